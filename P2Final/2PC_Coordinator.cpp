@@ -2,190 +2,680 @@
  * @file 2PC_Coordinator.cpp definition for Coordinator class
  * @author Nadezhda Chernova
  */
+#include <algorithm>
+#include <charconv>
 #include <vector>
-#include <iomanip>
 #include <string>
 #include <stdexcept>
-#include <tuple>
-#include <fstream>
-#include <sstream>
-#include <iostream>
+#include <random>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
 #include "TCPClient.h"
 #include "Protocol.h"
 #include "2PC_Coordinator.h"
+#include "Metrics.h"
 
 
 using namespace std;
 
-Coordinator::Coordinator(const string &logFilename) {
-    // Open the log file in append mode
-    ofstream logFile(logFilename, ios::app);
-    if (!logFile) {
-        throw runtime_error("Cannot open log file: " + logFilename);
-    }
+// metrics of every coordinator of the process (see Metrics.h)
+static Histogram &voteLatency = metrics().histogram(
+        "coordinator_vote_latency_seconds",
+        "Time from sending a vote request to the participant's vote");
+static Histogram &commitLatency = metrics().histogram(
+        "coordinator_commit_latency_seconds",
+        "Time from the start of a committed transaction to its last ACK");
+static const char *const OUTCOMES = "coordinator_transactions_total";
+static const char *const OUTCOMES_HELP = "Transactions run, by outcome";
+static Counter &committedCount = metrics().counter(OUTCOMES, OUTCOMES_HELP,
+                                                   "outcome=\"commit\"");
+static Counter &abortedCount = metrics().counter(OUTCOMES, OUTCOMES_HELP,
+                                                 "outcome=\"abort\"");
+static Counter &unknownCount = metrics().counter(OUTCOMES, OUTCOMES_HELP,
+                                                 "outcome=\"unknown\"");
+static const char *const ABORTS = "coordinator_aborts_total";
+static const char *const ABORTS_HELP = "Transactions aborted, by reason";
+static Counter &abortVoted = metrics().counter(
+        ABORTS, ABORTS_HELP, "reason=\"vote_abort\"");
+static Counter &abortNoVote = metrics().counter(
+        ABORTS, ABORTS_HELP, "reason=\"no_vote\"");
+static Counter &abortPresumed = metrics().counter(
+        ABORTS, ABORTS_HELP, "reason=\"presumed_abort\"");
+static Counter &unacknowledged = metrics().counter(
+        "coordinator_unacknowledged_total",
+        "Commits not acknowledged by every participant in time");
+
+Coordinator::Coordinator(const string &logFilename,
+                         const CoordinatorOptions &options)
+        : options(options),
+          logger(logFilename, options.log),
+          decisions(logFilename.substr(0, logFilename.find_last_of('.')) +
+                    ".dec"),
+          pool(options.connections,
+               static_cast<int>(options.connectTimeout.count())) {
+    if (options.pipelineDepth == 0)
+        throw runtime_error("Pipeline depth must be at least 1");
+    // a batch of transfers within one bank has two legs per transfer
+    if (options.batchSize == 0 || options.batchSize > MAX_LEGS / 2)
+        throw runtime_error("Batch size must be between 1 and " +
+                            to_string(MAX_LEGS / 2));
+    if (options.traceEvery == 0)
+        throw runtime_error("Trace sampling must be at least 1");
 
-    // Ensure file is writable
-    logFile << "\nLog file opened successfully" << endl;
-    if (!logFile.good()) {
-        throw runtime_error("Cannot write to log file: " + logFilename);
+    log("Log file opened successfully");
+    if (decisions.pending() > 0)
+        log(to_string(decisions.pending()) + " commits of earlier runs are "
+            "not acknowledged by every participant yet");
+    if (options.decisionPort != 0) {
+        inquiries = make_unique<DecisionServer>(options.decisionPort,
+                                                decisions, logger);
+        log("Answering DECISION-REQUESTs on port " +
+            to_string(options.decisionPort));
+    }
+    if (options.adminPort != 0) {
+        admin = make_unique<MetricsServer>(options.adminPort, metrics());
+        log("Serving metrics on admin port " + to_string(options.adminPort));
+    }
+    if (!options.traceFile.empty()) {
+        if (!tracer().enabled())
+            tracer().enable();
+        log("Tracing one transaction in " + to_string(options.traceEvery) +
+            " to " + options.traceFile);
     }
-    logFile.close();
 
-    // Assign logFilename after validation
-    this->logFilename = logFilename;
+    random_device seed;
+    nextTxn = (static_cast<uint64_t>(seed()) << 32) | seed();
 }
 
 Coordinator::~Coordinator() {
+    inquiries.reset();
+    if (decisions.pending() > 0)
+        log(to_string(decisions.pending()) + " commits are not acknowledged "
+            "by every participant; their decisions stay logged", LOG_WARN);
+    if (!options.traceFile.empty()) {
+        try {
+            size_t spans = tracer().dump(options.traceFile, "coordinator");
+            log("Wrote " + to_string(spans) + " spans to " +
+                options.traceFile);
+        } catch (const runtime_error &e) {
+            log(e.what(), LOG_ERROR);
+        }
+    }
     log("Shutting down gracefully");
 }
 
 void Coordinator::callParticipants(const string &accountFrom,
                                    const string &accountTo,
-                                   double amount,
+                                   Money amount,
                                    const vector<pair<string, u_short>> &banks) {
-    for (const auto &bank: banks) {
-        addParticipant(bank.first, bank.second);
+    if (banks.size() != 2)
+        throw runtime_error("A transfer needs exactly two participants");
+    runTransfers({{amount, banks[0].first, banks[0].second, accountFrom,
+                   banks[1].first, banks[1].second, accountTo}});
+}
+
+size_t Coordinator::runTransfers(const vector<Transfer> &transfers) {
+    arena.reset(); // the transactions of the previous call are gone
+    pmr::vector<size_t> all(transfers.size(), &arena);
+    for (size_t i = 0; i < all.size(); i++)
+        all[i] = i;
+    pmr::vector<Transaction> transactions = group(transfers, all,
+                                                  options.batchSize, &arena);
+    size_t committed = runWindows(transactions);
+
+    // One bad transfer aborts its whole batch: run the others on their own
+    pmr::vector<size_t> retry(&arena);
+    for (const auto &transaction: transactions) {
+        // a batch that may have committed in one phase must not run again
+        if (!transaction.commit && !transaction.unknown &&
+            transaction.transfers.size() > 1) {
+            log(LogLine() << "Retrying the " << transaction.transfers.size()
+                          << " transfers of transaction #" << transaction.txn
+                          << " one by one");
+            retry.insert(retry.end(), transaction.transfers.begin(),
+                         transaction.transfers.end());
+        }
     }
-    bool twoPC = sendVoteRequest(amount, accountFrom, accountTo);
-    if (twoPC) {
-        sendGlobalCommit();
-    } else {
-        sendGlobalAbort();
+    if (!retry.empty()) {
+        transactions = group(transfers, retry, 1, &arena);
+        committed += runWindows(transactions);
     }
+    return committed;
 }
 
-void Coordinator::addParticipant(const string &host, u_short port) {
-    participants.emplace_back(TCPClient(host, port), host, port, INIT);
-    log("Connected to participant " + host + ":" + to_string(port));
+size_t Coordinator::runTransactions(const vector<vector<Posting>> &postings) {
+    arena.reset();
+    pmr::vector<Transaction> transactions(&arena);
+    transactions.reserve(postings.size());
+    for (size_t i = 0; i < postings.size(); i++) {
+        if (postings[i].empty())
+            throw runtime_error("A transaction needs at least one posting");
+        Transaction &transaction = transactions.emplace_back(&arena);
+        for (const auto &posting: postings[i]) {
+            Branch &at = branch(transaction, posting.host, posting.port);
+            if (at.deltas.size() == MAX_LEGS)
+                throw runtime_error("More than " + to_string(MAX_LEGS) +
+                                    " postings at " + endpoint(at));
+            at.deltas.push_back({posting.account, posting.amount});
+        }
+        transaction.transfers.push_back(i);
+    }
+    return runWindows(transactions);
 }
 
-bool Coordinator::sendVoteRequest(double amount, const string &accountFrom,
-                                  const string &accountTo) {
-    string response; // hold response from participants
-    vector<string> messages = {
-            string(toString(VOTE_REQUEST)) + " " + accountFrom + " " +
-            formatAmount(-amount),
-            string(toString(VOTE_REQUEST)) + " " + accountTo + " " +
-            formatAmount(amount)};
+/**
+ * Appends "host:port" to a key
+ */
+static void appendEndpoint(pmr::string &key, const string &host,
+                           u_short port) {
+    char digits[8];
+    key += host;
+    key += ':';
+    key.append(digits, to_chars(digits, digits + sizeof(digits), port).ptr);
+}
 
-    using size_type = vector<tuple<TCPClient, string,
-    unsigned short, ParticipantState>>::size_type;
-    // Send request to participants
-    for (size_type i = 0; i < participants.size(); i++) {
-        log("Sending message '" + messages[i] + "' to " +
-            get<1>(participants[i]) + ":" +
-            to_string(get<2>(participants[i])));
-        get<0>(participants[i]).send_request(messages[i]);
-    }
+pmr::vector<Coordinator::Transaction>
+Coordinator::group(const vector<Transfer> &transfers,
+                   const pmr::vector<size_t> &indexes, size_t batchSize,
+                   pmr::memory_resource *arena) {
+    pmr::vector<Transaction> transactions(arena);
+    // participant pair -> transaction
+    pmr::unordered_map<pmr::string, size_t> open(arena);
+    pmr::string pair(arena);
+    for (size_t i: indexes) {
+        const Transfer &transfer = transfers[i];
+        pair.clear();
+        appendEndpoint(pair, transfer.hostFrom, transfer.portFrom);
+        pair += '>';
+        appendEndpoint(pair, transfer.hostTo, transfer.portTo);
+        auto [it, fresh] = open.try_emplace(pair, transactions.size());
+        if (fresh)
+            transactions.emplace_back(arena);
+        Transaction &transaction = transactions[it->second];
 
-    // Get response and process it
-    for (auto &bank: participants) {
-        response = get<0>(bank).get_response();
-        if (!processResponse(response)) {
-            get<3>(bank) = ABORT; // update state to ABORT
-        } else {
-            get<3>(bank) = COMMIT; // update state to COMMIT
-        }
+        branch(transaction, transfer.hostFrom, transfer.portFrom)
+                .deltas.push_back({transfer.accountFrom, -transfer.amount});
+        branch(transaction, transfer.hostTo, transfer.portTo)
+                .deltas.push_back({transfer.accountTo, transfer.amount});
+        transaction.transfers.push_back(i);
+        if (transaction.transfers.size() == batchSize)
+            open.erase(it); // full, the pair's next transfer starts another
     }
+    return transactions;
+}
 
-    // Return true/false based on updated state
-    for (auto &bank: participants) {
-        if (get<3>(bank) == ABORT) {
-            return false;
+Coordinator::Branch &Coordinator::branch(Transaction &transaction,
+                                         string_view host, u_short port) {
+    for (auto &existing: transaction.branches)
+        if (existing.port == port && existing.host == host)
+            return existing;
+    // the legs go where the transaction is, e.g. into the arena
+    transaction.branches.push_back(
+            {host, port, pmr::vector<Delta>(
+                    transaction.branches.get_allocator().resource())});
+    return transaction.branches.back();
+}
+
+size_t Coordinator::runWindows(pmr::vector<Transaction> &transactions) {
+    size_t committed = 0;
+    for (size_t first = 0; first < transactions.size();
+         first += options.pipelineDepth) {
+        size_t last = min(transactions.size(), first + options.pipelineDepth);
+        for (size_t i = first; i < last; i++) {
+            Transaction &transaction = transactions[i];
+            transaction.txn = newTransaction();
+            size_t count = transaction.transfers.size();
+            size_t participants = transaction.branches.size();
+            LogLine line;
+            line << "Starting transaction #" << transaction.txn;
+            if (count > 1)
+                line << " (" << count << " transfers)";
+            if (participants > 2)
+                line << " across " << participants << " participants";
+            log(line);
         }
+        // inquiries for these ids are answered from now on
+        decisions.issue(transactions[first].txn, nextTxn & ~IMPLICIT_TXN);
+        WindowTiming timing;
+        timing.transactions = last - first;
+        auto start = chrono::steady_clock::now();
+        sendVoteRequests(transactions.data() + first, last - first);
+        auto voted = chrono::steady_clock::now();
+        timing.committed = sendDecisions(transactions.data() + first,
+                                         last - first, timing);
+        timing.vote = voted - start;
+        timing.decision = chrono::steady_clock::now() - voted -
+                          timing.logSync;
+        committed += timing.committed;
+        auto total = timing.vote + timing.logSync + timing.decision;
+        for (size_t i = first; i < last; i++)
+            if (transactions[i].commit)
+                commitLatency.record(total);
+        if (windowObserver)
+            windowObserver(timing);
     }
-    return true;
+    return committed;
 }
 
-void Coordinator::log(const string &message) {
-    cout << message << endl;
+void Coordinator::observeWindows(
+        function<void(const WindowTiming &)> observer) {
+    windowObserver = move(observer);
+}
 
-    // Add log messages to the end of file without overwriting existing
-    ofstream logFile(logFilename, ios::app);
-    if (!logFile) {
-        throw runtime_error("Unable to open log file");
+uint64_t Coordinator::newTransaction() {
+    uint64_t txn;
+    do {
+        txn = nextTxn++ & ~IMPLICIT_TXN;
+    } while (txn == 0);
+    return txn;
+}
+
+Coordinator::Branch *Coordinator::Waiting::answered(uint64_t txn) {
+    for (size_t i = next; i < branches.size(); i++) {
+        auto &[id, branch] = branches[i];
+        if (branch == nullptr || id != txn)
+            continue;
+        Branch *found = branch;
+        branch = nullptr;
+        remaining--;
+        while (next < branches.size() && branches[next].second == nullptr)
+            next++;
+        return found;
     }
-    logFile << message << endl;
-    logFile.close();
+    return nullptr;
 }
 
-string Coordinator::formatAmount(double amount) {
-    ostringstream stream;
-    stream << fixed << setprecision(2) << amount;
-    return stream.str();
+Coordinator::Waiting &Coordinator::Awaiting::on(TCPClient *connection) {
+    for (size_t i = 0; i < used; i++)
+        if (waiting[i].connection == connection)
+            return waiting[i];
+    if (used == waiting.size())
+        waiting.emplace_back();
+    Waiting &added = waiting[used++];
+    added.connection = connection;
+    added.branches.clear();
+    added.next = 0;
+    added.remaining = 0;
+    return added;
 }
 
-bool Coordinator::processResponse(const string &response) {
-    Protocol protocol = toProtocol(response);
-    switch (protocol) {
-        case VOTE_COMMIT:
-            return true;
-        case VOTE_ABORT:
-            return false;
-        default:
-            log("Invalid response received: " + response);
-            return false;
+bool Coordinator::send(uint64_t txn, Branch &branch, const Message &message,
+                       Awaiting &awaiting, bool reply) {
+    try {
+        bool trace = (message.flags & MESSAGE_TRACED) != 0;
+        uint64_t connects = pool.connectCount();
+        auto start = trace ? chrono::steady_clock::now()
+                           : chrono::steady_clock::time_point();
+        TCPClient &connection = pool.connection(branch.host, branch.port, txn);
+        if (trace && pool.connectCount() != connects)
+            tracer().record(SPAN_CONNECT, txn, start,
+                            chrono::steady_clock::now(), message.type,
+                            branch.port);
+        connection.queue_request(message);
+        Waiting &waiting = awaiting.on(&connection);
+        if (reply) {
+            waiting.branches.emplace_back(txn, &branch);
+            waiting.remaining++;
+        }
+        return true;
+    }
+    catch (const runtime_error &e) {
+        log(LogLine() << "Unable to reach " << branch.host << ':'
+                      << branch.port << ": " << e.what(), LOG_WARN);
+        return false;
     }
 }
 
-void Coordinator::sendGlobalCommit() {
-   string response; // hold response from participants
-   bool isCommitted = true; // checks for ACK messages
+template<typename Received>
+void Coordinator::gather(Awaiting &awaiting, chrono::milliseconds timeout,
+                         chrono::steady_clock::time_point &flushed,
+                         Received &&received) {
+    auto deadline = chrono::steady_clock::now() + timeout;
 
-    // Send request
-    for (auto &bank: participants) {
-        log("Sending message '" + string(toString(GLOBAL_COMMIT)) + "' to " +
-            get<1>(bank) + ":" + to_string(get<2>(bank)));
-        get<0>(bank).send_request(toString(GLOBAL_COMMIT));
+    // Send everything first, so all participants work at the same time
+    for (size_t i = 0; i < awaiting.used; i++) {
+        Waiting &waiting = awaiting.waiting[i];
+        try {
+            waiting.connection->flush();
+        }
+        catch (const runtime_error &e) {
+            dropConnection(waiting, e.what());
+        }
     }
+    flushed = chrono::steady_clock::now();
 
-    // Get response
-    for (auto &bank: participants) {
-        response = get<0>(bank).get_response();
-        if (response != toString(ACK)) {
-            cerr << "Failed to receive " + string(toString(ACK)) +
-                    " from "
-                 << get<1>(bank) + ":" +
-                    to_string(get<2>(bank))
-                 << endl;
-           isCommitted = false;
-        } else {
-            log("'" + response + "' received from " + get<1>(bank) + ":" +
-                to_string(get<2>(bank)));
+    while (true) {
+        // Take the replies already received, poll the connections still
+        // owing some
+        polls.clear();
+        polled.clear();
+        for (size_t i = 0; i < awaiting.used; i++) {
+            Waiting &waiting = awaiting.waiting[i];
+            Message response;
+            while (waiting.remaining > 0 &&
+                   waiting.connection->next_response(response)) {
+                Branch *branch = waiting.answered(response.txn);
+                if (branch == nullptr) {
+                    log(LogLine() << "Response for unexpected transaction #"
+                                  << response.txn << " received", LOG_WARN);
+                    continue;
+                }
+                received(*branch, response);
+            }
+            if (waiting.remaining > 0) {
+                polls.push_back({waiting.connection->socket(), POLLIN, 0});
+                polled.push_back(&waiting);
+            }
+        }
+        if (polled.empty())
+            return;
+
+        auto left = chrono::ceil<chrono::milliseconds>(
+                deadline - chrono::steady_clock::now());
+        if (left.count() <= 0)
+            break;
+        int count = poll(polls.data(), polls.size(),
+                         static_cast<int>(left.count()));
+        if (count < 0 && errno != EINTR)
+            throw runtime_error(strerror(errno));
+
+        for (size_t i = 0; i < polled.size(); i++) {
+            if (polls[i].revents == 0)
+                continue;
+            try {
+                polled[i]->connection->receive(false);
+            }
+            catch (const runtime_error &e) {
+                dropConnection(*polled[i], e.what());
+            }
         }
     }
 
-    // Consider committed or aborted
-    if(isCommitted) {
-        log("Transaction committed");
-    } else {
-        log("Transaction aborted");
+    // Deadline passed
+    for (size_t i = 0; i < awaiting.used; i++) {
+        Waiting &waiting = awaiting.waiting[i];
+        if (waiting.remaining > 0)
+            dropConnection(waiting, (LogLine() << "no reply within "
+                                               << timeout.count()
+                                               << " ms").view());
     }
 }
 
-void Coordinator::sendGlobalAbort() {
-    string response; // hold response from participants
+void Coordinator::dropConnection(Waiting &waiting, string_view reason) {
+    for (size_t i = waiting.next; i < waiting.branches.size(); i++) {
+        const Branch *branch = waiting.branches[i].second;
+        if (branch != nullptr) {
+            log(LogLine() << "Lost connection to " << branch->host << ':'
+                          << branch->port << ": " << reason, LOG_WARN);
+            break;
+        }
+    }
+    waiting.abandon();
+    pool.discard(waiting.connection);
+    waiting.connection = nullptr; // may be reopened at the same address
+}
 
-    // Send global-abort to participants except those who already sent abort
-    for (auto &bank: participants) {
-        if (get<3>(bank) != ABORT) {
-            log("Sending message '" + string(toString(GLOBAL_ABORT)) + "' to " +
-                get<1>(bank) + ":" + to_string(get<2>(bank)));
-            get<0>(bank).send_request(toString(GLOBAL_ABORT));
+void Coordinator::sendVoteRequests(Transaction *window, size_t size) {
+    replies.clear();
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < size; i++) {
+        Transaction &transaction = window[i];
+        // a participant holding every leg decides alone, in one round; one
+        // left in doubt asks the decision port the request carries
+        Protocol request = transaction.branches.size() == 1
+                           ? ONE_PHASE_COMMIT : VOTE_REQUEST;
+        uint8_t flags = traced(transaction.txn) ? MESSAGE_TRACED : 0;
+        for (auto &branch: transaction.branches) {
+            legs.clear();
+            for (const auto &delta: branch.deltas)
+                legs.push_back({delta.account, delta.amount});
+            LogLine line;
+            line << "Sending message '" << toString(request);
+            if (legs.size() == 1)
+                line << " " << branch.deltas[0].account << " "
+                     << branch.deltas[0].amount << "'";
+            else
+                line << "' with " << legs.size() << " legs";
+            log(line << " to " << branch.host << ':' << branch.port);
+            send(transaction.txn, branch,
+                 {request, transaction.txn, legs.data(), legs.size(), flags,
+                  options.decisionPort},
+                 replies);
+        }
+    }
 
-            // Get response
-            response = get<0>(bank).get_response();
-            if (response != toString(ACK)) {
-                cerr << "Failed to receive " + string(toString(ACK)) +
-                        "from "
-                     << get<1>(bank) + ":" +
-                        to_string(get<2>(bank))
-                     << endl;
-            } else {
-                log("'" + response + "' received from " + get<1>(bank) + ":" +
-                    to_string(get<2>(bank)));
+    auto sent = chrono::steady_clock::now();
+    chrono::steady_clock::time_point flushed;
+    gather(replies, options.voteTimeout, flushed,
+           [this, sent, &flushed](Branch &branch, const Message &response) {
+        auto now = chrono::steady_clock::now();
+        voteLatency.record(now - sent);
+        if (traced(response.txn))
+            tracer().record(SPAN_VOTE_WAIT, response.txn, flushed, now,
+                            response.type, branch.port);
+        if (response.type == ACK) { // committed in one phase
+            branch.state = COMMIT;
+            branch.acked = true;
+            return;
+        }
+        if (response.type == VOTE_READONLY) { // done, skips phase 2
+            branch.state = READONLY;
+            branch.acked = true;
+            return;
+        }
+        branch.state = processResponse(response) ? COMMIT : ABORT;
+    });
+    for (size_t i = 0; i < size; i++)
+        if (traced(window[i].txn))
+            tracer().record(SPAN_VOTE_SEND, window[i].txn, start, flushed,
+                            window[i].branches.size() == 1
+                            ? ONE_PHASE_COMMIT : VOTE_REQUEST);
+}
+
+size_t Coordinator::sendDecisions(Transaction *window, size_t size,
+                                  WindowTiming &timing) {
+    // Presumed abort: only commits are logged, those of the whole window
+    // with one sync, and none is announced before it is durable
+    // Branches acknowledged in phase 1 (committed in one phase, or read
+    // only) are done; a transaction with none left needs no record
+    auto holding = [](const Branch &branch) {
+        return branch.state == COMMIT && !branch.acked;
+    };
+    vector<uint64_t> &commits = windowCommits;
+    commits.clear();
+    for (size_t i = 0; i < size; i++) {
+        Transaction &transaction = window[i];
+        transaction.commit = all_of(
+                transaction.branches.begin(), transaction.branches.end(),
+                [](const Branch &branch) {
+                    return branch.state == COMMIT || branch.state == READONLY;
+                });
+        // a one-phase commit that got no reply may have been applied
+        transaction.unknown = transaction.branches.size() == 1 &&
+                              transaction.branches[0].state == INIT;
+        if (transaction.commit &&
+            any_of(transaction.branches.begin(), transaction.branches.end(),
+                   holding))
+            commits.push_back(transaction.txn);
+    }
+    size_t decided = commits.size();
+    auto logging = chrono::steady_clock::now();
+    decisions.commit(commits);
+    auto logged = chrono::steady_clock::now();
+    timing.logSync = logged - logging;
+    for (uint64_t txn: commits)
+        if (traced(txn))
+            tracer().record(SPAN_LOG_SYNC, txn, logging, logged);
+    if (commits.size() < decided) {
+        for (size_t i = 0; i < size; i++) {
+            Transaction &transaction = window[i];
+            if (transaction.commit &&
+                any_of(transaction.branches.begin(),
+                       transaction.branches.end(), holding) &&
+                find(commits.begin(), commits.end(), transaction.txn) ==
+                commits.end()) {
+                log(LogLine() << "Transaction #" << transaction.txn
+                              << " was presumed aborted by a participant "
+                                 "that asked, aborting", LOG_WARN);
+                transaction.commit = false;
             }
         }
     }
-    log("Transaction aborted");
+
+    replies.clear();
+    tracedDecisions.clear();
+    for (size_t i = 0; i < size; i++) {
+        Transaction &transaction = window[i];
+        Protocol decision = transaction.commit ? GLOBAL_COMMIT : GLOBAL_ABORT;
+        uint8_t flags = traced(transaction.txn) ? MESSAGE_TRACED : 0;
+        bool decided = false;
+
+        for (auto &branch: transaction.branches) {
+            if (branch.state == INIT)
+                log(LogLine() << "No vote for transaction #"
+                              << transaction.txn << " from " << branch.host
+                              << ':' << branch.port << ", presuming abort",
+                    LOG_WARN);
+            // Participants that voted abort have already forgotten the
+            // transaction, one that committed it in one phase or voted
+            // read-only is done; unreachable ones may still hold it
+            if (branch.state == ABORT || branch.acked)
+                continue;
+            log(LogLine() << "Sending message '" << toString(decision)
+                          << "' to " << branch.host << ':' << branch.port);
+            // an abort is not acknowledged: a participant that misses it
+            // asks and is told abort (presumed) anyway
+            send(transaction.txn, branch,
+                 {decision, transaction.txn, nullptr, 0, flags}, replies,
+                 transaction.commit);
+            decided = true;
+        }
+        if (flags != 0 && decided)
+            tracedDecisions.push_back(&transaction);
+    }
+
+    chrono::steady_clock::time_point flushed;
+    gather(replies, options.ackTimeout, flushed,
+           [this, &flushed](Branch &branch, const Message &response) {
+        if (traced(response.txn))
+            tracer().record(SPAN_ACK_WAIT, response.txn, flushed,
+                            chrono::steady_clock::now(), response.type,
+                            branch.port);
+        if (response.type != ACK) {
+            log(LogLine() << "Failed to receive " << toString(ACK)
+                          << " from " << branch.host << ':' << branch.port,
+                LOG_WARN);
+            return;
+        }
+        branch.acked = true;
+        log(LogLine() << "'" << toString(response.type) << "' received from "
+                      << branch.host << ':' << branch.port);
+    });
+    for (const Transaction *transaction: tracedDecisions)
+        tracer().record(SPAN_DECISION_SEND, transaction->txn, logged, flushed,
+                        transaction->commit ? GLOBAL_COMMIT : GLOBAL_ABORT);
+
+    size_t committed = 0;
+    vector<uint64_t> &acknowledged = windowAcknowledged;
+    acknowledged.clear();
+    for (size_t i = 0; i < size; i++) {
+        const Transaction &transaction = window[i];
+        LogLine line;
+        line << "Transaction #" << transaction.txn;
+        if (transaction.unknown) {
+            unknownCount.add();
+            const Branch &branch = transaction.branches[0];
+            log(line << " has an unknown outcome: " << branch.host << ':'
+                     << branch.port << " did not answer its "
+                     << toString(ONE_PHASE_COMMIT), LOG_ERROR);
+            continue;
+        }
+        if (!transaction.commit) {
+            abortedCount.add();
+            auto voted = [](ParticipantState state) {
+                return [state](const Branch &branch) {
+                    return branch.state == state;
+                };
+            };
+            const auto &branches = transaction.branches;
+            if (any_of(branches.begin(), branches.end(), voted(ABORT)))
+                abortVoted.add();
+            else if (any_of(branches.begin(), branches.end(), voted(INIT)))
+                abortNoVote.add();
+            else
+                abortPresumed.add(); // a participant asked before the commit
+            log(line << " aborted");
+            continue;
+        }
+        committed += transaction.transfers.size();
+        committedCount.add();
+        bool acked = all_of(transaction.branches.begin(),
+                            transaction.branches.end(),
+                            [](const Branch &branch) { return branch.acked; });
+        if (acked)
+            acknowledged.push_back(transaction.txn);
+        else
+            unacknowledged.add();
+        log(line << (acked ? " committed"
+                           : " committed, not acknowledged by every "
+                             "participant"));
+    }
+    decisions.end(acknowledged); // the others may still be asked for
+    return committed;
+}
+
+vector<Money> Coordinator::balances(const string &host, u_short port,
+                                    const vector<string> &accounts) {
+    if (accounts.empty() || accounts.size() > MAX_LEGS)
+        throw runtime_error("A balance inquiry needs 1 to " +
+                            to_string(MAX_LEGS) + " accounts");
+    uint64_t txn = newTransaction(); // only matches the reply
+    Branch branch{host, port, {}};
+    vector<Leg> legs;
+    for (const auto &account: accounts)
+        legs.push_back({account, Money()});
+    log("Sending message '" + string(toString(BALANCE_INQUIRY)) + "' for " +
+        to_string(accounts.size()) + " accounts to " + endpoint(branch));
+    Awaiting awaiting;
+    if (!send(txn, branch, {BALANCE_INQUIRY, txn, legs.data(), legs.size()},
+              awaiting))
+        throw runtime_error("Unable to reach " + endpoint(branch));
+
+    vector<Money> result;
+    Protocol answer = UNKNOWN_PROTOCOL;
+    chrono::steady_clock::time_point flushed;
+    gather(awaiting, options.voteTimeout, flushed,
+           [&](Branch &, const Message &response) {
+        answer = response.type;
+        for (size_t i = 0; i < response.legCount; i++)
+            result.push_back(response.legs[i].amount);
+    });
+    if (answer == UNKNOWN_PROTOCOL)
+        throw runtime_error("No balances from " + endpoint(branch));
+    if (answer != BALANCE || result.size() != accounts.size())
+        throw runtime_error(endpoint(branch) + " replied " +
+                            toString(answer) + ": unknown account");
+    return result;
+}
+
+void Coordinator::log(string_view message, LogLevel level) {
+    logger.log(level, message);
+}
+
+bool Coordinator::processResponse(const Message &response) {
+    switch (response.type) {
+        case VOTE_COMMIT:
+            return true;
+        case VOTE_ABORT:
+            return false;
+        default:
+            log(LogLine() << "Invalid response received: "
+                          << toString(response.type), LOG_WARN);
+            return false;
+    }
+}
+
+string Coordinator::endpoint(const Branch &branch) {
+    return string(branch.host) + ":" + to_string(branch.port);
 }
@@ -5,22 +5,154 @@
 
 #pragma once
 
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <poll.h>
 #include <vector>
 #include <string>
-#include <tuple>
+#include <string_view>
+#include <unordered_map>
+#include "Arena.h"
+#include "ConnectionPool.h"
+#include "DecisionLog.h"
+#include "DecisionServer.h"
+#include "Logger.h"
+#include "MetricsServer.h"
 #include "TCPClient.h"
+#include "Tracer.h"
+#include "WireFormat.h"
 
 using namespace std;
 
+/**
+ * @struct CoordinatorOptions tuning knobs of a coordinator
+ */
+struct CoordinatorOptions {
+    // connections kept open to each participant
+    size_t connections = 1;
+    // transactions whose messages are pipelined together
+    size_t pipelineDepth = 64;
+    // transfers between the same two participants run as one transaction
+    size_t batchSize = 1;
+    // longest wait for a connection to a participant, or for a send
+    chrono::milliseconds connectTimeout{1000};
+    // longest wait for a participant's vote; no vote in time means abort
+    chrono::milliseconds voteTimeout{2000};
+    // longest wait for a participant's acknowledgement of the decision
+    chrono::milliseconds ackTimeout{2000};
+    // port answering the DECISION-REQUESTs of participants, 0 for none
+    u_short decisionPort = 0;
+    // admin port serving the metrics (see MetricsServer), 0 for none
+    u_short adminPort = 0;
+    // spans of traced transactions are dumped here on exit (see Tracer),
+    // no tracing if empty
+    string traceFile;
+    // one transaction in this many is traced
+    size_t traceEvery = 1;
+    // diagnostic log (logFilename)
+    LoggerOptions log;
+};
+
+/**
+ * @struct Transfer one transfer of an amount between accounts of two
+ * participants
+ */
+struct Transfer {
+    Money amount;        // amount to be transferred
+    string hostFrom;     // participant holding accountFrom
+    u_short portFrom;
+    string accountFrom;  // account from which the amount is transferred
+    string hostTo;       // participant holding accountTo
+    u_short portTo;
+    string accountTo;    // account to which the amount is transferred
+};
+
+/**
+ * @struct Posting one leg of a multi-leg transaction: an amount deposited
+ * into or withdrawn from an account of a participant
+ */
+struct Posting {
+    string host;     // participant holding the account
+    u_short port;
+    string account;  // account at the participant
+    Money amount;    // deposited if positive, withdrawn if negative
+};
+
+/**
+ * @struct WindowTiming how long the phases of one pipeline window took; all
+ * transactions of a window run their phases together, so each of them
+ * takes about as long
+ */
+struct WindowTiming {
+    size_t transactions = 0;          // transactions in the window
+    size_t committed = 0;             // transfers committed
+    chrono::nanoseconds vote{0};      // phase 1, vote requests to last vote
+    chrono::nanoseconds logSync{0};   // decision log write and sync
+    chrono::nanoseconds decision{0};  // phase 2, decisions to last ACK
+};
+
 /**
  * @class Coordinator class
  * The Coordinator class is responsible for managing 2-phase commit protocol,
- * which involves coordinating transactions between two participant banks.
+ * which involves coordinating transactions between participant banks.
  * It sends transaction requests, collects votes from participants, and
  * decides whether to commit or abort the transaction based on the received
  * votes.
- * Class uses TCPClient for each connection it makes to the participants.
+ *
+ * A coordinator is long-lived: it keeps a pool of persistent connections to
+ * the participants (see ConnectionPool) and runs transfers in windows of
+ * CoordinatorOptions::pipelineDepth transactions. The vote requests of a
+ * whole window are sent to each participant in one write and the replies
+ * are matched to their transactions by id, then the decisions of the window
+ * are sent and acknowledged the same way.
+ *
+ * Replies from all participants are gathered concurrently with poll(), each
+ * participant within its own deadline. A participant that does not vote in
+ * time is presumed to abort, so its transactions abort instead of waiting
+ * for it; one that does not acknowledge in time only leaves the decision
+ * unacknowledged. Either way its connection is discarded and reopened by
+ * the next transaction.
+ *
+ * A transaction whose legs are all at one participant (e.g. a transfer
+ * within one bank) skips the vote: the participant gets a ONE-PHASE-COMMIT,
+ * applies the legs if they are valid and replies ACK, which saves a round
+ * trip, the decision log write and the participant's hold record. If it
+ * replies VOTE-COMMIT instead (it held the legs), phase 2 runs as usual. A
+ * one-phase commit without a reply has an unknown outcome; it is reported
+ * and never run again. A participant that votes VOTE-READONLY holds nothing
+ * and gets no decision; a transaction with only such votes needs no
+ * decision log record either.
+ *
+ * Decisions follow presumed abort (see DecisionLog): the commits of a window
+ * are recorded in a binary decision log next to the diagnostic log
+ * (log.txt -> log.dec) with one fdatasync before any GLOBAL-COMMIT is sent,
+ * and only commits wait for acknowledgements. GLOBAL-ABORT is neither logged
+ * nor acknowledged: a participant that misses it finds out by asking. With
+ * CoordinatorOptions::decisionPort a DecisionServer answers participants
+ * that ask for the outcome of an in-doubt transaction, including those of
+ * earlier runs still in the decision log; the port goes with every vote
+ * request, so that participants ask the coordinator that decides. The ids
+ * of each window are recorded as issued (DecisionLog::issue) before it is
+ * sent, and inquiries for ids this coordinator never issued are answered
+ * DECISION-UNKNOWN.
+ *
+ * Vote and commit latencies, outcomes and abort reasons are recorded in the
+ * process's metrics (see Metrics.h), served on CoordinatorOptions::adminPort.
+ * With CoordinatorOptions::traceFile one transaction in traceEvery is
+ * traced: its messages are marked so the participants trace it too, the
+ * coordinator's phases of it are recorded as spans (see Tracer) and the
+ * spans are dumped to the file by the destructor.
+ *
+ * Once the connections are open, running transfers does not allocate: the
+ * transactions of a runTransfers() or runTransactions() call live in an
+ * arena that the next call reuses (see Arena), they refer to the accounts
+ * and hosts of the caller's transfers instead of copying them, the
+ * bookkeeping of a window is kept for the next one and log messages are
+ * built in place (see LogLine). The transfers themselves must outlive
+ * the call.
  */
 class Coordinator {
 public:
@@ -33,97 +165,308 @@ public:
     enum ParticipantState {
         INIT,
         ABORT,
-        COMMIT
+        COMMIT,
+        READONLY // voted commit, holds nothing: left out of phase 2
     };
 
     /**
      * Constructs Coordinator object with specified log file.
      * @param logFilename filename where logs will be stored
-     * @throws runtime_error if log file cannot be opened, file is not writable
+     * @param options tuning knobs
+     * @throws runtime_error if log file or decision log cannot be opened,
+     * the decision or admin port cannot be served, or traceEvery is 0
      */
-    explicit Coordinator(const string &logFilename);
+    explicit Coordinator(const string &logFilename,
+                         const CoordinatorOptions &options = CoordinatorOptions());
 
     /**
-     * Destructor
+     * Destructor, dumps the trace if tracing
      */
     ~Coordinator();
 
     /**
-     * Initiates connection with participants using TCPClient, sends them
-     * vote requests and then decides whether to commit or abort transaction
-     * based on their responses.
+     * Runs a single transfer: sends vote requests to the participants and
+     * then decides whether to commit or abort the transaction based on
+     * their responses.
      * @param accountFrom account from which the amount is to be transferred
      * @param accountTo account to which the amount is to be transferred
      * @param amount amount to be transferred
      * @param participants vector of pairs with host and port of
      * each participant
+     * @throws runtime_error if there are not exactly two participants
      */
     void callParticipants(const string &accountFrom, const string &accountTo,
-                          double amount,
+                          Money amount,
                           const vector<pair<string, u_short>> &participants);
 
     /**
-     * Adds a participant to the coordinator's list
-     * @param host host address of the participant
-     * @param port port number of the participant
+     * Runs transfers, pipelining up to CoordinatorOptions::pipelineDepth
+     * transactions over the pooled connections. Transfers between the same
+     * two participants are batched, up to CoordinatorOptions::batchSize per
+     * transaction, so each participant validates and logs the whole batch
+     * with one VOTE-REQUEST and one log sync. The transfers of a batch that
+     * aborts are run again one by one, so one bad transfer does not fail
+     * the others.
+     * @param transfers transfers to run
+     * @return number of transfers committed
      */
-    void addParticipant(const string &host, u_short port);
+    size_t runTransfers(const vector<Transfer> &transfers);
+
+    /**
+     * Runs multi-leg transactions, each spanning any number of
+     * participants, pipelined like runTransfers. Every participant gets one
+     * VOTE-REQUEST with all the legs of the transaction at it; the
+     * transaction commits only if all of them vote to commit.
+     * @param transactions postings of each transaction
+     * A posting of zero only checks that the account exists; a
+     * participant whose postings change nothing votes VOTE-READONLY and is
+     * left out of phase 2.
+     * @return number of transactions committed
+     * @throws runtime_error if a transaction has no postings or more than
+     * MAX_LEGS postings at one participant
+     */
+    size_t runTransactions(const vector<vector<Posting>> &transactions);
+
+    /**
+     * Asks a participant for the committed balances of accounts with one
+     * BALANCE-INQUIRY, which it answers from its account index without
+     * holds or log records
+     * @param host participant
+     * @param port participant's port
+     * @param accounts accounts at the participant, at most MAX_LEGS
+     * @return balance of each account, in the same order
+     * @throws runtime_error if the participant cannot be reached, does not
+     * answer within the vote timeout or does not know an account
+     */
+    vector<Money> balances(const string &host, u_short port,
+                           const vector<string> &accounts);
+
+    /**
+     * Reports how long the phases of every pipeline window took, for load
+     * generators and benchmarks
+     * @param observer called after each window on the calling thread, or
+     * empty to stop reporting
+     */
+    void observeWindows(function<void(const WindowTiming &)> observer);
 
     /**
      * Logs message (step, transaction made) to log file.
-     * Each action taken in the FSM is appended to a log file.
+     * Each action taken in the FSM is appended to a log file by a
+     * background thread (see Logger), so this never waits for I/O.
      *
      * @param message message to be logged
-     * @throws runtime_error If file cannot be opened
+     * @param level severity
      */
-    void log(const string &message);
+    void log(string_view message, LogLevel level = LOG_INFO);
+
+    /** @copydoc log(string_view, LogLevel) */
+    void log(const LogLine &message, LogLevel level = LOG_INFO) {
+        log(message.view(), level);
+    }
 
 private:
-    string logFilename; // filename where logs will be stored
+    /**
+     * @struct Delta amount deposited into or withdrawn from an account
+     */
+    struct Delta {
+        string_view account; // account at the participant, of the input
+        Money amount;    // amount to deposit or withdraw (depends on the sign)
+    };
 
-    // Tuple Access: used get<0>, get<1>, get<2>, and get<3> to access
-    // TCPClient, host, port, and state respectively in the tuple.
-    vector<tuple<TCPClient, string, u_short, ParticipantState>> participants;
+    /**
+     * @struct Branch the part of a transaction at one participant, sent to
+     * it as one VOTE-REQUEST that it validates all or nothing
+     */
+    struct Branch {
+        string_view host;           // participant, of the input
+        u_short port;
+        pmr::vector<Delta> deltas;  // legs at this participant
+        ParticipantState state = INIT; // vote, INIT while unknown
+        bool acked = false;            // decision acknowledged
+    };
 
     /**
-     * Sends vote request to participants and processes their responses.
-     * @param amount amount to be transferred
-     * @param accountFrom account from which the amount is to be transferred
-     * @param accountTo account to which the amount is to be transferred
-     * @return returns true if all participants agree to commit the transaction,
-     * false otherwise
+     * @struct Transaction a transaction of one or more transfers
      */
-    bool sendVoteRequest(double amount, const string &accountFrom,
-                         const string &accountTo);
+    struct Transaction {
+        explicit Transaction(pmr::memory_resource *arena)
+                : branches(arena), transfers(arena) {}
+
+        uint64_t txn = 0;              // assigned when the transaction starts
+        pmr::vector<Branch> branches;  // one per participant involved
+        pmr::vector<size_t> transfers; // indexes of the transfers it runs,
+                                       // or of its runTransactions() input
+        bool commit = false;           // decision
+        bool unknown = false;          // one-phase commit without a reply
+    };
 
     /**
-     * Processes response received from a participant.
-     * @param response from participant
-     * @return Returns true if response is VOTE_COMMIT, false if response is
-     * VOTE_ABORT or an invalid response.
+     * @struct Waiting branches waiting for a reply on one connection, in
+     * the order their requests were queued; replies mostly come in that
+     * order too
      */
-    bool processResponse(const string &response);
+    struct Waiting {
+        TCPClient *connection = nullptr;
+        vector<pair<uint64_t, Branch *>> branches; // nullptr once answered
+        size_t next = 0;      // first branch that may still be waiting
+        size_t remaining = 0; // branches still waiting
+
+        /**
+         * @return the branch waiting for a reply of a transaction, which
+         * waits no more, or nullptr if there is none
+         */
+        Branch *answered(uint64_t txn);
+
+        /** Gives up on the branches still waiting */
+        void abandon() {
+            next = branches.size();
+            remaining = 0;
+        }
+    };
 
     /**
-     * Sends a GLOBAL-COMMIT message to participants and processes their
-     * acknowledgements.
-     * Transaction is committed if coordinator received ACK for all
-     * participants, otherwise transaction is considered aborted.
+     * @struct Awaiting branches waiting for a reply, per connection. Every
+     * window reuses it, so it keeps the capacity of its vectors.
      */
-    void sendGlobalCommit();
+    struct Awaiting {
+        vector<Waiting> waiting; // the first `used` are in use
+        size_t used = 0;
+
+        /** @return the branches waiting on a connection, added if new */
+        Waiting &on(TCPClient *connection);
+
+        /** Forgets all connections and branches */
+        void clear() { used = 0; }
+    };
+
+    CoordinatorOptions options;
+    Logger logger;      // diagnostic log
+    DecisionLog decisions; // durable commit decisions
+    uint64_t nextTxn;   // id of the next transaction started
+    ConnectionPool pool; // persistent connections to the participants
+    unique_ptr<DecisionServer> inquiries; // answers participants, if enabled
+    unique_ptr<MetricsServer> admin; // serves the metrics, if enabled
+    function<void(const WindowTiming &)> windowObserver; // may be empty
+    Arena arena;           // transactions of the running call
+    Awaiting replies;      // branches of the window waiting for them
+    vector<Leg> legs;      // legs of the message being queued
+    vector<uint64_t> windowCommits;      // commits of the window to log
+    vector<uint64_t> windowAcknowledged; // commits of the window acked
+    vector<const Transaction *> tracedDecisions; // of the window
+    vector<pollfd> polls;       // connections gather() polls
+    vector<Waiting *> polled;   // their branches
 
     /**
-     * Sends a GLOBAL-ABORT message to all participants that have not
-     * already sent an abort response.
+     * Generates a transaction id. Ids start at a random point so transactions
+     * of different coordinator runs do not collide at the participants.
+     * @return new transaction id, never 0 and never an implicit id
      */
-    void sendGlobalAbort();
+    uint64_t newTransaction();
 
-     /**
-     * Formats an amount as a string with two decimal places
-     * @param amount to format
-     * @return formatted amount as string
+    /**
+     * @return true if a transaction is traced (see
+     * CoordinatorOptions::traceFile)
      */
-    string formatAmount(double amount);
-};
+    bool traced(uint64_t txn) const {
+        return !options.traceFile.empty() && txn % options.traceEvery == 0;
+    }
+
+    /**
+     * Groups transfers into transactions: transfers between the same pair
+     * of participants are batched, up to batchSize per transaction, in the
+     * order given.
+     * @param transfers all transfers
+     * @param indexes transfers to group
+     * @param batchSize most transfers per transaction
+     * @param arena memory of the transactions
+     * @return transactions, without ids yet
+     */
+    static pmr::vector<Transaction> group(const vector<Transfer> &transfers,
+                                          const pmr::vector<size_t> &indexes,
+                                          size_t batchSize,
+                                          pmr::memory_resource *arena);
+
+    /**
+     * @return a transaction's branch at a participant, added if new
+     */
+    static Branch &branch(Transaction &transaction, string_view host,
+                          u_short port);
+
+    /**
+     * Runs transactions in pipelined windows
+     * @param transactions transactions to run, decided on return
+     * @return number of transfers committed
+     */
+    size_t runWindows(pmr::vector<Transaction> &transactions);
+
+    /**
+     * Sends the vote requests of a window of transactions and records the
+     * vote of every branch. A branch whose participant cannot be reached
+     * keeps state INIT.
+     * @param window first transaction
+     * @param size number of transactions
+     */
+    void sendVoteRequests(Transaction *window, size_t size);
 
+    /**
+     * Decides every transaction of a window, logs the commits with one
+     * sync, sends GLOBAL-COMMIT or GLOBAL-ABORT and collects the
+     * acknowledgements of the commits.
+     * @param window first transaction, with votes
+     * @param size number of transactions
+     * @param timing gets the time of the log sync
+     * @return number of transfers committed
+     */
+    size_t sendDecisions(Transaction *window, size_t size,
+                         WindowTiming &timing);
+
+    /**
+     * Queues a message for a branch on the connection of its transaction
+     * @param txn transaction id
+     * @param branch branch the message is for
+     * @param message message to queue
+     * @param awaiting branches waiting for a reply, the branch is added
+     * @param reply the branch waits for a reply (else only the connection
+     * is added, to be flushed)
+     * @return false if the participant cannot be reached
+     */
+    bool send(uint64_t txn, Branch &branch, const Message &message,
+              Awaiting &awaiting, bool reply = true);
+
+    /**
+     * Flushes the queued messages of all connections and waits for the
+     * replies of all participants at once, until every awaiting branch got
+     * one or the timeout passed. Branches of a connection that fails or
+     * times out get no reply and the connection is discarded.
+     * @param awaiting branches waiting for a reply
+     * @param timeout longest wait for the replies
+     * @param flushed set once everything is written, before the first
+     * reply is received
+     * @param received called with each branch and its reply, as
+     * received(Branch &, const Message &)
+     */
+    template<typename Received>
+    void gather(Awaiting &awaiting, chrono::milliseconds timeout,
+                chrono::steady_clock::time_point &flushed,
+                Received &&received);
+
+    /**
+     * Gives up on the branches waiting on a connection and discards it
+     * @param waiting the connection and the branches waiting on it
+     * @param reason logged reason
+     */
+    void dropConnection(Waiting &waiting, string_view reason);
+
+    /**
+     * Processes a vote received from a participant.
+     * @param response from participant
+     * @return Returns true if response is VOTE_COMMIT, false if response is
+     * VOTE_ABORT or an invalid response.
+     */
+    bool processResponse(const Message &response);
 
+    /**
+     * @return "host:port" of a branch's participant
+     */
+    static string endpoint(const Branch &branch);
+};
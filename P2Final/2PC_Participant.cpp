@@ -4,23 +4,128 @@
  */
 
 #include "2PC_Participant.h"
+#include "Metrics.h"
 #include "Protocol.h"
+#include "ShardedParticipant.h"
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <fstream>
 #include <sstream>
-#include <iomanip>
 
 using namespace std;
 
+// metrics of every shard of the process (see Metrics.h)
+static const char *const VOTES = "participant_votes_total";
+static const char *const VOTES_HELP = "Answers to VOTE-REQUEST and "
+                                      "ONE-PHASE-COMMIT, by vote";
+static Counter &votedCommit = metrics().counter(VOTES, VOTES_HELP,
+                                                "vote=\"commit\"");
+static Counter &votedAbort = metrics().counter(VOTES, VOTES_HELP,
+                                               "vote=\"abort\"");
+static Counter &votedReadOnly = metrics().counter(VOTES, VOTES_HELP,
+                                                  "vote=\"readonly\"");
+static const char *const ABORTS = "participant_aborts_total";
+static const char *const ABORTS_HELP = "Transactions refused or aborted, "
+                                       "by reason";
+static Counter &abortNoAccount = metrics().counter(
+        ABORTS, ABORTS_HELP, "reason=\"no_account\"");
+static Counter &abortFunds = metrics().counter(
+        ABORTS, ABORTS_HELP, "reason=\"insufficient_funds\"");
+static Counter &abortDecided = metrics().counter(
+        ABORTS, ABORTS_HELP, "reason=\"global_abort\"");
+static Counter &commits = metrics().counter(
+        "participant_commits_total", "Transactions committed");
+static Counter &holdsPlaced = metrics().counter(
+        "participant_holds_total", "Holds placed by VOTE-COMMITs");
+static Gauge &holdsOpen = metrics().gauge(
+        "participant_holds_open", "Transactions holding funds (READY)");
+static Histogram &holdTime = metrics().histogram(
+        "participant_hold_seconds",
+        "Time a transaction held funds, from its vote to the decision");
+static Counter &inquiries = metrics().counter(
+        "participant_inquiries_total",
+        "In-doubt transactions the coordinator was asked about");
+
+/**
+ * Counts a refusal by its reason, see Participant::refusal()
+ * @param noAccount refused for lack of an account, else of funds
+ */
+static void countRefusal(bool noAccount) {
+    votedAbort.add();
+    (noAccount ? abortNoAccount : abortFunds).add();
+}
+
+/**
+ * @struct TxnName a transaction id as log messages name it (see
+ * operator<<)
+ */
+struct TxnName {
+    uint64_t txn;
+};
+
+/**
+ * Appends a transaction id to a log message: "transaction #42", or
+ * "connection #3" for the implicit transaction of a legacy connection
+ */
+static LogLine &operator<<(LogLine &line, TxnName name) {
+    if ((name.txn & IMPLICIT_TXN) != 0)
+        return line << "connection #" << ((name.txn & ~IMPLICIT_TXN) >> 32);
+    return line << "transaction #" << name.txn;
+}
+
+/**
+ * Derives the name of a file kept next to the accounts file
+ * @param accounts_filename e.g. acc1.txt
+ * @param extension e.g. ".wal"
+ * @return e.g. acc1.wal
+ */
+static string siblingFilename(const string &accounts_filename,
+                              const char *extension) {
+    size_t dot = accounts_filename.find_last_of('.');
+    return accounts_filename.substr(0, dot) + extension;
+}
+
 Participant::Participant(u_short serve_port, const string &accounts_filename,
-                         const string &log_filename) : TCPServer(serve_port),
-                                                       accounts_filename(
-                                                               accounts_filename),
-                                                       log_filename(
-                                                               log_filename) {
-    readAccounts(); // read an accounts text file on startup
+                         const string &log_filename,
+                         const ParticipantOptions &options,
+                         ShardedParticipant *group, unsigned shard)
+        : TCPServer(serve_port, group != nullptr),
+          accounts_filename(accounts_filename),
+          log_filename(log_filename),
+          options(options),
+          group(group),
+          shard(shard),
+          wal(ownFilename(".wal"), options.syncWindow, options.syncBatch),
+          ownLogger(group == nullptr
+                    ? make_unique<Logger>(log_filename, options.log)
+                    : nullptr),
+          logger(group == nullptr ? ownLogger.get() : &group->logger()) {
+    deltas.reserve(MAX_LEGS);
+    checkShardLayout();
+    if (group != nullptr)
+        watch(group->mailbox(shard).fd());
+    watch(inquirer.fd());
+    recover();
 }
 
 Participant::~Participant() {
+    try {
+        syncLog();
+        if (commitsSinceCheckpoint > 0)
+            checkpoint();
+        if (group == nullptr) { // readable copy of the balances
+            AccountTable escrow;
+            string header = "# checkpoint " + to_string(checkpointLsn) +
+                            "\n" + readEscrow(accounts_filename, escrow);
+            writeAccountsFile(accounts_filename, header, {&accounts});
+        }
+    } catch (const exception &e) {
+        log(e.what(), LOG_ERROR);
+    }
     log("Shutting down gracefully");
 }
 
@@ -30,177 +135,1175 @@ void Participant::stop() {
     TCPServer::stopServer();
 }
 
-void Participant::readAccounts() {
-    string account; // account number from file
-    string balance; // balance from file
-    double bal;     //  balance in another format for map
+string Participant::ownFilename(const char *extension) const {
+    if (group == nullptr)
+        return siblingFilename(accounts_filename, extension);
+    return siblingFilename(accounts_filename, "") + ".s" + to_string(shard) +
+           "of" + to_string(group->size()) + extension;
+}
 
-    // Open accounts file
-    ifstream inputFile(accounts_filename);
-    if (!inputFile.is_open()) {
-        throw runtime_error{
-                "Unable to open accounts file " + accounts_filename};
+void Participant::checkShardLayout() const {
+    // files of another layout matter once they hold records
+    string base = siblingFilename(accounts_filename, "");
+    string layout = group == nullptr ? ""
+                                     : "of" + to_string(group->size()) + ".";
+    vector<string> others;
+    if (group != nullptr) {
+        others.push_back(base + ".wal");
+        others.push_back(base + ".acct");
+        others.push_back(base + ".ckpt");
+    }
+    for (const char *pattern: {".s*of*.wal", ".s*of*.acct", ".s*of*.ckpt"}) {
+        glob_t found = {};
+        if (glob((base + pattern).c_str(), 0, nullptr, &found) == 0)
+            for (size_t i = 0; i < found.gl_pathc; i++) {
+                string name = found.gl_pathv[i];
+                if (layout.empty() ||
+                    name.find(layout, base.size()) == string::npos)
+                    others.push_back(name);
+            }
+        globfree(&found);
     }
+    for (const auto &name: others) {
+        struct stat info = {};
+        if (stat(name.c_str(), &info) == 0 && info.st_size > 0)
+            throw runtime_error(name + " was written with another number of "
+                                "shards; run with that number or remove the "
+                                "old log and account store files");
+    }
+}
 
-    // Read each line from file
-    while (getline(inputFile, balance, ' ')) {
-        getline(inputFile, account);
-        stringstream stream(balance); // convert balance to double (bal)
-        if (!(stream >> bal)) {
-            throw runtime_error("Invalid format of accounts file");
+void Participant::checkEscrow() {
+    uint64_t digest = group->escrowDigest();
+    if (accounts.escrowDigest() == 0) {
+        accounts.setEscrowDigest(digest);
+    } else if (accounts.escrowDigest() != digest) {
+        // the balances of the accounts that changed are sliced differently
+        throw runtime_error(ownFilename(".acct") + " was written with other "
+                            "escrow accounts; restore the \"# escrow\" lines "
+                            "of " + accounts_filename + " or remove the old "
+                            "log and account store files");
+    }
+}
+
+void Participant::readAccounts(AccountTable &imported) {
+    AccountLoad load = readAccountsFile(
+            accounts_filename, [&](const AccountKey &key, Money bal) {
+                if (group != nullptr && group->isEscrow(key))
+                    imported.insert(key) = group->slice(bal, shard);
+                else if (group == nullptr || group->owner(key) == shard)
+                    imported.insert(key) = bal;
+            }, [&](size_t accounts) {
+                imported.reserve(group == nullptr ? accounts
+                                                  : accounts / group->size());
+            });
+    checkpointLsn = load.lsn;
+    log("Read accounts file " + accounts_filename + ": " + load.summary());
+}
+
+AccountLoad Participant::readAccountsFile(
+        const string &filename,
+        const function<void(const AccountKey &, Money)> &add,
+        const function<void(size_t)> &expect) {
+    AccountLoad load = AccountLoader().load(filename, add, expect);
+    if (load.malformed > 0)
+        throw runtime_error("Invalid format of accounts file " + filename +
+                            ", " + to_string(load.malformed) +
+                            " malformed lines: " + load.describeProblems());
+    return load;
+}
+
+string Participant::readEscrow(const string &filename, AccountTable &escrow) {
+    ifstream inputFile(filename);
+    string line, lines;
+    while (getline(inputFile, line) && !line.empty() && line[0] == '#') {
+        istringstream header(line.substr(1));
+        string word, account;
+        if (header >> word >> account && word == "escrow") {
+            escrow.insert(account); // throws if the id is invalid
+            lines += "# escrow " + account + "\n";
         }
-        accounts[account] = bal; //  store account number and balance in map
     }
+    return lines;
+}
+
+void Participant::recover() {
+    auto started = chrono::steady_clock::now();
+    string storeFilename = ownFilename(".acct");
+
+    holding.clear();
+    spread.clear();
+    string source = "account store " + storeFilename;
+    if (!AccountStore::exists(storeFilename))
+        source = importAccounts(storeFilename); // first start
+    accounts.open(storeFilename); // drops what was not flushed
+    if (group != nullptr)
+        checkEscrow();
+    checkpointLsn = accounts.lsn();
+    size_t records = replayLog();
+    reserved.clear();
+    for (auto &entry: holding) {
+        reserve(entry.second);
+        entry.second.since = started; // in doubt since the restart
+    }
+    nextInquiry = started + options.inquiryAfter;
+
+    auto elapsed = chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now() - started);
+    log("Recovered " + to_string(accounts.size()) + " accounts (" +
+        to_string(accounts.bytesPerAccount()) + " bytes each) from " +
+        source + " (log record " + to_string(checkpointLsn) + "), replayed " +
+        to_string(records) + " log records, " + to_string(holding.size()) +
+        " transactions READY, in " + to_string(elapsed.count()) + " us");
+}
 
-    // Close file
-    inputFile.close();
+void Participant::loadCheckpoint(const Checkpoint &checkpoint,
+                                 AccountTable &imported) {
+    imported.reserve(checkpoint.size());
+    for (size_t i = 0; i < checkpoint.size(); i++)
+        imported.insert(checkpoint.account(i)) = checkpoint.balance(i);
+    checkpointLsn = checkpoint.lsn();
 }
 
-void Participant::log(const string &message) {
-    cout << message << endl;
-    // Open in append mode and write to log_filename
-    ofstream logFile(log_filename, std::ios::app);
-    if (!logFile) {
-        throw runtime_error("Unable to open log file");
+string Participant::importAccounts(const string &storeFilename) {
+    AccountTable imported;
+    string source;
+    string checkpointFilename = ownFilename(".ckpt");
+    bool migrated = Checkpoint::exists(checkpointFilename);
+    if (migrated) {
+        Checkpoint latest(checkpointFilename);
+        loadCheckpoint(latest, imported);
+        source = "checkpoint " + checkpointFilename;
+    } else {
+        readAccounts(imported);
+        source = "accounts file " + accounts_filename;
     }
-    logFile << message << endl;
-    logFile.close();
+    AccountStore::create(storeFilename, imported, checkpointLsn,
+                         group == nullptr ? 0 : group->escrowDigest());
+    if (migrated)
+        unlink(checkpointFilename.c_str()); // the store replaces it
+    return source + ", imported into " + storeFilename;
+}
+
+size_t Participant::replayLog() {
+    size_t applied = 0;
+    size_t records = wal.replay([&](const WalRecord &record) {
+        switch (record.type) {
+            case WAL_HOLD: {
+                // one record per leg, all with the same transaction id
+                Hold &hold = holding[record.txn];
+                AccountDelta leg{{}, record.amount};
+                AccountKey::pack(record.account, leg.account);
+                hold.legs.push_back(leg);
+                hold.lsn = record.lsn;
+                hold.alone = group == nullptr;
+                break;
+            }
+            case WAL_COMMIT:
+                holding.erase(record.txn);
+                // older commits are already in the store, and so may be
+                // some newer ones (see AccountStore)
+                if (record.lsn > checkpointLsn) {
+                    AccountKey key;
+                    if (!AccountKey::pack(record.account, key) ||
+                        !accounts.add(key, record.amount, record.lsn))
+                        throw runtime_error(
+                                "Write-ahead log commits to unknown account " +
+                                string(record.account));
+                    applied++;
+                }
+                break;
+            case WAL_ABORT:
+                holding.erase(record.txn);
+                break;
+            case WAL_DECIDER: // before the holds of the transaction
+                holding[record.txn].decider = Decider(
+                        record.account,
+                        static_cast<uint16_t>(record.amount.cents()));
+                break;
+        }
+    });
+    // a decider whose holds did not make it to the log before a crash
+    for (auto it = holding.begin(); it != holding.end();)
+        it = it->second.legs.empty() ? holding.erase(it) : next(it);
+    wal.startAfter(checkpointLsn);
+    commitsSinceCheckpoint = applied;
+    return records;
+}
+
+void Participant::log(string_view message, LogLevel level) {
+    if (group == nullptr)
+        logger->log(level, message);
+    else
+        logger->log(level, (LogLine() << "[shard " << shard << "] "
+                                      << message).view());
 }
 
 void Participant::start_client(const string &their_host,
                                u_short their_port) {
-    string message = "Accepted coordinator connection. State: INIT";
+    string message = "Accepted coordinator connection from " + their_host +
+                     ":" + to_string(their_port) + ". State: INIT";
     log(message);
-   }
+}
 
-bool Participant::process(const string &request) {
-    string command, account;
-    double amount;
-    ostringstream note;
-    stringstream stream(request);
+void Participant::end_client() {
+    uint64_t txn = implicit_txn(client_id());
+    auto state = spread.find(txn);
+    if (state != spread.end()) {
+        log(LogLine() << "Coordinator disconnected, releasing legs of "
+                      << TxnName{txn} << " on all shards", LOG_WARN);
+        state->second.to = {}; // nobody to tell
+        if (state->second.ready)
+            decideSpread(txn, state->second, false, ACK);
+        else if (!state->second.deciding)
+            state->second.aborted = true;
+    }
 
-    // Parse the command, account, and amount from request
-    stream >> command >> account >> amount;
+    auto it = holding.find(txn);
+    if (it != holding.end()) {
+        for (const auto &leg: it->second.legs)
+            log(LogLine() << "Coordinator disconnected, releasing hold from "
+                             "account " << leg.account.view(), LOG_WARN);
+        release(it->second);
+        dropHold(it);
+    }
+}
 
-    Protocol protocol = toProtocol(command);
-    switch (protocol) {
+bool Participant::process(const Message &request) {
+    const char *command = toString(request.type);
+    // legacy clients run exactly one transaction per connection
+    bool keepOpen = (request.txn & IMPLICIT_TXN) == 0;
+    replyTo = {shard, client_id(), false};
+    traced = (request.flags & MESSAGE_TRACED) != 0 && tracer().enabled();
+    auto start = traced ? chrono::steady_clock::now()
+                        : chrono::steady_clock::time_point();
+    requestDecider = request.decisionPort == 0
+              ? Decider() : Decider(client_host(), request.decisionPort);
+    if (carriesLegs(request.type))
+        packLegs(request);
+
+    // a request decided by other shards is answered (and a legacy
+    // connection closed) with a reply sent later
+    if (group != nullptr && request.type != BALANCE_INQUIRY && route(request))
+        return true;
+
+    bool open;
+    switch (request.type) {
+
+        case BALANCE_INQUIRY:
+            // answered later if other shards own some of the accounts
+            return processBalanceInquiry(command, request.txn) || keepOpen;
 
         case VOTE_REQUEST:
-            return processVoteRequest(command, account, amount);
+            open = processVoteRequest(command, request.txn, deltas.data(),
+                                      deltas.size()) || keepOpen;
+            break;
+
+        case ONE_PHASE_COMMIT:
+            // a legacy connection closes after the durable ACK
+            open = processOnePhaseCommit(command, request.txn, deltas.data(),
+                                         deltas.size()) || keepOpen;
+            break;
 
         case GLOBAL_COMMIT:
-            processGlobalCommit(command);
-            return false; // close communication
+            processGlobalCommit(command, request.txn);
+            open = true; // a legacy connection closes after the durable ACK
+            break;
 
         case GLOBAL_ABORT:
-            processGlobalAbort(command);
-            return false; // close communication
+            processGlobalAbort(command, request.txn);
+            open = keepOpen;
+            break;
 
         case UNKNOWN_PROTOCOL:
         default:
-            log("Invalid command received: " + command);
-            respond(toString(UNKNOWN_PROTOCOL));
+            log(LogLine() << "Invalid command received: " << command,
+                LOG_WARN);
+            respond({UNKNOWN_PROTOCOL, request.txn});
             return false;
     }
+    if (traced)
+        traceRequest(request.type, request.txn, start);
+    return open;
+}
+
+void Participant::traceRequest(Protocol type, uint64_t txn,
+                               chrono::steady_clock::time_point start) {
+    bool decision = type == GLOBAL_COMMIT || type == GLOBAL_ABORT;
+    tracer().record(decision ? SPAN_DECISION : SPAN_VALIDATE, txn, start,
+                    chrono::steady_clock::now(), type);
 }
 
-string Participant::formatAmount(double amount) {
-    ostringstream stream;
-    stream << fixed << setprecision(2) << amount;
-    return stream.str();
+unsigned Participant::ownerOf(const AccountKey &account) const {
+    return group->isEscrow(account) ? shard : group->owner(account);
 }
 
-bool Participant::processVoteRequest(const string &command,
-                                     const string &account,
-                                     const double amount) {
-    string formattedAmount = formatAmount(amount);
+void Participant::packLegs(const Message &request) {
+    deltas.clear();
+    for (size_t i = 0; i < request.legCount; i++) {
+        AccountDelta leg{{}, request.legs[i].amount};
+        AccountKey::pack(request.legs[i].account, leg.account); // else empty
+        deltas.push_back(leg);
+    }
+}
+
+bool Participant::route(const Message &request) {
+    if (request.type != VOTE_REQUEST && request.type != ONE_PHASE_COMMIT &&
+        request.type != GLOBAL_COMMIT && request.type != GLOBAL_ABORT)
+        return false;
+    unsigned home = decider(request);
+    if (home == shard)
+        return spreadRequest(request.type, request.txn);
 
-    // Withdraw
-    // got VOTE-REQUEST and approve, place hold and reply VOTE-COMMIT
-    if (amount < 0) {
+    auto mail = make_unique<ShardMail>();
+    mail->type = SHARD_REQUEST;
+    mail->protocol = request.type;
+    mail->from = shard;
+    mail->client = replyTo.client;
+    mail->txn = request.txn;
+    mail->traced = traced;
+    mail->decider = requestDecider;
+    if (carriesLegs(request.type))
+        mail->legs = deltas;
+    group->post(home, move(mail));
+    return true;
+}
 
-        if (accounts.find(account) != accounts.end() &&
-            accounts[account] >= -amount) {
-            holding[account] = amount;
-            log("Holding " + formattedAmount + " from account " +
-                account);
-            log("Got " + command + ", replying VOTE-COMMIT. State: READY");
-            respond(toString(VOTE_COMMIT));
+unsigned Participant::decider(const Message &request) {
+    uint64_t txn = request.txn;
+    if ((txn & IMPLICIT_TXN) != 0)
+        return shard;
+    if (!carriesLegs(request.type)) {
+        // a decision goes where the vote was decided
+        auto held = holding.find(txn);
+        if (spread.count(txn) != 0 ||
+            (held != holding.end() && held->second.alone))
+            return shard;
+        return group->placed(txn, group->home(txn, shard));
+    }
+    // escrow legs go with the others, each shard holds a slice
+    unsigned owner = group->size();
+    for (const auto &leg: deltas) {
+        if (group->isEscrow(leg.account))
+            continue;
+        unsigned legOwner = group->owner(leg.account);
+        if (owner != group->size() && legOwner != owner)
+            return group->home(txn, shard); // spread from the home
+        owner = legOwner;
+    }
+    if (owner == group->size()) // escrow legs only
+        return group->home(txn, shard);
+    group->place(txn, owner);
+    return owner;
+}
+
+bool Participant::spreadRequest(Protocol type, uint64_t txn) {
+    auto it = spread.find(txn);
+    // a one-phase commit with legs on other shards is held like a
+    // VOTE-REQUEST: VOTE-COMMIT tells the coordinator to run phase 2
+    if (type == VOTE_REQUEST || type == ONE_PHASE_COMMIT) {
+        if (it != spread.end()) { // repeated request
+            if (it->second.ready) {
+                log(LogLine() << "Got " << toString(type) << " for held "
+                              << TxnName{txn}
+                              << ", replying VOTE-COMMIT. State: READY");
+                send(replyTo, {VOTE_COMMIT, txn});
+            } else {
+                it->second.to = replyTo; // answer the retry instead
+            }
             return true;
+        }
+        if (all_of(deltas.begin(), deltas.end(), [&](const AccountDelta &leg) {
+                return ownerOf(leg.account) == shard;
+            }))
+            return false;
 
-            // got VOTE-REQUEST and don't approve, reply VOTE-ABORT
-        } else {
-            log("Got " + command + ", replying VOTE-ABORT. State: ABORT");
-            if (accounts.find(account) != accounts.end()) {
-                log("Releasing hold from account " + account);
+        // one SHARD_PREPARE per shard owning legs
+        vector<unique_ptr<ShardMail>> prepares(group->size());
+        for (const auto &leg: deltas) {
+            auto &mail = prepares[ownerOf(leg.account)];
+            if (!mail) {
+                mail = make_unique<ShardMail>();
+                mail->type = SHARD_PREPARE;
+                mail->from = shard;
+                mail->txn = txn;
+                mail->traced = traced;
+                mail->decider = requestDecider;
             }
-            respond(toString(VOTE_ABORT));
-            return false; // close communication
+            mail->legs.push_back(leg);
         }
+        Spread &state = spread[txn];
+        state.to = replyTo;
+        state.traced = traced;
+        state.decider = requestDecider;
+        for (unsigned owner = 0; owner < prepares.size(); owner++)
+            if (prepares[owner]) {
+                group->post(owner, move(prepares[owner]));
+                state.waiting++;
+            }
+        log(LogLine() << "Got " << toString(type) << " for " << TxnName{txn}
+                      << ", asking " << state.waiting
+                      << " shards to hold its legs");
+        return true;
+    }
+
+    // GLOBAL-COMMIT or GLOBAL-ABORT
+    bool commit = type == GLOBAL_COMMIT;
+    if (it == spread.end()) {
+        auto held = holding.find(txn);
+        if (held != holding.end() && held->second.alone)
+            return false;
+        // unknown here, e.g. after a restart: any shard may hold legs
+        Spread &state = spread[txn];
+        state.to = replyTo;
+        state.traced = traced;
+        state.quiet = !commit && (txn & IMPLICIT_TXN) == 0; // presumed
+        for (unsigned owner = 0; owner < group->size(); owner++)
+            state.shards.push_back(owner);
+        decideSpread(txn, state, commit, ACK);
+        return true;
+    }
+    Spread &state = it->second;
+    state.to = replyTo;
+    state.quiet = !commit && (txn & IMPLICIT_TXN) == 0; // presumed
+    if (state.ready)
+        decideSpread(txn, state, commit, ACK);
+    else if (!state.deciding && !commit)
+        state.aborted = true; // once the votes are in
+    return true;
+}
+
+void Participant::decideSpread(uint64_t txn, Spread &state, bool commit,
+                               Protocol outcome) {
+    log(LogLine() << (commit ? "Committing " : "Releasing ") << TxnName{txn}
+                  << " on " << state.shards.size() << " shards");
+    state.ready = false;
+    state.deciding = true;
+    state.outcome = outcome;
+    state.waiting = state.shards.size();
+    for (unsigned owner: state.shards) {
+        auto mail = make_unique<ShardMail>();
+        mail->type = commit ? SHARD_COMMIT : SHARD_ABORT;
+        mail->from = shard;
+        mail->txn = txn;
+        mail->traced = state.traced;
+        group->post(owner, move(mail));
+    }
+}
+
+void Participant::shardAnswered(unsigned from, Protocol answer, uint64_t txn) {
+    auto it = spread.find(txn);
+    if (it == spread.end() || it->second.waiting == 0)
+        return;
+    Spread &state = it->second;
+    if (!state.deciding) {
+        if (answer == VOTE_COMMIT)
+            state.shards.push_back(from);
+        else if (answer != VOTE_READONLY) // holds nothing, nothing to decide
+            state.refused = true;
+    }
+    if (--state.waiting > 0)
+        return;
 
-        // Deposit
-        // got VOTE-REQUEST and approve, place hold and reply VOTE-COMMIT
+    if (!state.deciding) { // all votes are in
+        if (!state.refused && !state.aborted && state.shards.empty()) {
+            state.outcome = VOTE_READONLY;
+        } else if (!state.refused && !state.aborted) {
+            state.ready = true;
+            state.since = chrono::steady_clock::now();
+            log(LogLine() << "All shards hold the legs of " << TxnName{txn}
+                          << ", replying VOTE-COMMIT. State: READY");
+            send(state.to, {VOTE_COMMIT, txn});
+            return;
+        } else {
+            Protocol outcome = state.aborted ? ACK : VOTE_ABORT;
+            if (!state.shards.empty()) {
+                decideSpread(txn, state, false, outcome);
+                return;
+            }
+            state.outcome = outcome;
+        }
+    }
+    if (state.quiet) {
+        log(LogLine() << "Shards answered for " << TxnName{txn});
     } else {
+        log(LogLine() << "Shards answered for " << TxnName{txn}
+                      << ", replying " << toString(state.outcome));
+        send(state.to, {state.outcome, txn}, (txn & IMPLICIT_TXN) != 0);
+    }
+    spread.erase(it);
+}
 
-        if (accounts.find(account) != accounts.end()) {
-            holding[account] = amount;
-            log("Holding " + formattedAmount + " for account " + account);
-            log("Got " + command + ", replying VOTE-COMMIT. State: READY");
-            respond(toString(VOTE_COMMIT));
-            return true;
+bool Participant::receiveMail() {
+    Mailbox &inbox = group->mailbox(shard);
+    inbox.rearm();
+    while (auto mail = inbox.take()) {
+        if (mail->type == SHARD_STOP) {
+            stop();
+            return false;
+        }
+        receive(*mail);
+    }
+    return true;
+}
+
+void Participant::receive(ShardMail &mail) {
+    const char *command = toString(mail.protocol);
+    traced = mail.traced && tracer().enabled();
+    auto start = traced ? chrono::steady_clock::now()
+                        : chrono::steady_clock::time_point();
+    requestDecider = mail.decider;
+    switch (mail.type) {
+        case SHARD_REQUEST:
+            replyTo = {mail.from, mail.client, false};
+            deltas.assign(mail.legs.begin(), mail.legs.end());
+            if (spreadRequest(mail.protocol, mail.txn))
+                break;
+            if (mail.protocol == VOTE_REQUEST)
+                processVoteRequest(command, mail.txn, deltas.data(),
+                                   deltas.size());
+            else if (mail.protocol == ONE_PHASE_COMMIT)
+                processOnePhaseCommit(command, mail.txn, deltas.data(),
+                                      deltas.size());
+            else if (mail.protocol == GLOBAL_COMMIT)
+                processGlobalCommit(command, mail.txn);
+            else
+                processGlobalAbort(command, mail.txn);
+            if (traced)
+                traceRequest(mail.protocol, mail.txn, start);
+            break;
+
+        case SHARD_PREPARE:
+            replyTo = {mail.from, 0, true};
+            processVoteRequest("VOTE-REQUEST", mail.txn, mail.legs.data(),
+                               mail.legs.size());
+            if (traced)
+                traceRequest(VOTE_REQUEST, mail.txn, start);
+            break;
+
+        case SHARD_COMMIT:
+            replyTo = {mail.from, 0, true};
+            processGlobalCommit("GLOBAL-COMMIT", mail.txn);
+            if (traced)
+                traceRequest(GLOBAL_COMMIT, mail.txn, start);
+            break;
+
+        case SHARD_ABORT:
+            replyTo = {mail.from, 0, true};
+            processGlobalAbort("GLOBAL-ABORT", mail.txn);
+            if (traced)
+                traceRequest(GLOBAL_ABORT, mail.txn, start);
+            break;
+
+        case SHARD_VOTED:
+            shardAnswered(mail.from, mail.protocol, mail.txn);
+            break;
+
+        case SHARD_REPLY:
+            respond_to(mail.client, {mail.protocol, mail.txn}, mail.last);
+            break;
 
-            // got VOTE-REQUEST and don't approve, reply VOTE-ABORT without hold.
+        case SHARD_INQUIRE:
+            answerInquiry(mail);
+            break;
+
+        case SHARD_BALANCE:
+            balanceAnswered(mail);
+            break;
+
+        case SHARD_STOP:
+            break; // see receiveMail()
+    }
+}
+
+int Participant::next_timeout() {
+    auto now = chrono::steady_clock::now();
+    int timeout = wal.msUntilSync(now);
+    if (holding.empty() && spread.empty())
+        return timeout;
+    auto inquiry = max<int64_t>(0, chrono::ceil<chrono::milliseconds>(
+            nextInquiry - now).count());
+    return timeout < 0 ? static_cast<int>(inquiry)
+                       : min(timeout, static_cast<int>(inquiry));
+}
+
+void Participant::after_events() {
+    if (group != nullptr && !receiveMail())
+        return;
+    if (wal.syncDue(chrono::steady_clock::now()))
+        syncLog();
+    if (commitsSinceCheckpoint >= options.checkpointEvery)
+        checkpoint();
+    inquiryAnswered();
+    if (chrono::steady_clock::now() >= nextInquiry)
+        inquire();
+    holdsOpen.add(static_cast<int64_t>(holding.size()) - reportedHolds);
+    reportedHolds = static_cast<int64_t>(holding.size());
+}
+
+void Participant::replyAfterSync(const Message &reply, uint64_t lsn,
+                                 bool last) {
+    if (lsn <= wal.durableLsn()) {
+        send(replyTo, reply, last);
+        return;
+    }
+    auto since = traced ? chrono::steady_clock::now()
+                        : chrono::steady_clock::time_point();
+    pendingReplies.push_back({replyTo, {reply.type, reply.txn}, lsn, last,
+                              traced, since});
+}
+
+void Participant::send(const ReplyTo &to, const Message &reply, bool last) {
+    if (to.home || to.shard != shard) {
+        auto mail = make_unique<ShardMail>();
+        mail->type = to.home ? SHARD_VOTED : SHARD_REPLY;
+        mail->protocol = reply.type;
+        mail->from = shard;
+        mail->client = to.client;
+        mail->txn = reply.txn;
+        mail->last = last;
+        group->post(to.shard, move(mail));
+    } else if (to.client != 0 && to.client == client_id() && !last) {
+        respond(reply);
+    } else {
+        respond_to(to.client, reply, last);
+    }
+}
+
+void Participant::syncLog() {
+    uint64_t durable = wal.sync();
+    auto synced = chrono::steady_clock::now();
+    size_t kept = 0;
+    for (auto &pending: pendingReplies) {
+        if (pending.lsn <= durable) {
+            if (pending.traced)
+                tracer().record(SPAN_LOG_SYNC, pending.reply.txn,
+                                pending.since, synced, pending.reply.type);
+            send(pending.to, pending.reply, pending.last);
         } else {
-            log("Got " + command + ", replying VOTE-ABORT. State: ABORT");
-            respond(toString(VOTE_ABORT));
+            pendingReplies[kept++] = pending;
+        }
+    }
+    pendingReplies.resize(kept);
+}
+
+void Participant::inquire() {
+    auto now = chrono::steady_clock::now();
+    nextInquiry = now + options.inquiryAfter;
+    if (inquirer.busy())
+        return; // the last round is still asking
+    auto before = now - options.inquiryAfter;
+    vector<Inquiry> doubts;
+    auto ask = [&](uint64_t txn, const Decider &decider) {
+        if (decider.known())
+            doubts.push_back({decider.host, decider.port, txn});
+        else if (options.coordinatorPort != 0)
+            doubts.push_back({options.coordinatorHost,
+                              options.coordinatorPort, txn});
+    };
+    // implicit transactions die with their connection, nobody decides them
+    for (const auto &[txn, hold]: holding)
+        if ((txn & IMPLICIT_TXN) == 0 && hold.since <= before)
+            ask(txn, hold.decider);
+    for (const auto &[txn, state]: spread)
+        if ((txn & IMPLICIT_TXN) == 0 && state.ready && state.since <= before &&
+            holding.count(txn) == 0)
+            ask(txn, state.decider);
+    if (doubts.empty())
+        return;
+    inquiries.add(doubts.size());
+    log("Asking coordinators for " + to_string(doubts.size()) +
+        " in-doubt transactions");
+    inquirer.ask(move(doubts), options.inquiryAfter);
+}
+
+void Participant::inquiryAnswered() {
+    vector<pair<uint64_t, Protocol>> outcomes;
+    vector<string> problems;
+    if (!inquirer.collect(outcomes, problems))
+        return;
+    for (const string &problem: problems)
+        log("Unable to ask coordinator " + problem, LOG_WARN);
+    for (const auto &[txn, outcome]: outcomes) {
+        if (outcome == DECISION_UNKNOWN)
+            log(LogLine() << "Coordinator does not know in-doubt "
+                          << TxnName{txn} << ", holding it. State: READY",
+                LOG_WARN);
+        else
+            resolve(txn, outcome == GLOBAL_COMMIT);
+    }
+}
+
+void Participant::resolve(uint64_t txn, bool commit) {
+    log(LogLine() << "Coordinator decided "
+                  << toString(commit ? GLOBAL_COMMIT : GLOBAL_ABORT)
+                  << " for in-doubt " << TxnName{txn});
+    replyTo = {shard, 0, false}; // nobody waits for a reply
+    traced = false;
+    requestDecider = Decider();
+    auto state = spread.find(txn);
+    if (state != spread.end()) {
+        if (state->second.ready) {
+            state->second.quiet = true;
+            decideSpread(txn, state->second, commit, ACK);
+        }
+        return;
+    }
+    if (holding.count(txn) == 0)
+        return; // decided meanwhile
+    // the other shards holding legs of it ask on their own
+    if (commit)
+        processGlobalCommit("GLOBAL-COMMIT", txn);
+    else
+        processGlobalAbort("GLOBAL-ABORT", txn);
+}
+
+bool Participant::processVoteRequest(const char *command,
+                                     const uint64_t txn,
+                                     const AccountDelta *legs,
+                                     size_t legCount) {
+    // Repeated request (e.g. a retry after a lost reply)
+    auto held = holding.find(txn);
+    if (held != holding.end()) {
+        held->second.alone |= !replyTo.home;
+        log(LogLine() << "Got " << command << " for held " << TxnName{txn}
+                      << ", replying VOTE-COMMIT. State: READY");
+        replyAfterSync({VOTE_COMMIT, txn}, held->second.lsn);
+        return true;
+    }
+
+    // got VOTE-REQUEST and don't approve, reply VOTE-ABORT without hold
+    LogLine why;
+    Refusal refused = refusal(legs, legCount, why);
+    if (refused != ACCEPTED) {
+        log(LogLine() << "Got " << command << " for " << TxnName{txn}
+                      << ", replying VOTE-ABORT (" << why.view()
+                      << "). State: ABORT");
+        countRefusal(refused == NO_ACCOUNT);
+        send(replyTo, {VOTE_ABORT, txn});
+        return false; // transaction done
+    }
+
+    // approve legs that change nothing without holding them: nothing to
+    // log or decide, so the coordinator leaves this participant out of
+    // phase 2
+    if (changesNothing(legs, legCount)) {
+        log(LogLine() << "Got " << command << " for " << TxnName{txn}
+                      << ", replying VOTE-READONLY");
+        votedReadOnly.add();
+        send(replyTo, {VOTE_READONLY, txn});
+        return false; // transaction done here
+    }
+
+    // got VOTE-REQUEST and approve, place holds and reply VOTE-COMMIT
+    Hold &hold = placeHold(txn);
+    hold.legs.assign(legs, legs + legCount);
+    hold.alone = !replyTo.home;
+    hold.decider = requestDecider;
+    hold.since = chrono::steady_clock::now();
+    reserve(hold);
+    if (requestDecider.known()) // where to ask after a crash
+        wal.append(WAL_DECIDER, txn, requestDecider.host,
+                   Money::fromCents(requestDecider.port));
+    for (size_t i = 0; i < legCount; i++) {
+        const AccountDelta &leg = legs[i];
+        hold.lsn = wal.append(WAL_HOLD, txn, leg.account.view(), leg.amount);
+        log(LogLine() << "Holding " << leg.amount
+                      << (leg.amount.isNegative() ? " from account "
+                                                  : " for account ")
+                      << leg.account.view() << " for " << TxnName{txn});
+    }
+    log(LogLine() << "Got " << command << ", replying VOTE-COMMIT. "
+                                          "State: READY");
+    votedCommit.add();
+    holdsPlaced.add();
+    replyAfterSync({VOTE_COMMIT, txn}, hold.lsn);
+    return true;
+}
+
+bool Participant::processOnePhaseCommit(const char *command,
+                                        uint64_t txn,
+                                        const AccountDelta *legs,
+                                        size_t legCount) {
+    if (holding.count(txn) != 0) // held by an earlier VOTE-REQUEST
+        return processVoteRequest(command, txn, legs, legCount);
+
+    LogLine why;
+    Refusal refused = refusal(legs, legCount, why);
+    if (refused != ACCEPTED) {
+        log(LogLine() << "Got " << command << " for " << TxnName{txn}
+                      << ", replying VOTE-ABORT (" << why.view()
+                      << "). State: ABORT");
+        countRefusal(refused == NO_ACCOUNT);
+        send(replyTo, {VOTE_ABORT, txn});
+        return false;
+    }
+    if (changesNothing(legs, legCount)) {
+        log(LogLine() << "Got " << command << " for " << TxnName{txn}
+                      << ", replying VOTE-READONLY");
+        votedReadOnly.add();
+        send(replyTo, {VOTE_READONLY, txn});
+        return false;
+    }
+
+    // nobody else decides: apply at once, one commit record per leg and
+    // no hold, so the transaction costs the log one sync (shared with the
+    // others of the sync window)
+    uint64_t lsn = wal.lastLsn();
+    for (size_t i = 0; i < legCount; i++) {
+        const AccountDelta &leg = legs[i];
+        lsn = wal.append(WAL_COMMIT, txn, leg.account.view(), leg.amount);
+        accounts.add(leg.account, leg.amount, lsn);
+        log(LogLine() << "Committing " << leg.amount << " for account "
+                      << leg.account.view());
+    }
+    commitsSinceCheckpoint++;
+    votedCommit.add();
+    commits.add();
+    log(LogLine() << "Got " << command << " for " << TxnName{txn}
+                  << ", replying ACK. State: COMMIT");
+    replyAfterSync({ACK, txn}, lsn, (txn & IMPLICIT_TXN) != 0);
+    return true;
+}
+
+Participant::Refusal Participant::refusal(const AccountDelta *legs,
+                                          size_t legCount,
+                                          LogLine &why) const {
+    // every account must exist and the withdrawals from an account must be
+    // covered by what is left of its balance after the reservations of
+    // READY transactions
+    for (size_t i = 0; i < legCount; i++) {
+        const AccountDelta &leg = legs[i];
+        const Money *balance = accounts.find(leg.account);
+        if (balance == nullptr) {
+            why << "no account " << leg.account.view();
+            return NO_ACCOUNT;
+        }
+        if (!leg.amount.isNegative())
+            continue;
+        // withdrawn from the account by this leg and the ones before it,
+        // added up like changesNothing() does, without a map to allocate
+        Money withdrawn;
+        for (size_t j = 0; j <= i; j++)
+            if (legs[j].amount.isNegative() && legs[j].account == leg.account)
+                withdrawn -= legs[j].amount;
+        Money held = reservedOn(leg.account);
+        bool slice = group != nullptr && group->isEscrow(leg.account);
+        if (*balance - held < withdrawn) {
+            why << "insufficient funds in "
+                << (slice ? "this shard's slice of account " : "account ")
+                << leg.account.view();
+            if (!held.isZero())
+                why << ", " << held << " held by other transactions";
+            return NO_FUNDS;
+        }
+    }
+    return ACCEPTED;
+}
+
+bool Participant::changesNothing(const AccountDelta *legs, size_t legCount) {
+    for (size_t i = 0; i < legCount; i++) {
+        if (legs[i].amount.isZero())
+            continue;
+        Money net; // of the account, over all legs
+        for (size_t j = 0; j < legCount; j++)
+            if (legs[j].account == legs[i].account)
+                net += legs[j].amount;
+        if (!net.isZero())
             return false;
+    }
+    return true;
+}
+
+bool Participant::processBalanceInquiry(const char *command, uint64_t txn) {
+    log(LogLine() << "Got " << command << " for " << deltas.size()
+                  << " accounts", LOG_DEBUG);
+    if (group != nullptr &&
+        any_of(deltas.begin(), deltas.end(), [&](const AccountDelta &leg) {
+            return group->isEscrow(leg.account) ||
+                   group->owner(leg.account) != shard;
+        })) {
+        // ask every shard owning one of the accounts, and every shard for
+        // an escrow account, whose balance is the sum of the slices
+        uint64_t id = ++lastBalanceInquiry;
+        vector<unique_ptr<ShardMail>> asks(group->size());
+        for (auto &leg: deltas) {
+            leg.amount = Money();
+            bool escrow = group->isEscrow(leg.account);
+            for (unsigned owner = 0; owner < asks.size(); owner++) {
+                if (!escrow && owner != group->owner(leg.account))
+                    continue;
+                auto &mail = asks[owner];
+                if (!mail) {
+                    mail = make_unique<ShardMail>();
+                    mail->type = SHARD_INQUIRE;
+                    mail->from = shard;
+                    mail->client = id;
+                }
+                // each account once per shard: answers are added up
+                if (none_of(mail->legs.begin(), mail->legs.end(),
+                            [&](const AccountDelta &asked) {
+                                return asked.account == leg.account;
+                            }))
+                    mail->legs.push_back(leg);
+            }
         }
+        BalanceInquiry &inquiry = balanceInquiries[id];
+        inquiry.client = replyTo.client;
+        inquiry.txn = txn;
+        inquiry.legs = deltas;
+        for (unsigned owner = 0; owner < asks.size(); owner++)
+            if (asks[owner]) {
+                group->post(owner, move(asks[owner]));
+                inquiry.waiting++;
+            }
+        return true;
     }
+
+    replyLegs.clear();
+    for (const auto &leg: deltas) {
+        const Money *balance = accounts.find(leg.account);
+        if (balance == nullptr) {
+            log(LogLine() << "Got " << command
+                          << ", replying VOTE-ABORT (no account "
+                          << leg.account.view() << ")", LOG_WARN);
+            respond({VOTE_ABORT, txn});
+            return false;
+        }
+        replyLegs.push_back({leg.account.view(), *balance});
+    }
+    respond({BALANCE, txn, replyLegs.data(), replyLegs.size()});
+    return false;
+}
+
+void Participant::answerInquiry(ShardMail &mail) {
+    auto answer = make_unique<ShardMail>();
+    answer->type = SHARD_BALANCE;
+    answer->protocol = BALANCE;
+    answer->from = shard;
+    answer->client = mail.client;
+    answer->legs = move(mail.legs);
+    for (auto &leg: answer->legs) {
+        const Money *balance = accounts.find(leg.account);
+        if (balance == nullptr) {
+            answer->protocol = VOTE_ABORT;
+            break;
+        }
+        leg.amount = *balance; // a slice, for an escrow account
+    }
+    group->post(mail.from, move(answer));
+}
+
+void Participant::balanceAnswered(const ShardMail &mail) {
+    auto it = balanceInquiries.find(mail.client);
+    if (it == balanceInquiries.end())
+        return;
+    BalanceInquiry &inquiry = it->second;
+    if (mail.protocol != BALANCE)
+        inquiry.missing = true;
+    for (const auto &answer: mail.legs)
+        for (auto &leg: inquiry.legs)
+            if (leg.account == answer.account)
+                leg.amount += answer.amount;
+    if (--inquiry.waiting > 0)
+        return;
+
+    bool last = (inquiry.txn & IMPLICIT_TXN) != 0;
+    if (inquiry.missing) {
+        log("Got BALANCE-INQUIRY, replying VOTE-ABORT (no such account)",
+            LOG_WARN);
+        respond_to(inquiry.client, {VOTE_ABORT, inquiry.txn}, last);
+    } else {
+        replyLegs.clear();
+        for (const auto &leg: inquiry.legs)
+            replyLegs.push_back({leg.account.view(), leg.amount});
+        respond_to(inquiry.client, {BALANCE, inquiry.txn, replyLegs.data(),
+                                    replyLegs.size()}, last);
+    }
+    balanceInquiries.erase(it);
+}
+
+Participant::Hold &Participant::placeHold(uint64_t txn) {
+    if (spareHolds.empty())
+        return holding[txn];
+    auto node = move(spareHolds.back());
+    spareHolds.pop_back();
+    node.key() = txn;
+    Hold &hold = node.mapped();
+    hold.legs.clear(); // keeps its capacity
+    hold.lsn = 0;
+    hold.alone = true;
+    return holding.insert(move(node)).position->second;
+}
+
+void Participant::dropHold(unordered_map<uint64_t, Hold>::iterator it) {
+    auto node = holding.extract(it);
+    if (spareHolds.size() < MAX_SPARE_HOLDS &&
+        node.mapped().legs.capacity() <= MAX_SPARE_LEGS)
+        spareHolds.push_back(move(node));
 }
 
-void Participant::processGlobalCommit(const string &command) {
-    log("Got " + command + ", replying ACK. State: COMMIT");
-    string account;
+void Participant::reserve(const Hold &hold) {
+    for (const auto &leg: hold.legs) {
+        if (!leg.amount.isNegative())
+            continue;
+        auto it = reserved.find(leg.account);
+        if (it != reserved.end()) {
+            it->second -= leg.amount;
+        } else if (spareReservations.empty()) {
+            reserved.emplace(leg.account, -leg.amount);
+        } else {
+            auto &node = spareReservations.back();
+            node.key() = leg.account;
+            node.mapped() = -leg.amount;
+            reserved.insert(move(node));
+            spareReservations.pop_back();
+        }
+    }
+}
 
-    // Iterate through holding map to find account
-    for (const auto &val: holding) {
-        account = val.first;
+void Participant::release(const Hold &hold) {
+    for (const auto &leg: hold.legs) {
+        if (!leg.amount.isNegative())
+            continue;
+        auto it = reserved.find(leg.account);
+        if (it == reserved.end())
+            continue;
+        it->second += leg.amount;
+        if (it->second.isPositive())
+            continue;
+        // keep only accounts with reservations, and the node for the next
+        auto node = reserved.extract(it);
+        if (spareReservations.size() < MAX_SPARE_HOLDS)
+            spareReservations.push_back(move(node));
     }
+}
+
+Money Participant::reservedOn(const AccountKey &account) const {
+    auto it = reserved.find(account);
+    return it == reserved.end() ? Money() : it->second;
+}
+
+void Participant::processGlobalCommit(const char *command, uint64_t txn) {
+    log(LogLine() << "Got " << command << " for " << TxnName{txn}
+                  << ", replying ACK. State: COMMIT");
 
-    // Check if the account exists in holding map
-    auto it = holding.find(account);
+    // Find the hold of this transaction
+    auto it = holding.find(txn);
     bool isFound = (it != holding.end());
 
-    // Update balance
+    // Update balance; a commit without hold was applied before, but its
+    // record may not be durable yet, so the ACK waits for everything logged
+    uint64_t lsn = wal.lastLsn();
     if (isFound) {
-        accounts[account] += it->second; // real withdraw or deposit
-        log("Committing " + formatAmount(it->second) + " for account " +
-            account);
+        for (const auto &leg: it->second.legs) {
+            lsn = wal.append(WAL_COMMIT, txn, leg.account.view(), leg.amount);
+            accounts.add(leg.account, leg.amount, lsn); // withdraw or deposit
+            log(LogLine() << "Committing " << leg.amount << " for account "
+                          << leg.account.view());
+        }
+        holdTime.record(chrono::steady_clock::now() - it->second.since);
+        release(it->second);
+        dropHold(it);
+        commitsSinceCheckpoint++;
+        commits.add();
     }
-    updateAccountsFile();
-    respond(toString(ACK));
+    replyAfterSync({ACK, txn}, lsn, (txn & IMPLICIT_TXN) != 0);
 }
 
-void Participant::processGlobalAbort(const string &command) {
-    log("Got " + command + ", replying ACK. State: ABORT");
-    log("Releasing hold from account");
-    rollback(); // clear holdings + reload account file
-    respond("ACK");
+void Participant::processGlobalAbort(const char *command, uint64_t txn) {
+    // presumed abort: only legacy clients and home shards wait for an ACK
+    bool acked = replyTo.home || (txn & IMPLICIT_TXN) != 0;
+    log(LogLine() << "Got " << command << " for " << TxnName{txn}
+                  << (acked ? ", replying ACK" : "") << ". State: ABORT");
+    auto it = holding.find(txn);
+    uint64_t lsn = 0;
+    if (it != holding.end()) {
+        for (const auto &leg: it->second.legs)
+            log(LogLine() << "Releasing hold from account "
+                          << leg.account.view());
+        // not forced: a lost abort record leaves an in-doubt hold that the
+        // coordinator resolves again, it never loses money
+        lsn = wal.append(WAL_ABORT, txn, {}, Money());
+        holdTime.record(chrono::steady_clock::now() - it->second.since);
+        abortDecided.add();
+        release(it->second);
+        dropHold(it); // only this transaction's hold
+    }
+    // except for legs no coordinator knows about (see header)
+    if (acked)
+        replyAfterSync({ACK, txn}, replyTo.home ? lsn : 0);
+}
+
+void Participant::checkpoint() {
+    syncLog();
+    uint64_t lsn = wal.lastLsn(); // every record up to here is in accounts
+    size_t pages = accounts.flush(lsn);
+
+    wal.rewrite([&]() {
+        // READY transactions must survive the truncation
+        for (auto &[txn, hold]: holding) {
+            if (hold.decider.known())
+                wal.append(WAL_DECIDER, txn, hold.decider.host,
+                           Money::fromCents(hold.decider.port));
+            for (const auto &leg: hold.legs)
+                hold.lsn = wal.append(WAL_HOLD, txn, leg.account.view(),
+                                      leg.amount);
+        }
+    });
+    checkpointLsn = lsn;
+    commitsSinceCheckpoint = 0;
+    log("Checkpoint written at log record " + to_string(lsn) + ", " +
+        to_string(pages) + " pages flushed");
 }
 
-void Participant::updateAccountsFile() {
-    ofstream accountsFile(accounts_filename);
+void Participant::writeAccountsFile(const string &filename,
+                                    const string &header,
+                                    const vector<const AccountStore *> &tables,
+                                    const AccountTable *merged) {
+    string temporary = filename + ".tmp";
+    ofstream accountsFile(temporary, ios::trunc);
     if (!accountsFile) {
         throw runtime_error("Unable to open accounts file");
     }
-    for (const auto &account: accounts) {
-        accountsFile << account.second << " " << account.first << endl;
-    }
+    string text = header;
+    char amount[Money::MAX_TEXT];
+    auto write = [&](string_view account, Money balance) {
+        text.append(amount, balance.format(amount));
+        text += ' ';
+        text += account;
+        text += '\n';
+    };
+    for (const AccountStore *table: tables)
+        table->forEach([&](string_view account, Money balance) {
+            AccountKey key;
+            AccountKey::pack(account, key);
+            if (merged == nullptr || merged->find(key) == nullptr)
+                write(account, balance);
+        });
+    if (merged != nullptr)
+        merged->forEach(write);
+    accountsFile.write(text.data(), static_cast<streamsize>(text.size()));
     accountsFile.close();
+    if (!accountsFile) {
+        throw runtime_error("Unable to write accounts file");
+    }
+
+    // make the new checkpoint durable before it replaces the old one
+    int fd = open(temporary.c_str(), O_RDONLY);
+    if (fd < 0 || fsync(fd) < 0) {
+        if (fd >= 0)
+            close(fd);
+        throw runtime_error("Unable to sync accounts file");
+    }
+    close(fd);
+    if (rename(temporary.c_str(), filename.c_str()) < 0) {
+        throw runtime_error("Unable to replace accounts file");
+    }
 }
 
 void Participant::rollback() {
-    holding.clear(); // clear all holding amounts
-    readAccounts();  // reload account file
+    pendingReplies.clear(); // their outcome is not durable
+    recover();              // checkpoint + write-ahead log
     log("Rollback complete");
 }
@@ -5,12 +5,58 @@
 
 #pragma once
 
+#include <chrono>
 #include <fstream>
 #include <sstream>
+#include <functional>
+#include <string_view>
+#include "AccountLoader.h"
+#include "AccountStore.h"
+#include "AccountTable.h"
+#include "Checkpoint.h"
+#include "Inquirer.h"
+#include "Logger.h"
+#include "ShardMailbox.h"
 #include "TCPServer.h"
+#include "Tracer.h"
+#include "WriteAheadLog.h"
 #include <unordered_map>
+#include <vector>
 using namespace std;
 
+/**
+ * @struct ParticipantOptions tuning knobs of a participant
+ */
+struct ParticipantOptions {
+    // longest time a log record waits for others to share its sync
+    chrono::microseconds syncWindow{1000};
+    // buffered log records that force a sync before the window ends
+    size_t syncBatch = 512;
+    // commits between two flushes of the account store
+    size_t checkpointEvery = 10000;
+    // diagnostic log (log_filename)
+    LoggerOptions log;
+    // reactor threads, each owning a partition of the accounts (see
+    // ShardedParticipant); 1 runs the plain single-threaded Participant
+    unsigned shards = 1;
+    // coordinator answering DECISION-REQUESTs for transactions whose
+    // requests did not say where to ask (see inquire()), none if the port
+    // is 0
+    string coordinatorHost = "localhost";
+    u_short coordinatorPort = 0;
+    // age of a READY transaction before its coordinator is asked for the
+    // outcome, also the pause between two inquiries
+    chrono::milliseconds inquiryAfter{10000};
+    // admin port serving the metrics of all shards (see MetricsServer),
+    // started by the participant program, none if 0
+    u_short adminPort = 0;
+    // spans of the transactions coordinators trace (see Tracer), dumped
+    // here by the participant program on exit, none if empty
+    string traceFile;
+};
+
+class ShardedParticipant;
+
 /**
  * @class
  * Participant class is a derived class of TCPServer class, it inherits all the
@@ -22,18 +68,73 @@ using namespace std;
  * protocol. The class includes methods for checking accounts,  withdrawing or
  * depositing money, aborting transactions if no account exists or insufficient
  * funds, and mechanisms to recover from crashes or connection failures.
+ *
+ * A hold does not lock its accounts: it reserves the amounts it withdraws,
+ * and a VOTE-REQUEST is checked against the available balance, the
+ * committed balance minus what READY transactions reserved. Any number of
+ * transactions may hold deposits and withdrawals on the same account at
+ * once, and none can vote away money another one already holds. Only this
+ * participant's thread (or shard's, see ShardedParticipant) touches its
+ * accounts and reservations, so votes need no locks or version checks.
+ *
+ * Holds, commits and aborts are recorded in a binary write-ahead log next to
+ * the accounts file (acc1.txt -> acc1.wal). VOTE-COMMIT and the ACK of a
+ * commit are only sent once their record is durable; records of all
+ * transactions arriving within the sync window share one fdatasync (group
+ * commit).
+ *
+ * Balances live in a memory-mapped binary account store (acc1.txt ->
+ * acc1.acct, see AccountStore); a commit changes only the records of its
+ * accounts. Every ParticipantOptions::checkpointEvery commits the pages
+ * changed since the last checkpoint are flushed to the store and the
+ * write-ahead log is truncated to the holds of READY transactions.
+ * Recovery maps the store and replays only the log written after its last
+ * flush, rebuilding READY transactions so that their coordinator can still
+ * decide them. The text accounts file is imported into a new store on the
+ * first start (or converted beforehand, see participant --convert) and is
+ * refreshed on shutdown for people to read.
+ *
+ * The coordinator presumes abort: GLOBAL-ABORT is not acknowledged (except
+ * to legacy text-mode clients) and may get lost. A transaction that stays
+ * READY for ParticipantOptions::inquiryAfter, e.g. because its coordinator
+ * crashed, is in doubt, and its outcome is asked from the decision port of
+ * the coordinator that sent its VOTE-REQUEST (see inquire()); the port
+ * comes with the request and is logged with the hold.
+ *
+ * Once its connections are open, a participant handles requests without
+ * allocating: log messages are built in place (see LogLine), the nodes of
+ * released holds and reservations are kept for the next ones, and the
+ * vectors a request needs keep their capacity for the next request. Only
+ * the mail between shards (see ShardMail) is still allocated per message.
+ *
+ * Requests marked MESSAGE_TRACED are traced while the process's tracer is
+ * enabled: validating the legs, applying or releasing a hold and a reply's
+ * wait for the log sync are recorded as spans (see Tracer).
+ *
+ * A Participant may also be one shard of a ShardedParticipant. It then owns
+ * only the accounts that hash to it, keeps its own log and checkpoint
+ * (acc1.txt -> acc1.s0of4.wal, acc1.s0of4.acct) and hands requests to the
+ * shard that must decide them (see route()). Of an escrow account every
+ * shard owns a slice of the balance (see ShardedParticipant).
  */
 class Participant : public TCPServer {
 public:
     /**
-     * Constructs Participant object and initializes the TCP server
+     * Constructs Participant object and initializes the TCP server.
+     * Recovers the state left by the previous run (see recover()).
      * @param serve_port port number on which server listens
      * @param accounts_filename filename where account info is stored
      * @param log_filename filename where transaction logs are stored
+     * @param options tuning knobs
+     * @param group sharded participant this is one shard of, nullptr if none
+     * @param shard index of this shard in the group
      */
     explicit Participant(u_short serve_port,
                          const string &accounts_filename,
-                         const string &log_filename);
+                         const string &log_filename,
+                         const ParticipantOptions &options = ParticipantOptions(),
+                         ShardedParticipant *group = nullptr,
+                         unsigned shard = 0);
 
     /**
      * Destructor
@@ -42,12 +143,18 @@ public:
 
     /**
      * Logs message (step, transaction made) to log file.
-     * Each action taken in the FSM is appended to a log file.
+     * Each action taken in the FSM is appended to a log file by a
+     * background thread (see Logger), so this never waits for I/O.
      *
      * @param message message to be logged
-     * @throws runtime_error If file cannot be opened
+     * @param level severity
      */
-    void log(const string &message);
+    void log(string_view message, LogLevel level = LOG_INFO);
+
+    /** @copydoc log(string_view, LogLevel) */
+    void log(const LogLine &message, LogLevel level = LOG_INFO) {
+        log(message.view(), level);
+    }
 
     /**
      * Stops server and rolls back changes
@@ -55,16 +162,78 @@ public:
     void stop();
 
     /**
-     * Rolls back any uncommitted changes to the accounts.
-     * Used to undo any changes that have not been committed. It clears
-     * holding amounts, which are temporary changes that have not been
-     * finalized, and reloads account information from accounts file.
-     * This ensures that account balances are restored to their original
-     * state before changes.
+     * Rolls back any changes that are not durable.
+     * Used after an error, when in-memory state can no longer be trusted.
+     * It drops replies that were waiting for the log and recovers the durable
+     * state from the checkpoint and the write-ahead log (see recover()).
      * Log message indicating the completion of the rollback is recorded.
      */
     void rollback();
 
+    /**
+     * Rebuilds the participant's state from disk and logs how long it took:
+     * maps the account store (importing the text accounts file into a new
+     * one if there is none yet), then replays the write-ahead log records
+     * after its last flush.
+     * Commits are applied to the balances; holds without a commit or abort
+     * record become READY transactions again.
+     * @throws runtime_error If the files cannot be read, or the escrow
+     * accounts of a shard's store differ from the accounts file's
+     */
+    void recover();
+
+    /**
+     * Flushes the balances changed since the last checkpoint to the account
+     * store and truncates the write-ahead log, keeping only the holds of
+     * READY transactions.
+     * @throws runtime_error If a file cannot be written
+     */
+    void checkpoint();
+
+    /** @return committed balances of the accounts this participant owns */
+    const AccountStore &balances() const { return accounts; }
+
+    /**
+     * Writes balances to the text accounts file. The file is written under
+     * a temporary name, synced and renamed, so a crash leaves either the old
+     * or the new file.
+     * @param filename accounts file
+     * @param header first lines, e.g. "# checkpoint <lsn>\n"
+     * @param tables balances, of one participant or of every shard
+     * @param merged balances written instead of those of the same
+     * accounts in tables (e.g. escrow slices summed up), nullptr if none
+     * @throws runtime_error If file cannot be written
+     */
+    static void writeAccountsFile(const string &filename, const string &header,
+                                  const vector<const AccountStore *> &tables,
+                                  const AccountTable *merged = nullptr);
+
+    /**
+     * Reads the "# escrow <account>" lines at the top of an accounts file
+     * @param filename accounts file
+     * @param escrow the accounts marked for escrow are added here
+     * @return the lines, to be written back with the balances ("" if the
+     * file cannot be read)
+     */
+    static string readEscrow(const string &filename, AccountTable &escrow);
+
+    /**
+     * Parses a text accounts file on several threads (see AccountLoader).
+     * Each line is expected to contain a balance and an account number
+     * separated by a space. A "# checkpoint <lsn>" line records the last
+     * write-ahead log record the balances include.
+     * @param filename accounts file
+     * @param add called with every account and its balance
+     * @param expect called first with the number of accounts, may be empty
+     * @return what was read, e.g. the checkpoint's log record
+     * @throws runtime_error If file cannot be opened/if file format is
+     * invalid, naming the offsets of the malformed lines
+     */
+    static AccountLoad readAccountsFile(
+            const string &filename,
+            const function<void(const AccountKey &, Money)> &add,
+            const function<void(size_t)> &expect = {});
+
 protected:
     /**
      * Logs message indicating acceptance of the connection.
@@ -76,82 +245,465 @@ protected:
     void
     start_client(const string &their_host, u_short their_port) override;
 
+    /**
+     * Releases the hold of a legacy text-mode connection (one implicit
+     * transaction per connection) that is closed before its transaction was
+     * decided, since no coordinator could ever decide it later. Holds of
+     * transactions with explicit ids stay in place until their decision
+     * arrives on any connection.
+     */
+    void end_client() override;
+
     /**
      * Processes a received request from the coordinator.
      * Process method handles various types of requests from the coordinator
-     * as part of the 2-phase commit protocol. It parses the received request,
-     * determines the type of protocol command, and calls the appropriate method
-     * to handle the command. Protocol enum used.
+     * as part of the 2-phase commit protocol. The request arrives already
+     * decoded from the wire; this method dispatches on its protocol command
+     * and calls the appropriate method to handle it.
      *
      * Supported Commands:
      * - VOTE-REQUEST: Calls processVoteRequest.
+     * - ONE-PHASE-COMMIT: Calls processOnePhaseCommit.
+     * - BALANCE-INQUIRY: Calls processBalanceInquiry.
      * - GLOBAL-COMMIT: Calls processGlobalCommit.
      * - GLOBAL-ABORT: Calls processGlobalAbort.
      * - UNKNOWN_PROTOCOL: Logs and responds with invalid command message.
      * @param request command from coordinator
-     * @return true if the server should continue processing requests,
-     * false to stop.
+     * @return true if the connection should stay open for more requests,
+     * false to close it.
+     */
+    bool process(const Message &request) override;
+
+    /**
+     * @return milliseconds until buffered log records are due to be synced
      */
-    bool process(const string &request) override;
+    int next_timeout() override;
+
+    /**
+     * Handles the mail of other shards, syncs the write-ahead log when it
+     * is due, sends the replies that waited for it, takes a checkpoint
+     * when enough commits piled up and asks the coordinator about in-doubt
+     * transactions.
+     */
+    void after_events() override;
 
 private:
     string accounts_filename; // filename for stored account info
     string log_filename; // filename for stored transaction logs
-    unordered_map<string, double> accounts; // map of accounts to balances
-    unordered_map<string, double> holding;  // map of accounts to holding amount
 
     /**
-     * Opens the accounts file, reads each line to extract account  numbers and
-     * balances, and stores them in the accounts map.
-     * Each line in the file is expected to contain a balance and an account
-     * number separated by a space.
-     *
+     * @struct Hold legs held by a READY transaction
+     */
+    struct Hold {
+        vector<AccountDelta> legs; // one per leg of the VOTE-REQUEST
+        uint64_t lsn = 0;          // last log record of the hold
+        bool alone = true; // all legs held here, for a client of this shard
+                           // (unknown after a shard restarts)
+        Decider decider;   // asked for the outcome when in doubt
+        chrono::steady_clock::time_point since; // READY (or recovered) since
+    };
+
+    // released holds and reservations kept for reuse, at most this many,
+    // and holds only if they have room for at most MAX_SPARE_LEGS legs
+    static const size_t MAX_SPARE_HOLDS = 1024;
+    static const size_t MAX_SPARE_LEGS = 256;
+
+    /**
+     * @enum Refusal why the legs of a request are refused, see refusal()
+     */
+    enum Refusal {
+        ACCEPTED,   // not refused
+        NO_ACCOUNT, // an account does not exist
+        NO_FUNDS    // withdrawals exceed the available balance
+    };
+
+    /**
+     * @struct ReplyTo where the reply to the request being handled goes
+     */
+    struct ReplyTo {
+        unsigned shard = 0;  // shard the client is connected to
+        uint64_t client = 0; // client on that shard
+        bool home = false;   // the request came from a home shard (mail)
+    };
+
+    /**
+     * @struct PendingReply reply that waits until a log record is durable
+     */
+    struct PendingReply {
+        ReplyTo to;    // client or home shard to reply to
+        Message reply; // reply without account
+        uint64_t lsn;  // log record that must be durable first
+        bool last;     // close the connection after the reply
+        bool traced;   // of a traced transaction
+        chrono::steady_clock::time_point since; // waiting since, if traced
+    };
+
+    /**
+     * @struct Spread state of a transaction, at its home shard, whose legs
+     * are owned by other shards: they vote among themselves before the home
+     * votes for all of them.
+     */
+    struct Spread {
+        vector<unsigned> shards; // shards holding legs
+        size_t waiting = 0;      // answers outstanding from shards
+        bool refused = false;    // a shard voted VOTE-ABORT
+        bool ready = false;      // every shard holds its legs
+        bool deciding = false;   // shards apply or release their legs
+        bool aborted = false;    // GLOBAL-ABORT arrived while voting
+        Protocol outcome = VOTE_COMMIT; // reply once the shards answered
+        bool quiet = false;      // send no reply once the shards answered
+        ReplyTo to;              // client of the outcome
+        bool traced = false;     // the transaction is traced
+        Decider decider;         // asked for the outcome when in doubt
+        chrono::steady_clock::time_point since; // ready since
+    };
+
+    /**
+     * @struct BalanceInquiry a BALANCE-INQUIRY waiting for the shards
+     * owning its accounts
+     */
+    struct BalanceInquiry {
+        uint64_t client = 0;       // client on this shard
+        uint64_t txn = 0;          // echoed in the reply
+        size_t waiting = 0;        // answers outstanding from shards
+        bool missing = false;      // a shard does not know an account
+        vector<AccountDelta> legs; // accounts asked for, balances summed
+    };
+
+    ParticipantOptions options;
+    ShardedParticipant *group; // shards of this participant, nullptr if none
+    unsigned shard;            // index of this shard in group
+    ReplyTo replyTo;           // destination of replies to the current request
+    bool traced = false;       // the current request is traced
+    Decider requestDecider;    // of the current request's transaction
+    vector<AccountDelta> deltas; // legs of the current request, packed
+    unordered_map<uint64_t, Spread> spread; // transactions homed here
+    // inquiries of clients of this shard, by a number of their own
+    unordered_map<uint64_t, BalanceInquiry> balanceInquiries;
+    uint64_t lastBalanceInquiry = 0;
+    AccountStore accounts; // balances of all accounts
+    // withdrawals held by READY transactions, only accounts that have any
+    unordered_map<AccountKey, Money, AccountKeyHash> reserved;
+    unordered_map<uint64_t, Hold> holding;  // map of transactions to holds
+    // nodes of released holds and reservations, reused by the next ones
+    vector<unordered_map<uint64_t, Hold>::node_type> spareHolds;
+    vector<unordered_map<AccountKey, Money, AccountKeyHash>::node_type>
+            spareReservations;
+    vector<Leg> replyLegs; // legs of a BALANCE reply
+    WriteAheadLog wal; // durable record of holds, commits and aborts
+    vector<PendingReply> pendingReplies; // replies waiting for a log sync
+    uint64_t checkpointLsn = 0; // last log record flushed to the store
+    size_t commitsSinceCheckpoint = 0;
+    chrono::steady_clock::time_point nextInquiry; // in-doubt check due
+    Inquirer inquirer; // asks coordinators off the reactor's thread
+    int64_t reportedHolds = 0; // holding.size() as last added to the gauge
+    unique_ptr<Logger> ownLogger; // diagnostic log, unless group shares one
+    Logger *logger;               // diagnostic log, written to log_filename
+
+    /**
+     * Reads the accounts of this participant or shard from the text
+     * accounts file (see readAccountsFile()), sets checkpointLsn and logs
+     * how fast the file was read
+     * @param imported the balances are added here
      * @throws runtime_error If file cannot be opened/if file format is invalid.
      */
-    void readAccounts();
+    void readAccounts(AccountTable &imported);
 
     /**
-     * Updates accounts file with current account information
-     * @throws runtime_error If file cannot be opened
+     * Loads the balances of a binary checkpoint, the format older versions
+     * kept them in, and sets checkpointLsn
+     * @param checkpoint mapped checkpoint
+     * @param imported the balances are added here
      */
-    void updateAccountsFile();
+    void loadCheckpoint(const Checkpoint &checkpoint, AccountTable &imported);
 
     /**
-     * Formats an amount as a string with two decimal places
-     * @param amount to format
-     * @return formatted amount as string
+     * Creates the account store of a first start, from the checkpoint of
+     * an older version if there is one, else from the text accounts file
+     * @param storeFilename store to create
+     * @return where the balances came from, for the log
      */
-    string formatAmount(double amount);
+    string importAccounts(const string &storeFilename);
 
     /**
-     * Processes VOTE-REQUEST command
+     * Replays the write-ahead log on top of the loaded balances
+     * @return number of records replayed
+     */
+    size_t replayLog();
+
+    /**
+     * @param extension e.g. ".wal"
+     * @return name of a file of this participant or shard, e.g. acc1.wal
+     * or acc1.s0of4.wal
+     */
+    string ownFilename(const char *extension) const;
+
+    /**
+     * @throws runtime_error if the log or account store files next to the
+     * accounts file were written with another number of shards
+     */
+    void checkShardLayout() const;
+
+    /**
+     * Compares the escrow accounts the account store of a shard was sliced
+     * by with those of the accounts file; a store written before they were
+     * recorded adopts those of the file
+     * @throws runtime_error if they differ
+     */
+    void checkEscrow();
+
+    /**
+     * @return a new, empty hold of a transaction, in a node of an earlier
+     * hold if one was kept
+     */
+    Hold &placeHold(uint64_t txn);
+
+    /**
+     * Removes a committed or released hold, keeping its node for the next
+     */
+    void dropHold(unordered_map<uint64_t, Hold>::iterator it);
+
+    /**
+     * Reserves the withdrawals of a hold on their accounts
+     */
+    void reserve(const Hold &hold);
+
+    /**
+     * Returns the withdrawals of a hold that is committed or released
+     */
+    void release(const Hold &hold);
+
+    /**
+     * @return amount of an account reserved by READY transactions
+     */
+    Money reservedOn(const AccountKey &account) const;
+
+    /**
+     * Sends a reply once the log record it depends on is durable
+     * @param reply reply for the current client (see replyTo)
+     * @param lsn log record that must be durable first
+     * @param last close the connection after the reply
+     */
+    void replyAfterSync(const Message &reply, uint64_t lsn,
+                        bool last = false);
+
+    /**
+     * Sends a reply now: on this shard's connection, as mail to the shard
+     * the client is connected to, or as mail to the home shard that asked
+     */
+    void send(const ReplyTo &to, const Message &reply, bool last = false);
+
+    /**
+     * @return shard that holds a leg on the account for this (home) shard:
+     * the owner of the account, or this shard for an escrow account
+     */
+    unsigned ownerOf(const AccountKey &account) const;
+
+    /**
+     * Packs the legs of a request into deltas
+     */
+    void packLegs(const Message &request);
+
+    /**
+     * Hands a request of a sharded participant to the shard that decides
+     * it (see decider()). The owner of all legs of a transaction decides
+     * it alone. A transaction whose legs span shards is decided by its
+     * home, the shard of its id (txn % shards), which spreads it:
+     * every shard owning legs holds them like a VOTE-REQUEST of its own
+     * (SHARD_PREPARE) and answers the home, which votes for all of them
+     * and later passes the decision on (SHARD_COMMIT, SHARD_ABORT). A
+     * shard that held its legs while another refused is told to release
+     * them before the home replies VOTE-ABORT.
+     * @param request request of a client of this shard, legs in deltas
+     * @return true if another shard or the spread handles the request,
+     * false if this shard handles it alone
+     */
+    bool route(const Message &request);
+
+    /**
+     * @param request request of a client of this shard, legs in deltas
+     * @return shard deciding the request's transaction: for legs all owned
+     * by one shard (escrow legs aside) that owner, noted for the decision
+     * (see ShardedParticipant::place()); for a decision the shard noted,
+     * or this one if it holds the transaction; the connection's shard for
+     * implicit transactions; the home for everything else
+     */
+    unsigned decider(const Message &request);
+
+    /**
+     * Home shard: starts or continues a spread transaction if the request
+     * needs other shards
+     * @return true if it does, false if this shard decides alone
+     */
+    bool spreadRequest(Protocol type, uint64_t txn);
+
+    /**
+     * Home shard: sends a decision to the shards of a spread transaction
+     * @param outcome reply once all of them answered
+     */
+    void decideSpread(uint64_t txn, Spread &state, bool commit,
+                      Protocol outcome);
+
+    /**
+     * Home shard: counts a shard's answer and replies once all are in
+     */
+    void shardAnswered(unsigned from, Protocol answer, uint64_t txn);
+
+    /**
+     * Takes and handles the mail of other shards
+     * @return false if the mail stopped this shard
+     */
+    bool receiveMail();
+
+    /**
+     * Handles one mail of another shard
+     */
+    void receive(ShardMail &mail);
+
+    /**
+     * Syncs the write-ahead log and sends all replies that waited for it
+     */
+    void syncLog();
+
+    /**
+     * Asks for the outcome of every transaction that has been READY for
+     * ParticipantOptions::inquiryAfter, with one DECISION-REQUEST each to
+     * the coordinator that sent it (its Decider, else the configured
+     * coordinator). The requests are sent by the inquirer's thread, and the
+     * reactor goes on serving; the answers are applied by
+     * inquiryAnswered(). An unreachable coordinator is asked again after
+     * another inquiryAfter. A home shard asks for its spread transactions
+     * too, and every shard for the legs it holds.
+     */
+    void inquire();
+
+    /**
+     * Applies the answers of the inquirer's last round, if it has ended. A
+     * transaction its coordinator does not know (DECISION-UNKNOWN) stays
+     * READY: another coordinator may still commit it.
+     */
+    void inquiryAnswered();
+
+    /**
+     * Applies the outcome of an in-doubt transaction without replying to
+     * anybody
+     * @param txn transaction id
+     * @param commit true for GLOBAL-COMMIT
+     */
+    void resolve(uint64_t txn, bool commit);
+
+    /**
+     * Records the span of a traced request handled by this shard:
+     * validating its legs or applying its decision
+     * @param type request
+     * @param txn transaction id
+     * @param start when handling it started
+     */
+    void traceRequest(Protocol type, uint64_t txn,
+                      chrono::steady_clock::time_point start);
+
+    /**
+     * Processes VOTE-REQUEST command. The legs are validated together and
+     * either all of them are held (VOTE-COMMIT) or none (VOTE-ABORT). Valid
+     * legs that change no balance are not held (VOTE-READONLY). The
+     * withdrawals from an account must be covered by its available balance
+     * (balance minus reservations of other transactions). A
+     * repeated request for a transaction that already holds its legs is
+     * answered with VOTE-COMMIT again.
      * @param command received from coordinator
-     * @param account account involved in request
-     * @param amount to deposit or withdraw (depends on the sign)
+     * @param txn transaction id
+     * @param legs accounts and amounts to deposit or withdraw (depends on
+     * the sign)
+     * @param legCount number of legs
      * @return true if request was approved, false otherwise
      */
-    bool processVoteRequest(const string &command,
-                            const string &account,
-                            double amount);
+    bool processVoteRequest(const char *command,
+                            uint64_t txn,
+                            const AccountDelta *legs,
+                            size_t legCount);
+
+    /**
+     * Processes ONE-PHASE-COMMIT command, sent when this participant holds
+     * every leg of the transaction. The legs are validated like those of a
+     * VOTE-REQUEST and, if valid, applied at once and logged as commits
+     * without holds; the ACK follows once they are durable. An invalid
+     * request is answered with VOTE-ABORT. The request is not idempotent:
+     * the coordinator never sends it twice, and a transaction already held
+     * is answered like a repeated VOTE-REQUEST.
+     * @param command received from coordinator
+     * @param txn transaction id
+     * @param legs accounts and amounts to deposit or withdraw
+     * @param legCount number of legs
+     * @return true if the transaction committed (or is held)
+     */
+    bool processOnePhaseCommit(const char *command,
+                               uint64_t txn,
+                               const AccountDelta *legs,
+                               size_t legCount);
+
+    /**
+     * Processes BALANCE-INQUIRY command: replies the committed balances of
+     * the accounts (of deltas) straight from the account table, taking no
+     * holds and writing no log record, or VOTE-ABORT if an account does not
+     * exist. A shard asks the shards owning the accounts, and all shards
+     * for an escrow account, whose slices it adds up; the answers are not
+     * a snapshot across shards.
+     * @param command received from coordinator
+     * @param txn echoed in the reply
+     * @return true if the reply is sent later, once the shards answered
+     */
+    bool processBalanceInquiry(const char *command, uint64_t txn);
+
+    /**
+     * Answers another shard's SHARD_INQUIRE with the balances of the
+     * accounts this shard owns
+     */
+    void answerInquiry(ShardMail &mail);
+
+    /**
+     * Adds a shard's answer to its inquiry and replies once all are in
+     */
+    void balanceAnswered(const ShardMail &mail);
+
+    /**
+     * @return true if the legs leave every balance as it is (e.g. zero
+     * amounts that only check that an account exists)
+     */
+    static bool changesNothing(const AccountDelta *legs, size_t legCount);
+
+    /**
+     * Validates the legs of a request: every account must exist and the
+     * withdrawals from an account must be covered by its available balance
+     * @param why gets the details of a refusal, e.g. "no account 42"
+     * @return why the legs are refused, ACCEPTED if they are valid
+     */
+    Refusal refusal(const AccountDelta *legs, size_t legCount,
+                    LogLine &why) const;
 
     /**
      * Processes GLOBAL-ABORT command.
      * This method is invoked if the participant did not already abort
      * transaction in a previous phase. Upon receiving this command,
-     * participant acknowledges the abort ("ACK" message) and releases any
-     * holds on account balances by rolling back the transaction.
+     * participant releases the hold of this transaction in O(1); holds of
+     * other in-flight transactions are left untouched. Aborts are presumed,
+     * so only a legacy text-mode client gets an "ACK". A shard releasing
+     * legs for its home answers it once the abort is durable, so the legs
+     * never come back after a crash.
      * @param command received from coordinator
+     * @param txn transaction id
      */
-    void processGlobalAbort(const string &command);
+    void processGlobalAbort(const char *command, uint64_t txn);
 
     /**
      * Processes GLOBAL-COMMIT command.
-     * Updates account balance in accounts map by applying held amount,
-     * updates accounts file, responds with an "ACK" message to acknowledge
-     * commit.
+     * Updates account balance in accounts map by applying the amount held
+     * by this transaction, updates accounts file, responds with an "ACK"
+     * message to acknowledge commit. A commit for a transaction without a
+     * hold (already committed) is acknowledged again.
      * @param command
+     * @param txn transaction id
      */
-    void processGlobalCommit(const string &command);
+    void processGlobalCommit(const char *command, uint64_t txn);
 };
 
 
@@ -0,0 +1,217 @@
+/**
+ * @file AccountLoader.cpp definition for AccountLoader class
+ * @author Nadezhda Chernova
+ */
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include "AccountLoader.h"
+
+using namespace std;
+
+double AccountLoad::linesPerSecond() const {
+    double seconds = chrono::duration<double>(elapsed).count();
+    return seconds > 0 ? static_cast<double>(lines) / seconds : 0;
+}
+
+string AccountLoad::summary() const {
+    char text[128];
+    snprintf(text, sizeof(text), "%zu lines in %lld ms (%.1f M lines/s, %u "
+             "threads)", lines,
+             static_cast<long long>(chrono::duration_cast<chrono::milliseconds>(
+                     elapsed).count()),
+             linesPerSecond() / 1e6, threads);
+    return text;
+}
+
+string AccountLoad::describeProblems() const {
+    string text;
+    for (const auto &line: problems)
+        text += (text.empty() ? "at byte " : "; at byte ") +
+                to_string(line.offset) + ": " + line.problem;
+    if (malformed > problems.size())
+        text += "; and " + to_string(malformed - problems.size()) + " more";
+    return text;
+}
+
+/**
+ * @struct LoadChunk a part of the file one thread parses, and its results
+ */
+struct LoadChunk {
+    struct Parsed {
+        AccountKey key;
+        Money balance;
+    };
+
+    size_t begin = 0;  // offset of the first line
+    size_t end = 0;    // offset after the last line
+    vector<Parsed> accounts;
+    size_t lines = 0;
+    uint64_t lsn = 0;  // "# checkpoint <lsn>", 0 if not in this chunk
+    size_t malformed = 0;
+    vector<MalformedLine> problems;
+    exception_ptr failure; // e.g. out of memory
+};
+
+/**
+ * Reads the log record of a "# checkpoint <lsn>" line; other comment
+ * lines are ignored
+ */
+static void parseComment(string_view line, uint64_t &lsn) {
+    static const string_view WORD = "checkpoint";
+    size_t i = line.find_first_not_of(" \t", 1);
+    if (i == string_view::npos || line.substr(i, WORD.size()) != WORD)
+        return;
+    i = line.find_first_not_of(" \t", i + WORD.size());
+    if (i != string_view::npos)
+        from_chars(line.data() + i, line.data() + line.size(), lsn);
+}
+
+/**
+ * Parses the lines of a chunk of a mapped accounts file
+ */
+static void parseChunk(const char *data, LoadChunk &chunk) {
+    try {
+        // a short line is about 20 bytes; better grow once than often
+        chunk.accounts.reserve((chunk.end - chunk.begin) / 24);
+        size_t next = chunk.begin;
+        while (next < chunk.end) {
+            const char *start = data + next;
+            auto newline = static_cast<const char *>(
+                    memchr(start, '\n', chunk.end - next));
+            size_t length = newline != nullptr
+                            ? static_cast<size_t>(newline - start)
+                            : chunk.end - next;
+            string_view line(start, length);
+            chunk.lines++;
+
+            if (!line.empty() && line[0] == '#') {
+                parseComment(line, chunk.lsn);
+            } else if (!line.empty()) {
+                const char *problem = nullptr;
+                LoadChunk::Parsed parsed;
+                size_t space = line.find(' ');
+                if (space == string_view::npos)
+                    problem = "expected \"balance account\"";
+                else if (!Money::parse(line.substr(0, space), parsed.balance))
+                    problem = "invalid balance";
+                else if (!AccountKey::pack(line.substr(space + 1), parsed.key))
+                    problem = "invalid account id";
+                if (problem == nullptr) {
+                    chunk.accounts.push_back(parsed);
+                } else {
+                    chunk.malformed++;
+                    if (chunk.problems.size() < AccountLoad::MAX_REPORTED)
+                        chunk.problems.push_back({next, problem});
+                }
+            }
+            next += length + 1;
+        }
+    } catch (...) {
+        chunk.failure = current_exception();
+    }
+}
+
+AccountLoader::AccountLoader(unsigned threads) : threads(threads) {
+    if (this->threads == 0) {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+            this->threads = static_cast<unsigned>(CPU_COUNT(&allowed));
+        this->threads = max(this->threads, 1U);
+    }
+}
+
+AccountLoad AccountLoader::load(
+        const string &filename,
+        const function<void(const AccountKey &, Money)> &add,
+        const function<void(size_t)> &expect) const {
+    auto started = chrono::steady_clock::now();
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw runtime_error("Unable to open accounts file " + filename);
+    struct stat info = {};
+    if (fstat(fd, &info) < 0) {
+        close(fd);
+        throw runtime_error("Unable to stat accounts file " + filename);
+    }
+    auto length = static_cast<size_t>(info.st_size);
+    void *mapped = nullptr;
+    if (length > 0) {
+        mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            string problem = strerror(errno);
+            close(fd);
+            throw runtime_error("Unable to map accounts file " + filename +
+                                ": " + problem);
+        }
+        madvise(mapped, length, MADV_WILLNEED);
+    }
+    close(fd); // the mapping keeps the file open
+    auto data = static_cast<const char *>(mapped);
+
+    // one chunk per thread, each ending after a newline
+    size_t count = max<size_t>(1, min<size_t>(threads, length / MIN_CHUNK));
+    vector<LoadChunk> chunks(count);
+    size_t begin = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t end = length;
+        if (i + 1 < count) {
+            end = max(begin, length / count * (i + 1));
+            auto newline = static_cast<const char *>(
+                    memchr(data + end, '\n', length - end));
+            end = newline != nullptr ? newline - data + 1 : length;
+        }
+        chunks[i].begin = begin;
+        chunks[i].end = end;
+        begin = end;
+    }
+
+    vector<thread> workers;
+    for (size_t i = 1; i < count; i++)
+        workers.emplace_back(parseChunk, data, ref(chunks[i]));
+    parseChunk(data, chunks[0]);
+    for (auto &worker: workers)
+        worker.join();
+    if (mapped != nullptr)
+        munmap(mapped, length);
+
+    // merge in file order
+    AccountLoad result;
+    result.threads = static_cast<unsigned>(count);
+    if (expect) {
+        size_t accounts = 0;
+        for (const auto &chunk: chunks)
+            accounts += chunk.accounts.size();
+        expect(accounts);
+    }
+    for (auto &chunk: chunks) {
+        if (chunk.failure)
+            rethrow_exception(chunk.failure);
+        result.lines += chunk.lines;
+        result.accounts += chunk.accounts.size();
+        if (chunk.lsn != 0)
+            result.lsn = chunk.lsn;
+        result.malformed += chunk.malformed;
+        for (const auto &line: chunk.problems)
+            if (result.problems.size() < AccountLoad::MAX_REPORTED)
+                result.problems.push_back(line);
+        for (const auto &parsed: chunk.accounts)
+            add(parsed.key, parsed.balance);
+        vector<LoadChunk::Parsed>().swap(chunk.accounts); // memory back
+    }
+    result.elapsed = chrono::steady_clock::now() - started;
+    return result;
+}
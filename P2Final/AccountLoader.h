@@ -0,0 +1,91 @@
+/**
+ * @file AccountLoader.h declaration for AccountLoader class
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "AccountTable.h"
+#include "Money.h"
+
+using namespace std;
+
+/**
+ * @struct MalformedLine a line of an accounts file that was not understood
+ */
+struct MalformedLine {
+    size_t offset;       // byte offset of the start of the line
+    const char *problem; // e.g. "invalid balance"
+};
+
+/**
+ * @struct AccountLoad what AccountLoader::load() read, and how fast
+ */
+struct AccountLoad {
+    static const size_t MAX_REPORTED = 16;
+
+    size_t lines = 0;        // lines read, blank and comment lines included
+    size_t accounts = 0;     // account lines
+    uint64_t lsn = 0;        // "# checkpoint <lsn>", 0 if there is none
+    size_t malformed = 0;    // lines not understood
+    vector<MalformedLine> problems; // the first MAX_REPORTED of them
+    unsigned threads = 0;    // threads that parsed
+    chrono::nanoseconds elapsed{}; // mapping, parsing and merging
+
+    /** @return lines read per second */
+    double linesPerSecond() const;
+
+    /** @return e.g. "1000000 lines in 95 ms (10.5 M lines/s, 8 threads)" */
+    string summary() const;
+
+    /** @return e.g. "at byte 120: invalid balance; at byte 4711: ..." */
+    string describeProblems() const;
+};
+
+/**
+ * @class AccountLoader
+ * Bulk loader of a text accounts file, one "balance account" per line,
+ * blank lines and lines starting with '#' skipped except for a
+ * "# checkpoint <lsn>" line. The file is memory-mapped and split into one
+ * chunk per thread at line boundaries; each thread parses its chunk into a
+ * vector of packed keys and balances without allocating per line, and the
+ * chunks are then merged in file order, so that of an account listed
+ * twice the last line wins. Malformed lines do not stop the load: they
+ * are counted and the first ones reported by their byte offset.
+ *
+ * Failures will be thrown as std::runtime_error.
+ */
+class AccountLoader {
+public:
+    /** Chunks are at least this large, so small files use one thread */
+    static const size_t MIN_CHUNK = 1 << 20;
+
+    /**
+     * @param threads most threads to parse on, 0 for one per CPU this
+     * process may run on
+     */
+    explicit AccountLoader(unsigned threads = 0);
+
+    /**
+     * Loads an accounts file
+     * @param filename accounts file
+     * @param add called on the calling thread with every account and its
+     * balance, in file order
+     * @param expect called before the first add() with the number of
+     * accounts to come, e.g. to reserve room for them; may be empty
+     * @return what was read, malformed lines included
+     * @throws runtime_error if the file cannot be opened or mapped
+     */
+    AccountLoad load(const string &filename,
+                     const function<void(const AccountKey &, Money)> &add,
+                     const function<void(size_t)> &expect = {}) const;
+
+private:
+    unsigned threads;
+};
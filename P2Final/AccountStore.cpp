@@ -0,0 +1,268 @@
+/**
+ * @file AccountStore.cpp definition for AccountStore class
+ * @author Nadezhda Chernova
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include "AccountStore.h"
+
+using namespace std;
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "the store keeps integers in host byte order, little-endian");
+
+static const char MAGIC[8] = {'2', 'P', 'C', 'A', 'C', 'C', 'T', '1'};
+static const size_t MIN_SLOTS = AccountStore::HEADER_SIZE /
+                                AccountStore::RECORD_SIZE;
+
+// at most MAX_LOAD_NUM / MAX_LOAD_DEN of the slots are used
+static const size_t MAX_LOAD_NUM = 3;
+static const size_t MAX_LOAD_DEN = 4;
+
+/**
+ * @struct StoreHeader first bytes of a store file
+ */
+struct StoreHeader {
+    char magic[8];
+    uint64_t lsn;
+    uint64_t count;
+    uint64_t slots;
+    uint64_t escrow; // 0 in stores written before it was recorded
+};
+
+AccountStore::~AccountStore() {
+    close();
+}
+
+bool AccountStore::exists(const string &filename) {
+    return access(filename.c_str(), F_OK) == 0;
+}
+
+void AccountStore::create(const string &filename,
+                          const AccountTable &accounts, uint64_t lsn,
+                          uint64_t escrow) {
+    size_t slots = MIN_SLOTS;
+    while (accounts.size() * MAX_LOAD_DEN > slots * MAX_LOAD_NUM)
+        slots *= 2;
+    size_t length = HEADER_SIZE + slots * RECORD_SIZE;
+
+    // free slots are all zeros, so the file starts out sparse
+    string temporary = filename + ".tmp";
+    int fd = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    if (fd < 0)
+        throw runtime_error("Unable to create account store " + temporary +
+                            ": " + strerror(errno));
+    void *mapped = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(length)) == 0)
+        mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                      0);
+    if (mapped == MAP_FAILED) {
+        string problem = strerror(errno);
+        ::close(fd);
+        unlink(temporary.c_str());
+        throw runtime_error("Unable to map account store " + temporary +
+                            ": " + problem);
+    }
+
+    auto data = static_cast<char *>(mapped);
+    auto records = reinterpret_cast<Record *>(data + HEADER_SIZE);
+    accounts.forEach([&](string_view account, Money balance) {
+        AccountKey key;
+        AccountKey::pack(account, key);
+        size_t i = key.hash() & (slots - 1);
+        while (!records[i].key.empty())
+            i = (i + 1) & (slots - 1);
+        records[i].key = key;
+        records[i].balance = balance;
+    });
+    StoreHeader header = {};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.lsn = lsn;
+    header.count = accounts.size();
+    header.slots = slots;
+    header.escrow = escrow;
+    memcpy(data, &header, sizeof(header));
+
+    bool synced = msync(mapped, length, MS_SYNC) == 0;
+    string problem = strerror(errno);
+    munmap(mapped, length);
+    ::close(fd);
+    if (!synced) {
+        unlink(temporary.c_str());
+        throw runtime_error("Unable to sync account store " + temporary +
+                            ": " + problem);
+    }
+    if (rename(temporary.c_str(), filename.c_str()) < 0) {
+        unlink(temporary.c_str());
+        throw runtime_error("Unable to replace account store " + filename +
+                            ": " + strerror(errno));
+    }
+
+    // make the rename itself durable
+    size_t slash = filename.find_last_of('/');
+    string directory = slash == string::npos ? "." : filename.substr(0, slash);
+    int dir = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir >= 0) {
+        fsync(dir);
+        ::close(dir);
+    }
+}
+
+void AccountStore::open(const string &name) {
+    close();
+    int fd = ::open(name.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        throw runtime_error("Unable to open account store " + name + ": " +
+                            strerror(errno));
+    struct stat info = {};
+    StoreHeader header = {};
+    if (fstat(fd, &info) < 0 ||
+        pread(fd, &header, sizeof(header), 0) !=
+        static_cast<ssize_t>(sizeof(header))) {
+        ::close(fd);
+        throw runtime_error("Account store " + name + " is truncated");
+    }
+    auto size = static_cast<size_t>(info.st_size);
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        header.slots < MIN_SLOTS || (header.slots & (header.slots - 1)) != 0 ||
+        size != HEADER_SIZE + header.slots * RECORD_SIZE ||
+        header.count * MAX_LOAD_DEN > header.slots * MAX_LOAD_NUM) {
+        ::close(fd);
+        throw runtime_error("Account store " + name + " is malformed");
+    }
+
+    void *privately = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                           fd, 0);
+    void *sharedly = privately == MAP_FAILED
+                     ? MAP_FAILED
+                     : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                            fd, 0);
+    string problem = strerror(errno);
+    ::close(fd); // the mappings keep the file open
+    if (sharedly == MAP_FAILED) {
+        if (privately != MAP_FAILED)
+            munmap(privately, size);
+        throw runtime_error("Unable to map account store " + name + ": " +
+                            problem);
+    }
+
+    filename = name;
+    live = static_cast<char *>(privately);
+    shared = static_cast<char *>(sharedly);
+    length = size;
+    records = reinterpret_cast<Record *>(live + HEADER_SIZE);
+    mask = header.slots - 1;
+    count = header.count;
+    flushedLsn = header.lsn;
+    escrow = header.escrow;
+    page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    dirty.assign((length + page - 1) / page, 0);
+    dirtyPages.clear();
+}
+
+void AccountStore::close() {
+    if (live != nullptr)
+        munmap(live, length);
+    if (shared != nullptr)
+        munmap(shared, length);
+    live = shared = nullptr;
+    records = nullptr;
+    length = mask = count = 0;
+    dirty.clear();
+    dirtyPages.clear();
+}
+
+const Money *AccountStore::find(string_view account) const {
+    AccountKey key;
+    if (!AccountKey::pack(account, key))
+        return nullptr;
+    return find(key);
+}
+
+const Money *AccountStore::find(const AccountKey &key) const {
+    if (count == 0 || key.empty())
+        return nullptr;
+    const Record &record = probe(key);
+    return record.key.empty() ? nullptr : &record.balance;
+}
+
+bool AccountStore::add(const AccountKey &key, Money amount, uint64_t lsn) {
+    if (count == 0 || key.empty())
+        return false;
+    auto &record = const_cast<Record &>(probe(key));
+    if (record.key.empty())
+        return false;
+    if (record.lsn >= lsn)
+        return true; // replayed, and flushed before the crash
+    record.balance += amount;
+    record.lsn = lsn;
+    size_t changed = static_cast<size_t>(
+            reinterpret_cast<char *>(&record) - live) / page;
+    if (!dirty[changed]) {
+        dirty[changed] = 1;
+        dirtyPages.push_back(changed);
+    }
+    return true;
+}
+
+size_t AccountStore::flush(uint64_t lsn) {
+    size_t written = dirtyPages.size();
+    if (written > 0) {
+        sort(dirtyPages.begin(), dirtyPages.end());
+        for (size_t changed: dirtyPages)
+            memcpy(shared + changed * page, live + changed * page, page);
+        // one msync over the span from the first to the last changed page:
+        // it writes only the pages that changed, and every msync call syncs
+        // the file, so one per range would cost a sync each
+        size_t first = dirtyPages.front() * page;
+        size_t end = (dirtyPages.back() + 1) * page;
+        if (msync(shared + first, end - first, MS_SYNC) < 0)
+            throw runtime_error("Unable to sync account store " + filename +
+                                ": " + strerror(errno));
+
+        // the file has the changes now: drop the private copies of the
+        // pages, range by range, so that they are shared with the page
+        // cache again instead of taking memory twice
+        for (size_t i = 0; i < dirtyPages.size();) {
+            size_t j = i + 1;
+            while (j < dirtyPages.size() &&
+                   dirtyPages[j] == dirtyPages[j - 1] + 1)
+                j++;
+            madvise(live + dirtyPages[i] * page, (j - i) * page,
+                    MADV_DONTNEED);
+            i = j;
+        }
+        for (size_t changed: dirtyPages)
+            dirty[changed] = 0;
+        dirtyPages.clear();
+    }
+
+    // the header last: the pages it vouches for are durable by now
+    memcpy(shared + offsetof(StoreHeader, lsn), &lsn, sizeof(lsn));
+    if (msync(shared, page, MS_SYNC) < 0)
+        throw runtime_error("Unable to sync account store " + filename +
+                            ": " + strerror(errno));
+    flushedLsn = lsn;
+    return written;
+}
+
+void AccountStore::setEscrowDigest(uint64_t digest) {
+    memcpy(shared + offsetof(StoreHeader, escrow), &digest, sizeof(digest));
+    escrow = digest;
+}
+
+const AccountStore::Record &AccountStore::probe(const AccountKey &key) const {
+    for (size_t i = key.hash() & mask;; i = (i + 1) & mask) {
+        const Record &record = records[i];
+        if (record.key.empty() || record.key == key)
+            return record;
+    }
+}
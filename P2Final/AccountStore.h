@@ -0,0 +1,184 @@
+/**
+ * @file AccountStore.h declaration for AccountStore class
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "AccountTable.h"
+#include "Money.h"
+
+using namespace std;
+
+/**
+ * @class AccountStore
+ * Balances of all accounts of a participant in a memory-mapped file of
+ * fixed-size records that is its own index: the records are the slots of
+ * an open-addressing hash table with linear probing, like AccountTable's,
+ * so opening the store is an mmap and a lookup touches one record.
+ *
+ *     offset  size  field
+ *          0     8  magic "2PCACCT1"
+ *          8     8  lsn    last write-ahead log record flushed
+ *         16     8  count  number of accounts
+ *         24     8  slots  number of records, a power of two
+ *         32     8  escrow digest of the escrow accounts of a shard's
+ *                   store (see ShardedParticipant), 0 if none recorded
+ *       4096     -  slots records of RECORD_SIZE bytes:
+ *                   24-byte NUL-padded account id (all NUL: free slot),
+ *                   balance in cents, lsn of the last commit applied
+ *
+ * Integers in host byte order (little-endian). Records are 64-byte
+ * aligned, so none straddles a page or a disk sector.
+ *
+ * The file is mapped twice. Commits change the private (copy-on-write)
+ * mapping only, and remember the pages they touched; flush() copies those
+ * pages into the shared mapping and msyncs them, then the header. So no
+ * balance reaches the file before the write-ahead log record of its
+ * commit is durable, and open() again drops whatever was not flushed.
+ *
+ * A flush interrupted by a crash may leave some records newer than the
+ * header's lsn. Every record therefore keeps the lsn of the last commit it
+ * includes, and add() skips commits a record already has, so replaying the
+ * log after the header's lsn is idempotent.
+ *
+ * Accounts are only added by create(); a store never grows. At most three
+ * quarters of the slots are used, so an account costs between 64 / 0.75 =
+ * 85 and 64 / 0.375 = 171 bytes of file, of which only the pages in use
+ * occupy memory.
+ *
+ * Failures will be thrown as std::runtime_error.
+ */
+class AccountStore {
+public:
+    static const size_t HEADER_SIZE = 4096;
+    static const size_t RECORD_SIZE = 64;
+
+    AccountStore() = default;
+
+    ~AccountStore();
+
+    // don't allow any of these:
+    AccountStore(const AccountStore &) = delete;
+    AccountStore &operator=(const AccountStore &) = delete;
+
+    /**
+     * @return true if a store file exists
+     */
+    static bool exists(const string &filename);
+
+    /**
+     * Writes a new store of the given balances under a temporary name,
+     * syncs it and renames it into place
+     * @param filename store file to create or replace
+     * @param accounts balances
+     * @param lsn last write-ahead log record included in the balances
+     * @param escrow digest of the escrow accounts the balances were sliced
+     * by, 0 for none
+     * @throws runtime_error if the file cannot be written
+     */
+    static void create(const string &filename, const AccountTable &accounts,
+                       uint64_t lsn, uint64_t escrow = 0);
+
+    /**
+     * Maps a store file, dropping the unflushed changes of the one mapped
+     * before, if any
+     * @param filename store file
+     * @throws runtime_error if the file cannot be mapped or is malformed
+     */
+    void open(const string &filename);
+
+    /**
+     * @param account account id
+     * @return balance of the account, nullptr if there is no such account
+     */
+    const Money *find(string_view account) const;
+
+    /** @copydoc find(string_view) */
+    const Money *find(const AccountKey &key) const;
+
+    /**
+     * Applies a commit to the balance of an account, unless the account
+     * already includes it
+     * @param key account
+     * @param amount deposited if positive, withdrawn if negative
+     * @param lsn write-ahead log record of the commit
+     * @return false if there is no such account
+     */
+    bool add(const AccountKey &key, Money amount, uint64_t lsn);
+
+    /**
+     * Makes every change durable: writes and syncs the changed pages, then
+     * the header
+     * @param lsn last write-ahead log record the balances include; every
+     * record up to it must be durable
+     * @return number of pages written
+     * @throws runtime_error if syncing fails
+     */
+    size_t flush(uint64_t lsn);
+
+    /** @return last write-ahead log record flushed */
+    uint64_t lsn() const { return flushedLsn; }
+
+    /** @return number of accounts */
+    size_t size() const { return count; }
+
+    /** @return digest of the escrow accounts, 0 if none was recorded */
+    uint64_t escrowDigest() const { return escrow; }
+
+    /**
+     * Records the digest of the escrow accounts, durable with the next
+     * flush(); for stores written before it was recorded
+     */
+    void setEscrowDigest(uint64_t digest);
+
+    /** @return bytes of the file divided by the number of accounts */
+    size_t bytesPerAccount() const {
+        return count == 0 ? 0 : length / count;
+    }
+
+    /**
+     * Calls visit(account id, balance) for every account, in file order
+     */
+    template<typename Visit>
+    void forEach(Visit &&visit) const {
+        for (size_t i = 0; count > 0 && i <= mask; i++)
+            if (!records[i].key.empty())
+                visit(records[i].key.view(), records[i].balance);
+    }
+
+private:
+    struct alignas(RECORD_SIZE) Record {
+        AccountKey key;
+        Money balance;
+        uint64_t lsn;   // last commit applied, 0 if none since create()
+        uint64_t reserved[3];
+    };
+    static_assert(sizeof(Record) == RECORD_SIZE, "64-byte records");
+
+    string filename;
+    char *live = nullptr;      // private mapping, the current balances
+    char *shared = nullptr;    // shared mapping, what flush() writes
+    size_t length = 0;         // bytes mapped
+    Record *records = nullptr; // records of the private mapping
+    size_t mask = 0;           // slots - 1
+    size_t count = 0;          // accounts
+    uint64_t flushedLsn = 0;
+    uint64_t escrow = 0;       // see escrowDigest()
+    size_t page = 0;           // bytes of a memory page
+    vector<uint8_t> dirty;     // per page: changed since the last flush
+    vector<size_t> dirtyPages; // the pages marked in dirty
+
+    /**
+     * @return the record of the key, or the free record where it belongs
+     */
+    const Record &probe(const AccountKey &key) const;
+
+    /** Unmaps the file, if mapped */
+    void close();
+};
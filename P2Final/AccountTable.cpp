@@ -0,0 +1,88 @@
+/**
+ * @file AccountTable.cpp definition for AccountTable class
+ * @author Nadezhda Chernova
+ */
+
+#include <stdexcept>
+#include "AccountTable.h"
+
+using namespace std;
+
+static const size_t MIN_SLOTS = 16;
+
+Money *AccountTable::find(string_view account) {
+    AccountKey key;
+    if (!AccountKey::pack(account, key))
+        return nullptr;
+    return find(key);
+}
+
+Money *AccountTable::find(const AccountKey &key) {
+    if (count == 0 || key.empty())
+        return nullptr;
+    Entry &entry = probe(key);
+    return entry.key.empty() ? nullptr : &entry.balance;
+}
+
+const Money *AccountTable::find(const AccountKey &key) const {
+    if (count == 0 || key.empty())
+        return nullptr;
+    const Entry &entry = probe(key);
+    return entry.key.empty() ? nullptr : &entry.balance;
+}
+
+Money &AccountTable::insert(string_view account) {
+    AccountKey key;
+    if (!AccountKey::pack(account, key))
+        throw runtime_error("Invalid account id: " + string(account));
+    return insert(key);
+}
+
+Money &AccountTable::insert(const AccountKey &key) {
+    if (!entries)
+        rehash(MIN_SLOTS);
+    Entry *entry = &probe(key);
+    if (!entry->key.empty())
+        return entry->balance;
+
+    if ((count + 1) * MAX_LOAD_DEN > (mask + 1) * MAX_LOAD_NUM) {
+        rehash((mask + 1) * 2);
+        entry = &probe(key);
+    }
+    entry->key = key;
+    entry->balance = Money();
+    count++;
+    return entry->balance;
+}
+
+void AccountTable::reserve(size_t accounts) {
+    size_t slots = MIN_SLOTS;
+    while (accounts * MAX_LOAD_DEN > slots * MAX_LOAD_NUM)
+        slots *= 2;
+    if (!entries || slots > mask + 1)
+        rehash(slots);
+}
+
+void AccountTable::clear() {
+    entries.reset();
+    mask = 0;
+    count = 0;
+}
+
+AccountTable::Entry &AccountTable::probe(const AccountKey &key) const {
+    for (size_t i = key.hash() & mask;; i = (i + 1) & mask) {
+        Entry &entry = entries[i];
+        if (entry.key.empty() || entry.key == key)
+            return entry;
+    }
+}
+
+void AccountTable::rehash(size_t slots) {
+    unique_ptr<Entry[]> old = std::move(entries);
+    size_t oldSlots = old ? mask + 1 : 0;
+    entries = make_unique<Entry[]>(slots);
+    mask = slots - 1;
+    for (size_t i = 0; i < oldSlots; i++)
+        if (!old[i].key.empty())
+            probe(old[i].key) = old[i];
+}
@@ -0,0 +1,52 @@
+/**
+ * @file Arena.cpp definition for Arena class
+ * @author Nadezhda Chernova
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include "Arena.h"
+
+using namespace std;
+
+Arena::Arena(size_t blockSize) : blockSize(max<size_t>(blockSize, 64)) {}
+
+void Arena::reset() {
+    if (blocks.size() > 1) {
+        // one block of the size the round needed serves the next round
+        size_t total = capacity();
+        blocks.clear();
+        grow(total);
+    }
+    current = 0;
+    offset = 0;
+}
+
+size_t Arena::capacity() const {
+    size_t total = 0;
+    for (const auto &block: blocks)
+        total += block.size;
+    return total;
+}
+
+void *Arena::do_allocate(size_t bytes, size_t alignment) {
+    for (; current < blocks.size(); current++, offset = 0) {
+        Block &block = blocks[current];
+        auto start = reinterpret_cast<uintptr_t>(block.data.get());
+        size_t aligned = (start + offset + alignment - 1) / alignment *
+                         alignment - start;
+        if (aligned <= block.size && bytes <= block.size - aligned) {
+            offset = aligned + bytes;
+            return block.data.get() + aligned;
+        }
+    }
+    grow(max(blockSize, blocks.empty() ? 0 : blocks.back().size * 2) +
+         bytes + alignment);
+    return do_allocate(bytes, alignment);
+}
+
+void Arena::grow(size_t size) {
+    blocks.push_back({unique_ptr<byte[]>(new byte[size]), size});
+    current = blocks.size() - 1;
+    offset = 0;
+}
@@ -0,0 +1,77 @@
+/**
+ * @file Arena.h declaration for Arena class
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @class Arena
+ * Memory for objects that die together, e.g. the transactions of one
+ * Coordinator::runTransfers() call. Allocating bumps an offset through a
+ * list of blocks, deallocating does nothing, and reset() frees everything
+ * at once by rewinding to the first block. The blocks are kept (merged
+ * into one if a round needed several), so once the arena is as large as a
+ * round needs, later rounds allocate no memory at all.
+ *
+ * Arena is a std::pmr::memory_resource: standard containers allocate from
+ * it as pmr::vector, pmr::string, pmr::unordered_map and the like, and a
+ * container handed an arena passes it on when it moves.
+ *
+ * Not thread-safe: an arena belongs to one thread at a time.
+ */
+class Arena : public pmr::memory_resource {
+public:
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+    /**
+     * @param blockSize bytes of the first block and least bytes of those
+     * added when it is full
+     */
+    explicit Arena(size_t blockSize = BLOCK_SIZE);
+
+    // don't allow any of these:
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    /**
+     * Frees everything allocated so far; objects in the arena must not be
+     * used any more
+     */
+    void reset();
+
+    /** @return bytes of all blocks */
+    size_t capacity() const;
+
+private:
+    /**
+     * @struct Block memory allocated from, in turn
+     */
+    struct Block {
+        unique_ptr<byte[]> data;
+        size_t size;
+    };
+
+    size_t blockSize;
+    vector<Block> blocks;
+    size_t current = 0; // block allocated from
+    size_t offset = 0;  // bytes of it in use
+
+    void *do_allocate(size_t bytes, size_t alignment) override;
+
+    void do_deallocate(void *, size_t, size_t) override {}
+
+    bool do_is_equal(const memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+    /** Adds a block of at least size bytes and makes it current */
+    void grow(size_t size);
+};
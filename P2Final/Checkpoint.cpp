@@ -0,0 +1,75 @@
+/**
+ * @file Checkpoint.cpp definition for Checkpoint class
+ * @author Nadezhda Chernova
+ */
+
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include "Checkpoint.h"
+
+using namespace std;
+
+static const char MAGIC[8] = {'2', 'P', 'C', 'C', 'K', 'P', 'T', '1'};
+
+Checkpoint::Checkpoint(const string &filename) : data(nullptr), length(0) {
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw runtime_error("Unable to open checkpoint " + filename + ": " +
+                            strerror(errno));
+    struct stat info = {};
+    if (fstat(fd, &info) < 0) {
+        close(fd);
+        throw runtime_error("Unable to stat checkpoint " + filename);
+    }
+    length = static_cast<size_t>(info.st_size);
+    if (length < HEADER_SIZE) {
+        close(fd);
+        throw runtime_error("Checkpoint " + filename + " is truncated");
+    }
+
+    void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (mapped == MAP_FAILED)
+        throw runtime_error("Unable to map checkpoint " + filename + ": " +
+                            strerror(errno));
+    data = static_cast<const char *>(mapped);
+    madvise(mapped, length, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+    uint64_t field;
+    memcpy(&field, data + 8, sizeof(field));
+    checkpointLsn = le64toh(field);
+    memcpy(&field, data + 16, sizeof(field));
+    count = le64toh(field);
+    if (memcmp(data, MAGIC, sizeof(MAGIC)) != 0 ||
+        length != HEADER_SIZE + count * RECORD_SIZE) {
+        munmap(mapped, length);
+        throw runtime_error("Checkpoint " + filename + " is malformed");
+    }
+}
+
+Checkpoint::~Checkpoint() {
+    if (data != nullptr)
+        munmap(const_cast<char *>(data), length);
+}
+
+bool Checkpoint::exists(const string &filename) {
+    return access(filename.c_str(), F_OK) == 0;
+}
+
+string_view Checkpoint::account(size_t i) const {
+    const char *record = data + HEADER_SIZE + i * RECORD_SIZE;
+    return {record, strnlen(record, ACCOUNT_FIELD)};
+}
+
+Money Checkpoint::balance(size_t i) const {
+    uint64_t field;
+    memcpy(&field, data + HEADER_SIZE + i * RECORD_SIZE + ACCOUNT_FIELD,
+           sizeof(field));
+    return Money::fromCents(static_cast<int64_t>(le64toh(field)));
+}
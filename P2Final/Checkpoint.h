@@ -0,0 +1,76 @@
+/**
+ * @file Checkpoint.h declaration for Checkpoint class
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "Money.h"
+
+using namespace std;
+
+/**
+ * @class Checkpoint
+ * Read-only view of a binary checkpoint of all account balances, memory
+ * mapped so that loading it costs no parsing:
+ *
+ *     offset  size  field
+ *          0     8  magic "2PCCKPT1"
+ *          8     8  lsn    last write-ahead log record included
+ *         16     8  count  number of account records
+ *         24     8  zero
+ *         32     -  count records of RECORD_SIZE bytes:
+ *                   24-byte NUL-padded account id, balance in cents
+ *
+ * all integers little-endian. Older versions kept the balances in
+ * checkpoints, written under a temporary name and renamed into place; a
+ * participant now reads one only to import it into its AccountStore.
+ *
+ * Failures will be thrown as std::runtime_error.
+ */
+class Checkpoint {
+public:
+    static const size_t HEADER_SIZE = 32;
+    static const size_t RECORD_SIZE = 32;
+    static const size_t ACCOUNT_FIELD = 24;
+
+    /**
+     * Maps a checkpoint file
+     * @param filename checkpoint file
+     * @throws runtime_error if the file cannot be mapped or is malformed
+     */
+    explicit Checkpoint(const string &filename);
+
+    ~Checkpoint();
+
+    // don't allow any of these:
+    Checkpoint(const Checkpoint &) = delete;
+    Checkpoint &operator=(const Checkpoint &) = delete;
+
+    /**
+     * @return true if a checkpoint file exists
+     */
+    static bool exists(const string &filename);
+
+    /** @return last write-ahead log record included in the balances */
+    uint64_t lsn() const { return checkpointLsn; }
+
+    /** @return number of accounts */
+    size_t size() const { return count; }
+
+    /** @return account id of the i-th record */
+    string_view account(size_t i) const;
+
+    /** @return balance of the i-th record */
+    Money balance(size_t i) const;
+
+private:
+    const char *data;      // mapped file
+    size_t length;         // bytes mapped
+    uint64_t checkpointLsn;
+    size_t count;
+};
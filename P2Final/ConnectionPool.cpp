@@ -0,0 +1,61 @@
+/**
+ * @file ConnectionPool.cpp definition for ConnectionPool class
+ * @author Nadezhda Chernova
+ */
+
+#include <charconv>
+#include <stdexcept>
+#include "ConnectionPool.h"
+
+using namespace std;
+
+ConnectionPool::ConnectionPool(size_t connectionsPerEndpoint, int timeout_ms)
+        : connectionsPerEndpoint(connectionsPerEndpoint),
+          timeout_ms(timeout_ms) {
+    if (connectionsPerEndpoint == 0)
+        throw runtime_error("A connection pool needs at least one connection "
+                            "per endpoint");
+}
+
+TCPClient &ConnectionPool::connection(string_view host, u_short port,
+                                      uint64_t txn) {
+    char digits[8];
+    key.assign(host);
+    key += ':';
+    key.append(digits, to_chars(digits, digits + sizeof(digits), port).ptr);
+    auto found = endpoints.find(key);
+    if (found == endpoints.end()) {
+        Endpoint endpoint{TCPClient::resolve(string(host), port), {}, {}};
+        endpoint.connections.resize(connectionsPerEndpoint);
+        found = endpoints.emplace(key, std::move(endpoint)).first;
+    }
+
+    Endpoint &endpoint = found->second;
+    unique_ptr<TCPClient> &client =
+            endpoint.connections[txn % connectionsPerEndpoint];
+    if (!client) {
+        auto now = chrono::steady_clock::now();
+        if (now < endpoint.retryAfter)
+            throw runtime_error("Connect failed recently, retrying later");
+        try {
+            client = make_unique<TCPClient>(endpoint.address, BINARY_MODE,
+                                             timeout_ms);
+        }
+        catch (const runtime_error &) {
+            if (timeout_ms > 0)
+                endpoint.retryAfter = now + chrono::milliseconds(timeout_ms);
+            throw;
+        }
+        connects++;
+    }
+    return *client;
+}
+
+void ConnectionPool::discard(const TCPClient *client) {
+    for (auto &[key, endpoint]: endpoints)
+        for (auto &connection: endpoint.connections)
+            if (connection.get() == client) {
+                connection.reset();
+                return;
+            }
+}
@@ -0,0 +1,85 @@
+/**
+ * @file ConnectionPool.h declaration for ConnectionPool class
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <netinet/in.h>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "TCPClient.h"
+
+using namespace std;
+
+/**
+ * @class ConnectionPool
+ * Persistent connections of a long-lived coordinator to its participants.
+ * Each participant endpoint (host:port) is resolved once and gets up to
+ * connectionsPerEndpoint connections, opened on first use and kept open
+ * for all later transactions. A transaction always uses the same connection
+ * of an endpoint (chosen by its id), so its decision follows its vote
+ * request on one socket, while different transactions are spread over the
+ * connections and pipelined on each of them.
+ *
+ * A connection that failed is discarded and reopened by the next
+ * transaction that needs it. Connecting and sending give up after the
+ * pool's timeout, so an unresponsive participant cannot stall the
+ * coordinator, and after a failed connect the endpoint is not retried
+ * until the timeout has passed again, so the transactions meanwhile fail
+ * at once instead of each waiting for its own connect.
+ *
+ * Failures will be thrown as std::runtime_error.
+ */
+class ConnectionPool {
+public:
+    /**
+     * Constructs an empty pool
+     * @param connectionsPerEndpoint connections kept open per participant
+     * @param timeout_ms connect and send timeout, -1 to wait forever
+     */
+    explicit ConnectionPool(size_t connectionsPerEndpoint = 1,
+                            int timeout_ms = -1);
+
+    /**
+     * Returns the connection a transaction uses for an endpoint, connecting
+     * (and resolving the host the first time) if needed.
+     * @param host participant host
+     * @param port participant port
+     * @param txn transaction id
+     * @return connection, owned by the pool
+     * @throws runtime_error if the host cannot be resolved or the
+     * connection cannot be opened
+     */
+    TCPClient &connection(string_view host, u_short port, uint64_t txn);
+
+    /**
+     * Closes a connection that failed; it is reopened on next use.
+     * @param client connection returned by connection()
+     */
+    void discard(const TCPClient *client);
+
+    /** @return number of connections opened so far */
+    uint64_t connectCount() const { return connects; }
+
+private:
+    /**
+     * @struct Endpoint a participant's cached address and open connections
+     */
+    struct Endpoint {
+        sockaddr_in address;                      // resolved once
+        vector<unique_ptr<TCPClient>> connections; // null until first use
+        chrono::steady_clock::time_point retryAfter; // after a failed connect
+    };
+
+    size_t connectionsPerEndpoint;
+    int timeout_ms;                            // connect and send timeout
+    unordered_map<string, Endpoint> endpoints; // keyed by "host:port"
+    string key; // "host:port" looked up, kept so its capacity is reused
+    uint64_t connects = 0;
+};
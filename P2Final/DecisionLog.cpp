@@ -0,0 +1,242 @@
+/**
+ * @file DecisionLog.cpp definition for DecisionLog class
+ * @author Nadezhda Chernova
+ */
+
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include "DecisionLog.h"
+#include "Metrics.h"
+#include "WriteAheadLog.h"
+
+using namespace std;
+
+/**
+ * @return how far an id lies after another, modulo IMPLICIT_TXN
+ */
+static uint64_t distance(uint64_t from, uint64_t to) {
+    return (to - from) & ~IMPLICIT_TXN;
+}
+
+static Histogram &fsyncTime = metrics().histogram(
+        "decision_log_fsync_seconds",
+        "Time spent in fdatasync of the coordinator's decision log");
+
+DecisionLog::DecisionLog(const string &filename) : filename(filename) {
+    // replay: commits minus those that ended, up to a torn or corrupt tail
+    fd = open(filename.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw runtime_error("Unable to open decision log " + filename +
+                            ": " + strerror(errno));
+    char page[RECORD_SIZE * 1024];
+    size_t filled = 0;
+    bool intact = true;
+    while (intact) {
+        ssize_t got = read(fd, page + filled, sizeof(page) - filled);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            close(fd);
+            throw runtime_error("Unable to read decision log " + filename +
+                                ": " + strerror(errno));
+        }
+        filled += got;
+        size_t used = 0;
+        for (; used + RECORD_SIZE <= filled; used += RECORD_SIZE) {
+            const char *record = page + used;
+            uint32_t crc;
+            memcpy(&crc, record, sizeof(crc));
+            if (le32toh(crc) != crc32(record + 4, RECORD_SIZE - 4)) {
+                intact = false;
+                break;
+            }
+            uint64_t txn;
+            memcpy(&txn, record + 8, sizeof(txn));
+            txn = le64toh(txn);
+            if (record[4] == DECISION_COMMIT)
+                commits.insert(txn);
+            else if (record[4] == DECISION_RANGE)
+                rangeStarts.push_back(txn);
+            else
+                commits.erase(txn);
+        }
+        filled -= used;
+        memmove(page, page + used, filled);
+        if (got == 0)
+            break;
+    }
+    close(fd);
+    // the newest ranges; a block recorded twice counts from its first id
+    if (rangeStarts.size() > MAX_RANGES)
+        rangeStarts.erase(rangeStarts.begin(),
+                          rangeStarts.end() - MAX_RANGES);
+    for (uint64_t start: rangeStarts) {
+        auto [it, added] = ranges.try_emplace(start / BLOCK_SIZE, start);
+        if (!added)
+            it->second = min(it->second, start);
+    }
+
+    // compact: a fresh log of the open commits replaces the old one
+    string temporary = filename + ".tmp";
+    fd = open(temporary.c_str(),
+              O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw runtime_error("Unable to create decision log " + temporary +
+                            ": " + strerror(errno));
+    try {
+        for (uint64_t start: rangeStarts)
+            append(DECISION_RANGE, start);
+        for (uint64_t txn: commits)
+            append(DECISION_COMMIT, txn);
+        writeBuffer();
+        if (fdatasync(fd) < 0)
+            throw runtime_error("Unable to sync decision log " + temporary +
+                                ": " + strerror(errno));
+        if (rename(temporary.c_str(), filename.c_str()) < 0)
+            throw runtime_error("Unable to replace decision log " + filename +
+                                ": " + strerror(errno));
+    } catch (...) {
+        close(fd);
+        unlink(temporary.c_str());
+        throw;
+    }
+    syncDirectory(filename);
+}
+
+DecisionLog::~DecisionLog() {
+    try {
+        writeBuffer(); // end records need no sync
+    } catch (const exception &) {
+        // nothing sensible left to do while shutting down
+    }
+    close(fd);
+}
+
+void DecisionLog::issue(uint64_t first, uint64_t next) {
+    lock_guard<mutex> guard(lock);
+    if (!issuing) {
+        issuing = true;
+        runFirst = first;
+        reservedEnd = first;
+    }
+    inFlight = first;
+    issuedEnd = next;
+    presumed.clear(); // their windows are decided
+    if (distance(runFirst, next) <= distance(runFirst, reservedEnd))
+        return;
+    // answers about the new block must survive a crash, so before any of
+    // its ids is sent
+    while (distance(runFirst, next) > distance(runFirst, reservedEnd)) {
+        append(DECISION_RANGE, reservedEnd);
+        reservedEnd = (reservedEnd / BLOCK_SIZE + 1) * BLOCK_SIZE &
+                      ~IMPLICIT_TXN;
+    }
+    writeBuffer();
+    if (fdatasync(fd) < 0)
+        throw runtime_error("Unable to sync decision log " + filename +
+                            ": " + strerror(errno));
+    syncs++;
+}
+
+void DecisionLog::commit(vector<uint64_t> &txns) {
+    lock_guard<mutex> guard(lock);
+    size_t kept = 0;
+    for (uint64_t txn: txns) {
+        if (presumed.count(txn) != 0)
+            continue; // a participant was already told it aborted
+        append(DECISION_COMMIT, txn);
+        txns[kept++] = txn;
+    }
+    txns.resize(kept);
+    if (buffer.empty())
+        return;
+    writeBuffer();
+    if (kept == 0)
+        return; // only end records
+    auto start = chrono::steady_clock::now();
+    if (fdatasync(fd) < 0)
+        throw runtime_error("Unable to sync decision log " + filename +
+                            ": " + strerror(errno));
+    fsyncTime.record(chrono::steady_clock::now() - start);
+    syncs++;
+    // answer inquiries with commit only once it is durable
+    for (uint64_t txn: txns) {
+        if (spare.empty()) {
+            commits.insert(txn);
+            continue;
+        }
+        spare.back().value() = txn;
+        commits.insert(move(spare.back()));
+        spare.pop_back();
+    }
+}
+
+void DecisionLog::end(const vector<uint64_t> &txns) {
+    lock_guard<mutex> guard(lock);
+    for (uint64_t txn: txns) {
+        auto node = commits.extract(txn);
+        if (node.empty())
+            continue;
+        append(DECISION_END, txn);
+        if (spare.size() < MAX_SPARE)
+            spare.push_back(move(node));
+    }
+}
+
+Protocol DecisionLog::decision(uint64_t txn) {
+    lock_guard<mutex> guard(lock);
+    if (commits.count(txn) != 0)
+        return GLOBAL_COMMIT;
+    if (issuing) {
+        uint64_t offset = distance(runFirst, txn);
+        if (offset < distance(runFirst, issuedEnd)) {
+            // an earlier window is decided; this one must abort now
+            if (distance(inFlight, txn) < distance(inFlight, issuedEnd))
+                presumed.insert(txn);
+            return GLOBAL_ABORT;
+        }
+        if (offset < distance(runFirst, reservedEnd))
+            return DECISION_UNKNOWN; // not issued yet
+    }
+    auto range = ranges.find(txn / BLOCK_SIZE);
+    if (range != ranges.end() && txn >= range->second)
+        return GLOBAL_ABORT; // an earlier run's, not committed
+    return DECISION_UNKNOWN; // another coordinator's
+}
+
+size_t DecisionLog::pending() {
+    lock_guard<mutex> guard(lock);
+    return commits.size();
+}
+
+void DecisionLog::append(DecisionType type, uint64_t txn) {
+    char record[RECORD_SIZE] = {};
+    record[4] = static_cast<char>(type);
+    uint64_t field = htole64(txn);
+    memcpy(record + 8, &field, sizeof(field));
+    uint32_t crc = htole32(crc32(record + 4, RECORD_SIZE - 4));
+    memcpy(record, &crc, sizeof(crc));
+    buffer.insert(buffer.end(), record, record + RECORD_SIZE);
+}
+
+void DecisionLog::writeBuffer() {
+    const char *data = buffer.data();
+    size_t left = buffer.size();
+    while (left > 0) {
+        ssize_t written = write(fd, data, left);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            throw runtime_error("Unable to write decision log " + filename +
+                                ": " + strerror(errno));
+        }
+        data += written;
+        left -= written;
+    }
+    buffer.clear();
+}
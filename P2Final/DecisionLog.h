@@ -0,0 +1,163 @@
+/**
+ * @file DecisionLog.h declaration for DecisionLog class
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "Protocol.h"
+
+using namespace std;
+
+/**
+ * @enum DecisionType kind of a decision log record
+ */
+enum DecisionType : uint8_t {
+    DECISION_COMMIT = 1, // transaction committed
+    DECISION_END = 2,    // every participant acknowledged the commit
+    DECISION_RANGE = 3   // ids from txn to the end of its block are issued
+};
+
+/**
+ * @class DecisionLog
+ * Binary, append-only log of a coordinator's commit decisions, so that the
+ * outcome of a transaction survives a coordinator crash. Records have a
+ * fixed size of RECORD_SIZE bytes:
+ *
+ *     offset  size  field
+ *          0     4  crc32 of bytes 4..15
+ *          4     1  type (DecisionType)
+ *          5     3  zero
+ *          8     8  txn
+ *
+ * all integers little-endian.
+ *
+ * The log presumes abort: only commits are recorded, and a transaction of
+ * this coordinator the log does not know committed is taken as aborted. Abort decisions
+ * therefore cost no write at all, and nobody needs to acknowledge them.
+ * commit() records the commits of a whole window of transactions with one
+ * write() and one fdatasync(), and GLOBAL-COMMIT may only be sent after it
+ * returned. Once every participant acknowledged a commit, end() buffers a
+ * record saying so; it is written along with the next commits and is not
+ * forced, since a lost one only keeps a decision around longer.
+ *
+ * decision() answers a participant's DECISION-REQUEST. It may be called by
+ * another thread than commit(). Abort is only presumed for transactions
+ * this coordinator started: every coordinator draws its ids from a random
+ * start, and issue() records the blocks of BLOCK_SIZE ids it draws from
+ * (a DECISION_RANGE record, synced before the first id of a block is
+ * sent). An id outside them belongs to another coordinator and is answered
+ * DECISION-UNKNOWN, and so is one this run did not issue yet. A transaction
+ * of the window in flight that an inquiry presumes aborted can no longer
+ * commit, so the answer stays true even if the inquiry overtakes the
+ * decision; only those are remembered, until the next window starts.
+ *
+ * Opening the log replays it and rewrites it with only the commits that
+ * have not ended yet and the last MAX_RANGES ranges, so the file stays
+ * small. The set nodes of ended commits are kept for the next ones, so a
+ * steady stream of commits and ends allocates no memory.
+ *
+ * Failures will be thrown as std::runtime_error.
+ */
+class DecisionLog {
+public:
+    static const size_t RECORD_SIZE = 16;
+    static const size_t MAX_SPARE = 4096; // set nodes kept for reuse
+    static const uint64_t BLOCK_SIZE = 1 << 24; // ids of a DECISION_RANGE
+    static const size_t MAX_RANGES = 4096; // ranges of earlier runs kept
+
+    /**
+     * Opens (or creates) the log file, recovers the commits that have not
+     * ended yet and compacts the file to them
+     * @param filename log file
+     * @throws runtime_error if the file cannot be read or written
+     */
+    explicit DecisionLog(const string &filename);
+
+    /**
+     * Writes buffered end records and closes the file
+     */
+    ~DecisionLog();
+
+    // don't allow any of these:
+    DecisionLog(const DecisionLog &) = delete;
+    DecisionLog &operator=(const DecisionLog &) = delete;
+
+    /**
+     * Records that a window of transactions is about to be sent, and that
+     * every earlier one is decided. Ids are issued in increasing order
+     * (modulo IMPLICIT_TXN), the first id of the first window starts the
+     * run. The range of the window's ids is durable when this returns,
+     * with one fdatasync if it starts a block.
+     * @param first id of the window's first transaction
+     * @param next id after the window's last transaction
+     * @throws runtime_error if the write or sync fails
+     */
+    void issue(uint64_t first, uint64_t next);
+
+    /**
+     * Durably records commit decisions, with one fdatasync for all of them
+     * @param txns transactions decided to commit; those an inquiry already
+     * presumed aborted are removed and must abort instead
+     * @throws runtime_error if the write or sync fails
+     */
+    void commit(vector<uint64_t> &txns);
+
+    /**
+     * Records that committed transactions need no answer any more
+     * @param txns transactions acknowledged by every participant
+     */
+    void end(const vector<uint64_t> &txns);
+
+    /**
+     * Answers an inquiry for the outcome of a transaction; any thread
+     * @param txn transaction id
+     * @return GLOBAL_COMMIT if the transaction committed; GLOBAL_ABORT if
+     * this coordinator issued it and it aborted or was never decided (it is
+     * then presumed aborted for good); DECISION_UNKNOWN if this coordinator
+     * did not issue it (yet)
+     */
+    Protocol decision(uint64_t txn);
+
+    /** @return number of commits not known to be acknowledged */
+    size_t pending();
+
+    /** @return number of fdatasync() calls so far */
+    uint64_t syncCount() const { return syncs; }
+
+private:
+    string filename;
+    int fd;                  // log file, opened for appending
+    vector<char> buffer;     // records not yet written
+    mutex lock;              // guards the sets and the buffer
+    unordered_set<uint64_t> commits;  // committed, not yet ended
+    unordered_set<uint64_t> presumed; // of the window, inquired before any
+                                      // decision
+    vector<unordered_set<uint64_t>::node_type> spare; // of ended commits
+    unordered_map<uint64_t, uint64_t> ranges; // of earlier runs: first id
+                                              // issued in a block, by block
+    vector<uint64_t> rangeStarts; // the same, in the order recorded
+    bool issuing = false; // this run issued ids
+    uint64_t runFirst = 0;    // first id of this run
+    uint64_t inFlight = 0;    // first id of the window
+    uint64_t issuedEnd = 0;   // id after the window
+    uint64_t reservedEnd = 0; // id after the ranges this run recorded
+    uint64_t syncs = 0;
+
+    /**
+     * Buffers a record
+     */
+    void append(DecisionType type, uint64_t txn);
+
+    /**
+     * Writes the buffered records
+     * @throws runtime_error if the write fails
+     */
+    void writeBuffer();
+};
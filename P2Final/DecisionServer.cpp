@@ -0,0 +1,61 @@
+/**
+ * @file DecisionServer.cpp definition for DecisionServer class
+ * @author Nadezhda Chernova
+ */
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include "DecisionServer.h"
+
+using namespace std;
+
+DecisionServer::DecisionServer(u_short port, DecisionLog &decisions,
+                               Logger &logger)
+        : TCPServer(port), decisions(decisions), logger(logger) {
+    wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake < 0)
+        throw runtime_error(string("Failed to create eventfd: ") +
+                            strerror(errno));
+    watch(wake);
+    worker = thread([this]() {
+        try {
+            serve();
+        } catch (const exception &e) {
+            this->logger.log(LOG_ERROR, "Decision server failed: " +
+                                        string(e.what()));
+        }
+    });
+}
+
+DecisionServer::~DecisionServer() {
+    stopping = true;
+    uint64_t one = 1;
+    if (write(wake, &one, sizeof(one)) < 0)
+        logger.log(LOG_ERROR, string("Failed to stop decision server: ") +
+                              strerror(errno));
+    worker.join();
+    close(wake);
+}
+
+bool DecisionServer::process(const Message &request) {
+    if (request.type != DECISION_REQUEST) {
+        logger.log(LOG_WARN, "Invalid inquiry received: " +
+                             string(toString(request.type)));
+        respond({UNKNOWN_PROTOCOL, request.txn});
+        return false;
+    }
+    Protocol outcome = decisions.decision(request.txn);
+    logger.log(LOG_INFO, "Participant asked for transaction #" +
+                         to_string(request.txn) + ", replying " +
+                         toString(outcome));
+    respond({outcome, request.txn});
+    return true;
+}
+
+void DecisionServer::after_events() {
+    if (stopping)
+        stopServer();
+}
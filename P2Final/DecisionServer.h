@@ -0,0 +1,61 @@
+/**
+ * @file DecisionServer.h declaration for DecisionServer class
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include "DecisionLog.h"
+#include "Logger.h"
+#include "TCPServer.h"
+
+using namespace std;
+
+/**
+ * @class DecisionServer
+ * Answers the DECISION-REQUESTs of participants holding in-doubt
+ * transactions, on a thread of its own next to the coordinator: the reply is
+ * GLOBAL-COMMIT if the decision log has the commit, GLOBAL-ABORT if this
+ * coordinator issued the transaction otherwise (presumed abort), and
+ * DECISION-UNKNOWN for a transaction it did not issue (see DecisionLog), so
+ * the participant keeps holding it. Participants may ask in text or binary
+ * mode and keep the connection open for more inquiries.
+ *
+ * Failures will be thrown as std::runtime_error by the constructor only.
+ */
+class DecisionServer : public TCPServer {
+public:
+    /**
+     * Starts serving on a thread of its own
+     * @param port port number on which the server listens
+     * @param decisions decision log to answer from
+     * @param logger diagnostic log
+     * @throws runtime_error if the port cannot be served
+     */
+    DecisionServer(u_short port, DecisionLog &decisions, Logger &logger);
+
+    /**
+     * Stops the server and waits for its thread
+     */
+    ~DecisionServer() override;
+
+protected:
+    /**
+     * Answers a DECISION-REQUEST, refuses anything else
+     */
+    bool process(const Message &request) override;
+
+    /**
+     * Stops serving once the destructor asked to
+     */
+    void after_events() override;
+
+private:
+    DecisionLog &decisions;
+    Logger &logger;
+    int wake;                // eventfd the destructor signals
+    atomic<bool> stopping{false};
+    thread worker;
+};
@@ -0,0 +1,102 @@
+/**
+ * @file Inquirer.cpp definition for Inquirer class
+ * @author Nadezhda Chernova
+ */
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include "Inquirer.h"
+#include "TCPClient.h"
+
+using namespace std;
+
+Inquirer::Inquirer() {
+    done = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (done < 0)
+        throw runtime_error(string("Failed to create eventfd: ") +
+                            strerror(errno));
+}
+
+Inquirer::~Inquirer() {
+    if (worker.joinable())
+        worker.join();
+    close(done);
+}
+
+void Inquirer::ask(vector<Inquiry> inquiries, chrono::milliseconds timeout) {
+    asked = move(inquiries);
+    answers.clear();
+    failures.clear();
+    worker = thread([this, timeout]() { run(timeout); });
+}
+
+bool Inquirer::collect(vector<pair<uint64_t, Protocol>> &outcomes,
+                       vector<string> &problems) {
+    uint64_t ended;
+    if (!worker.joinable() || read(done, &ended, sizeof(ended)) < 0)
+        return false; // still asking (EAGAIN) or nothing asked
+    worker.join();
+    outcomes.insert(outcomes.end(), answers.begin(), answers.end());
+    problems.insert(problems.end(), failures.begin(), failures.end());
+    return true;
+}
+
+void Inquirer::run(chrono::milliseconds timeout) {
+    auto deadline = chrono::steady_clock::now() + timeout;
+    sort(asked.begin(), asked.end(), [](const Inquiry &a, const Inquiry &b) {
+        return a.host != b.host ? a.host < b.host : a.port < b.port;
+    });
+    // one connection per coordinator, all within the round's deadline
+    for (size_t first = 0, last; first < asked.size(); first = last) {
+        const string &host = asked[first].host;
+        u_short port = asked[first].port;
+        for (last = first; last < asked.size() && asked[last].host == host &&
+                           asked[last].port == port; last++) {
+        }
+        size_t answered = 0;
+        try {
+            auto left = chrono::ceil<chrono::milliseconds>(
+                    deadline - chrono::steady_clock::now());
+            if (left.count() <= 0)
+                throw runtime_error("no time left in this round");
+            TCPClient client(TCPClient::resolve(host, port), BINARY_MODE,
+                             static_cast<int>(left.count()));
+            for (size_t i = first; i < last; i++)
+                client.queue_request({DECISION_REQUEST, asked[i].txn});
+            client.flush();
+            Message answer;
+            while (answered < last - first) {
+                if (client.next_response(answer)) {
+                    if (answer.type != GLOBAL_COMMIT &&
+                        answer.type != GLOBAL_ABORT &&
+                        answer.type != DECISION_UNKNOWN)
+                        throw runtime_error(string("unexpected ") +
+                                            toString(answer.type));
+                    answers.emplace_back(answer.txn, answer.type);
+                    answered++;
+                    continue;
+                }
+                left = chrono::ceil<chrono::milliseconds>(
+                        deadline - chrono::steady_clock::now());
+                pollfd ready{client.socket(), POLLIN, 0};
+                if (left.count() <= 0 ||
+                    poll(&ready, 1, static_cast<int>(left.count())) == 0)
+                    throw runtime_error("no answer within " +
+                                        to_string(timeout.count()) + " ms");
+                client.receive(false);
+            }
+        } catch (const runtime_error &e) {
+            failures.push_back(host + ":" + to_string(port) + ": " +
+                               e.what());
+        }
+    }
+    // wakes the reactor; a counter of one cannot overflow the eventfd
+    uint64_t one = 1;
+    ssize_t written = write(done, &one, sizeof(one));
+    (void) written;
+}
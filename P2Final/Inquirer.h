@@ -0,0 +1,88 @@
+/**
+ * @file Inquirer.h declaration for Inquirer class
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "Protocol.h"
+
+using namespace std;
+
+/**
+ * @struct Inquiry one in-doubt transaction and the coordinator deciding it
+ */
+struct Inquiry {
+    string host;  // coordinator's host
+    u_short port; // coordinator's decision port
+    uint64_t txn; // transaction id
+};
+
+/**
+ * @class Inquirer
+ * Asks coordinators for the outcome of in-doubt transactions on a thread
+ * of its own, so that the participant's reactor never waits for one. A
+ * round, started by ask(), sends one DECISION-REQUEST per transaction,
+ * pipelined on one connection per coordinator, and waits for the answers
+ * until its deadline. Its end is signalled on fd(), an eventfd the reactor
+ * watches; collect() then hands the answers to the reactor's thread. Only
+ * one round runs at a time.
+ *
+ * Failures to reach a coordinator are reported by collect(); the
+ * constructor throws std::runtime_error if the eventfd cannot be created.
+ */
+class Inquirer {
+public:
+    Inquirer();
+
+    /**
+     * Waits for the round in progress, if any
+     */
+    ~Inquirer();
+
+    Inquirer(const Inquirer &) = delete;
+    Inquirer &operator=(const Inquirer &) = delete;
+
+    /** @return eventfd readable once a round has ended */
+    int fd() const { return done; }
+
+    /** @return true while a round runs or its answers are not collected */
+    bool busy() const { return worker.joinable(); }
+
+    /**
+     * Starts a round; not while busy()
+     * @param inquiries transactions to ask for, grouped by coordinator
+     * @param timeout longest time the round waits for all coordinators
+     */
+    void ask(vector<Inquiry> inquiries, chrono::milliseconds timeout);
+
+    /**
+     * Takes the answers of a round that has ended
+     * @param outcomes transaction ids and their answers (GLOBAL-COMMIT,
+     * GLOBAL-ABORT or DECISION-UNKNOWN) are added here
+     * @param problems coordinators that could not be asked, and why, are
+     * added here
+     * @return false if no round has ended (nothing added)
+     */
+    bool collect(vector<pair<uint64_t, Protocol>> &outcomes,
+                 vector<string> &problems);
+
+private:
+    int done; // eventfd signalled at the end of a round
+    thread worker;
+    vector<Inquiry> asked;                      // the round's transactions
+    vector<pair<uint64_t, Protocol>> answers;   // filled by the round
+    vector<string> failures;                    // filled by the round
+
+    /**
+     * Runs a round on the worker thread
+     */
+    void run(chrono::milliseconds timeout);
+};
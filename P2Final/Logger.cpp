@@ -0,0 +1,222 @@
+/**
+ * @file Logger.cpp definition for Logger class
+ * @author Nadezhda Chernova
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include "Logger.h"
+
+using namespace std;
+
+static const size_t BUFFER_SIZE = 64 * 1024; // bytes formatted per write()
+static const chrono::milliseconds IDLE_WAIT{50}; // longest consumer nap
+
+/**
+ * Writes all bytes, retrying after interrupts and short writes
+ * @return false on error
+ */
+static bool writeAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t count = ::write(fd, data, size);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += count;
+        size -= count;
+    }
+    return true;
+}
+
+Logger::Logger(const string &filename, const LoggerOptions &options)
+        : options(options) {
+    size_t capacity = 1;
+    while (capacity < options.capacity)
+        capacity <<= 1;
+    mask = capacity - 1;
+    slots = make_unique<Slot[]>(capacity);
+    for (size_t i = 0; i < capacity; i++)
+        slots[i].sequence.store(i, memory_order_relaxed);
+
+    fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+              0644);
+    if (fd < 0)
+        throw runtime_error("Cannot open log file: " + filename + ": " +
+                            strerror(errno));
+    buffer.reserve(BUFFER_SIZE + SLOT_SIZE + 64);
+    echo.reserve(BUFFER_SIZE + SLOT_SIZE);
+    consumer = thread(&Logger::run, this);
+}
+
+Logger::~Logger() {
+    stopping.store(true);
+    wake.notify_one();
+    consumer.join();
+    close(fd);
+}
+
+void Logger::log(LogLevel level, string_view message) {
+    if (level < options.level)
+        return;
+
+    // Claim a position; a full queue drops the record rather than wait
+    uint64_t position = tail.load(memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+        slot = &slots[position & mask];
+        uint64_t sequence = slot->sequence.load(memory_order_acquire);
+        auto lag = static_cast<int64_t>(sequence - position);
+        if (lag == 0) {
+            if (tail.compare_exchange_weak(position, position + 1,
+                                           memory_order_relaxed))
+                break;
+        } else if (lag < 0) {
+            drops.fetch_add(1, memory_order_relaxed);
+            return;
+        } else {
+            position = tail.load(memory_order_relaxed);
+        }
+    }
+
+    slot->micros = chrono::duration_cast<chrono::microseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+    slot->level = level;
+    size_t length = message.size() < MAX_MESSAGE ? message.size() : MAX_MESSAGE;
+    slot->length = static_cast<uint16_t>(length);
+    memcpy(slot->message, message.data(), slot->length);
+    slot->sequence.store(position + 1, memory_order_release);
+
+    if (sleeping.load())
+        wake.notify_one();
+}
+
+void Logger::flush() {
+    uint64_t target = tail.load();
+    unique_lock<mutex> lock(wakeLock);
+    wake.notify_one();
+    drained.wait(lock, [&]() { return written.load() >= target; });
+}
+
+const char *Logger::toString(LogLevel level) {
+    switch (level) {
+        case LOG_DEBUG:
+            return "DEBUG";
+        case LOG_INFO:
+            return "INFO";
+        case LOG_WARN:
+            return "WARN";
+        case LOG_ERROR:
+            return "ERROR";
+    }
+    return "?";
+}
+
+void Logger::run() {
+    uint64_t reportedDrops = 0;
+    while (true) {
+        size_t taken = drain();
+
+        uint64_t dropCount = drops.load(memory_order_relaxed);
+        if (dropCount != reportedDrops) {
+            format(chrono::duration_cast<chrono::microseconds>(
+                           chrono::system_clock::now().time_since_epoch())
+                           .count(), LOG_WARN,
+                   to_string(dropCount - reportedDrops) +
+                   " log records dropped, queue full");
+            reportedDrops = dropCount;
+        }
+
+        if (!buffer.empty()) {
+            write();
+            {
+                lock_guard<mutex> lock(wakeLock);
+                written.store(head);
+            }
+            drained.notify_all();
+        }
+        if (taken > 0)
+            continue;
+        if (stopping.load())
+            break;
+
+        // Nothing ready: nap until a producer wakes us. A wakeup that races
+        // with going to sleep is only late by IDLE_WAIT.
+        unique_lock<mutex> lock(wakeLock);
+        sleeping.store(true);
+        if (slots[head & mask].sequence.load(memory_order_acquire) !=
+            head + 1 && !stopping.load())
+            wake.wait_for(lock, IDLE_WAIT);
+        sleeping.store(false);
+    }
+}
+
+size_t Logger::drain() {
+    size_t taken = 0;
+    while (buffer.size() < BUFFER_SIZE) {
+        Slot &slot = slots[head & mask];
+        if (slot.sequence.load(memory_order_acquire) != head + 1)
+            break;
+        format(slot.micros, slot.level, {slot.message, slot.length});
+        slot.sequence.store(head + mask + 1, memory_order_release);
+        head++;
+        taken++;
+    }
+    return taken;
+}
+
+void Logger::format(int64_t micros, LogLevel level, string_view message) {
+    // "2026-10-16T02:34:18.123456Z INFO message"
+    auto second = static_cast<time_t>(micros / 1000000);
+    if (second != stampSecond) {
+        tm utc = {};
+        gmtime_r(&second, &utc);
+        strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &utc);
+        stampSecond = second;
+    }
+    char fraction[16];
+    snprintf(fraction, sizeof(fraction), ".%06dZ ",
+             static_cast<int>(micros % 1000000));
+    buffer += stamp;
+    buffer += fraction;
+    buffer += toString(level);
+    buffer += ' ';
+    buffer += message;
+    buffer += '\n';
+    if (options.echo) {
+        echo += message;
+        echo += '\n';
+    }
+}
+
+void Logger::write() {
+    if (!writeAll(fd, buffer.data(), buffer.size()))
+        fprintf(stderr, "Unable to write log file: %s\n", strerror(errno));
+    if (!echo.empty())
+        writeAll(STDOUT_FILENO, echo.data(), echo.size());
+    buffer.clear();
+    echo.clear();
+}
+
+LogLine &LogLine::operator<<(string_view more) {
+    size_t count = min(more.size(), sizeof(text) - length);
+    memcpy(text + length, more.data(), count);
+    length += count;
+    return *this;
+}
+
+LogLine &LogLine::operator<<(Money amount) {
+    if (sizeof(text) - length >= Money::MAX_TEXT)
+        length += amount.format(text + length);
+    else {
+        char formatted[Money::MAX_TEXT];
+        *this << string_view(formatted, amount.format(formatted));
+    }
+    return *this;
+}
@@ -0,0 +1,202 @@
+/**
+ * @file Logger.h declaration for Logger class
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include "Money.h"
+
+using namespace std;
+
+/**
+ * @enum LogLevel severity of a diagnostic log record
+ */
+enum LogLevel : uint8_t {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+};
+
+/**
+ * @struct LoggerOptions tuning knobs of a logger
+ */
+struct LoggerOptions {
+    // also print every message on standard output
+    bool echo = true;
+    // records below this level are dropped by the caller
+    LogLevel level = LOG_INFO;
+    // records queued for the background thread; more are dropped and counted
+    size_t capacity = 4096;
+};
+
+/**
+ * @class Logger
+ * Diagnostic log of a coordinator or participant. It is not the durable
+ * record of 2PC decisions (see WriteAheadLog), so a record may be lost in a
+ * crash or dropped when the queue is full; in exchange log() never waits
+ * for I/O or for other threads.
+ *
+ * log() copies the message into a slot of a bounded lock-free queue with
+ * many producers and one consumer. A background thread drains the queue,
+ * formats the records into a preallocated buffer as compact lines,
+ *
+ *     2026-10-16T02:34:18.123456Z INFO Transaction #42 committed
+ *
+ * and appends the buffer to the log file with one write() per batch. The
+ * message alone is echoed on standard output if LoggerOptions::echo is set.
+ * Messages longer than MAX_MESSAGE bytes are truncated.
+ *
+ * Failures will be thrown as std::runtime_error by the constructor only.
+ */
+class Logger {
+public:
+    static const size_t SLOT_SIZE = 256;
+    static const size_t MAX_MESSAGE = SLOT_SIZE - 24;
+
+    /**
+     * Opens the log file for appending and starts the background thread
+     * @param filename log file
+     * @param options tuning knobs
+     * @throws runtime_error if the file cannot be opened
+     */
+    explicit Logger(const string &filename,
+                    const LoggerOptions &options = LoggerOptions());
+
+    /**
+     * Writes every queued record, then stops the background thread
+     */
+    ~Logger();
+
+    // don't allow any of these:
+    Logger(const Logger &) = delete;
+    Logger &operator=(const Logger &) = delete;
+
+    /**
+     * Queues a record; never blocks
+     * @param level severity, records below LoggerOptions::level are ignored
+     * @param message message, truncated to MAX_MESSAGE bytes
+     */
+    void log(LogLevel level, string_view message);
+
+    /**
+     * Waits until every record queued so far has been written
+     */
+    void flush();
+
+    /** @return records dropped because the queue was full */
+    uint64_t dropped() const { return drops.load(memory_order_relaxed); }
+
+    /** @return name of a level, e.g. "INFO" */
+    static const char *toString(LogLevel level);
+
+private:
+    /**
+     * @struct Slot one queued record. sequence tells whose turn the slot
+     * is: the producer of position p may fill it when sequence == p, the
+     * consumer may take it when sequence == p + 1.
+     */
+    struct alignas(64) Slot {
+        atomic<uint64_t> sequence;
+        int64_t micros;    // time of the record, since the epoch
+        uint16_t length;   // message bytes
+        LogLevel level;
+        char message[MAX_MESSAGE];
+    };
+
+    LoggerOptions options;
+    int fd;                         // log file
+    unique_ptr<Slot[]> slots;       // capacity, a power of two
+    size_t mask;                    // capacity - 1
+    alignas(64) atomic<uint64_t> tail{0}; // next position to fill
+    alignas(64) uint64_t head = 0;        // next position to drain (consumer)
+    atomic<uint64_t> drops{0};
+    atomic<uint64_t> written{0};    // positions drained and written
+    atomic<bool> sleeping{false};   // consumer waits for records
+    atomic<bool> stopping{false};
+    mutex wakeLock;
+    condition_variable wake;        // consumer waits here, with a timeout
+    condition_variable drained;     // flush() waits here
+    string buffer;                  // formatted records, preallocated
+    string echo;                    // messages for standard output
+    time_t stampSecond = -1;        // second formatted in stamp
+    char stamp[32] = {};            // "2026-10-16T02:34:18"
+    thread consumer;
+
+    /**
+     * Background thread: drains, formats and writes records until stopped
+     */
+    void run();
+
+    /**
+     * Formats the records ready in the queue into the buffer
+     * @return number of records taken
+     */
+    size_t drain();
+
+    /**
+     * Formats one record into the buffer (and the echo buffer)
+     */
+    void format(int64_t micros, LogLevel level, string_view message);
+
+    /**
+     * Writes the buffer to the log file (and standard output)
+     */
+    void write();
+};
+
+/**
+ * @class LogLine
+ * A log message built in place, for the code that logs every message:
+ *
+ *     log(LogLine() << "Got " << command << " for transaction #" << txn);
+ *
+ * Text, numbers and amounts are appended to a fixed buffer of
+ * Logger::MAX_MESSAGE bytes rather than concatenated as strings, so
+ * building a message never allocates. What does not fit is cut off, as
+ * Logger::log() would.
+ */
+class LogLine {
+public:
+    LogLine() {} // leaves the buffer uninitialized
+
+    /** Appends text */
+    LogLine &operator<<(string_view text);
+
+    /** Appends a character */
+    LogLine &operator<<(char c) { return *this << string_view(&c, 1); }
+
+    /** Appends an amount, formatted as by Money::format() */
+    LogLine &operator<<(Money amount);
+
+    /** Appends an integer in decimal */
+    template<typename Integer,
+             typename = enable_if_t<is_integral_v<Integer>>>
+    LogLine &operator<<(Integer number) {
+        auto [end, error] = to_chars(text + length, text + sizeof(text),
+                                     number);
+        length = error == errc() ? end - text : sizeof(text);
+        return *this;
+    }
+
+    /** @return the message */
+    string_view view() const { return {text, length}; }
+
+private:
+    char text[Logger::MAX_MESSAGE];
+    size_t length = 0;
+};
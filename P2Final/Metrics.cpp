@@ -0,0 +1,178 @@
+/**
+ * @file Metrics.cpp definition for the metrics registry
+ * @author Nadezhda Chernova
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include "Metrics.h"
+
+using namespace std;
+
+unsigned metricStripe() {
+    static atomic<unsigned> next{0};
+    static thread_local unsigned stripe =
+            next.fetch_add(1, memory_order_relaxed) % METRIC_STRIPES;
+    return stripe;
+}
+
+uint64_t Counter::value() const {
+    uint64_t sum = 0;
+    for (const auto &stripe: stripes)
+        sum += stripe.value.load(memory_order_relaxed);
+    return sum;
+}
+
+int64_t Gauge::value() const {
+    int64_t sum = 0;
+    for (const auto &stripe: stripes)
+        sum += stripe.value.load(memory_order_relaxed);
+    return sum;
+}
+
+uint64_t Histogram::lowestOf(unsigned bucket) {
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+    unsigned exponent = bucket / SUB_BUCKETS + SUB_BITS - 1;
+    uint64_t sub = bucket % SUB_BUCKETS;
+    return (SUB_BUCKETS + sub) << (exponent - SUB_BITS);
+}
+
+uint64_t Histogram::highestOf(unsigned bucket) {
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+    unsigned exponent = bucket / SUB_BUCKETS + SUB_BITS - 1;
+    return lowestOf(bucket) + (1ULL << (exponent - SUB_BITS)) - 1;
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+    Snapshot snapshot;
+    snapshot.buckets.assign(BUCKETS, 0);
+    for (const auto &stripe: stripes) {
+        for (unsigned i = 0; i < BUCKETS; i++) {
+            uint64_t count = stripe.buckets[i].load(memory_order_relaxed);
+            snapshot.buckets[i] += count;
+            snapshot.count += count;
+        }
+        snapshot.sum += stripe.sum.load(memory_order_relaxed);
+    }
+    return snapshot;
+}
+
+double Histogram::Snapshot::quantile(double q) const {
+    if (count == 0)
+        return 0;
+    auto rank = static_cast<uint64_t>(ceil(q * count));
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen >= max<uint64_t>(rank, 1))
+            // middle of the bucket, off by at most half its width
+            return (lowestOf(i) + highestOf(i)) / 2.0;
+    }
+    return static_cast<double>(highestOf(BUCKETS - 1));
+}
+
+MetricsRegistry::Entry &MetricsRegistry::entry(const string &name,
+                                               const string &help,
+                                               const string &labels,
+                                               Kind kind) {
+    for (auto &existing: entries) {
+        if (existing.name != name)
+            continue;
+        if (existing.kind != kind)
+            throw runtime_error("Metric " + name +
+                                " is registered as another kind");
+        if (existing.labels == labels)
+            return existing;
+    }
+    Entry added{name, help, labels, kind, nullptr, nullptr, nullptr};
+    if (kind == COUNTER)
+        added.counter = make_unique<Counter>();
+    else if (kind == GAUGE)
+        added.gauge = make_unique<Gauge>();
+    else
+        added.histogram = make_unique<Histogram>();
+    entries.push_back(move(added));
+    return entries.back();
+}
+
+Counter &MetricsRegistry::counter(const string &name, const string &help,
+                                  const string &labels) {
+    lock_guard<mutex> guard(lock);
+    return *entry(name, help, labels, COUNTER).counter;
+}
+
+Gauge &MetricsRegistry::gauge(const string &name, const string &help,
+                              const string &labels) {
+    lock_guard<mutex> guard(lock);
+    return *entry(name, help, labels, GAUGE).gauge;
+}
+
+Histogram &MetricsRegistry::histogram(const string &name, const string &help,
+                                      const string &labels) {
+    lock_guard<mutex> guard(lock);
+    return *entry(name, help, labels, HISTOGRAM).histogram;
+}
+
+/**
+ * @return "name{labels}", or the bare name without labels
+ */
+static string series(const string &name, const string &labels) {
+    return labels.empty() ? name : name + "{" + labels + "}";
+}
+
+string MetricsRegistry::render() const {
+    lock_guard<mutex> guard(lock);
+    string out;
+    char number[64];
+    vector<bool> written(entries.size());
+    for (size_t first = 0; first < entries.size(); first++) {
+        if (written[first])
+            continue;
+        // the series of one name go together, after its HELP and TYPE
+        const Entry &head = entries[first];
+        static const char *const TYPES[] = {"counter", "gauge", "summary"};
+        out += "# HELP " + head.name + " " + head.help + "\n# TYPE " +
+               head.name + " " + TYPES[head.kind] + "\n";
+        for (size_t i = first; i < entries.size(); i++) {
+            const Entry &entry = entries[i];
+            if (written[i] || entry.name != head.name)
+                continue;
+            written[i] = true;
+            if (entry.kind == COUNTER) {
+                snprintf(number, sizeof(number), " %llu\n",
+                         static_cast<unsigned long long>(
+                                 entry.counter->value()));
+                out += series(entry.name, entry.labels) + number;
+            } else if (entry.kind == GAUGE) {
+                snprintf(number, sizeof(number), " %lld\n",
+                         static_cast<long long>(entry.gauge->value()));
+                out += series(entry.name, entry.labels) + number;
+            } else {
+                Histogram::Snapshot snapshot = entry.histogram->snapshot();
+                string comma = entry.labels.empty() ? "" : ",";
+                for (const char *q: {"0.5", "0.9", "0.99", "0.999"}) {
+                    snprintf(number, sizeof(number), " %.9f\n",
+                             snapshot.quantile(stod(q)) / 1e9);
+                    out += entry.name + "{" + entry.labels + comma +
+                           "quantile=\"" + q + "\"}" + number;
+                }
+                snprintf(number, sizeof(number), " %.9f\n",
+                         snapshot.sum / 1e9);
+                out += series(entry.name + "_sum", entry.labels) + number;
+                snprintf(number, sizeof(number), " %llu\n",
+                         static_cast<unsigned long long>(snapshot.count));
+                out += series(entry.name + "_count", entry.labels) + number;
+            }
+        }
+    }
+    return out;
+}
+
+MetricsRegistry &metrics() {
+    // never destroyed: threads may still record while the process exits
+    static MetricsRegistry *registry = new MetricsRegistry();
+    return *registry;
+}
@@ -0,0 +1,194 @@
+/**
+ * @file Metrics.h declaration for the metrics registry: counters, gauges and
+ * latency histograms cheap enough to record on every message
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Recording threads are spread over this many stripes of every metric, so
+ * threads (e.g. the reactors of a sharded participant) rarely share a cache
+ * line. A stripe is only written with relaxed atomics, never locked.
+ */
+const unsigned METRIC_STRIPES = 8;
+
+/**
+ * @return stripe of the calling thread, fixed for its lifetime
+ */
+unsigned metricStripe();
+
+/**
+ * @class Counter
+ * Monotonic count, e.g. of messages or bytes
+ */
+class Counter {
+public:
+    /** Adds to the count; any thread, lock-free */
+    void add(uint64_t amount = 1) {
+        stripes[metricStripe()].value.fetch_add(amount,
+                                                memory_order_relaxed);
+    }
+
+    /** @return the count, summed over the stripes */
+    uint64_t value() const;
+
+private:
+    struct alignas(64) Stripe {
+        atomic<uint64_t> value{0};
+    };
+    Stripe stripes[METRIC_STRIPES];
+};
+
+/**
+ * @class Gauge
+ * Value that goes up and down, e.g. transactions holding funds
+ */
+class Gauge {
+public:
+    /** Adds to the value (negative to subtract); any thread, lock-free */
+    void add(int64_t amount) {
+        stripes[metricStripe()].value.fetch_add(amount,
+                                                memory_order_relaxed);
+    }
+
+    /** @return the value, summed over the stripes */
+    int64_t value() const;
+
+private:
+    struct alignas(64) Stripe {
+        atomic<int64_t> value{0};
+    };
+    Stripe stripes[METRIC_STRIPES];
+};
+
+/**
+ * @class Histogram
+ * Distribution of durations in the style of an HDR histogram: log-linear
+ * buckets, SUB_BUCKETS per power of two, so any value is known to within
+ * 1/SUB_BUCKETS (6%) from a nanosecond up to about half an hour, and
+ * recording is an index computation and one relaxed increment.
+ */
+class Histogram {
+public:
+    static const unsigned SUB_BITS = 4;
+    static const unsigned SUB_BUCKETS = 1u << SUB_BITS;
+    static const unsigned MAX_BITS = 40; // values below 2^41 ns
+    // exact values below SUB_BUCKETS, then SUB_BUCKETS per power of two
+    static const unsigned BUCKETS = (MAX_BITS - SUB_BITS + 2) * SUB_BUCKETS;
+
+    /** Records a duration; any thread, lock-free */
+    void record(chrono::nanoseconds duration) {
+        auto ns = static_cast<uint64_t>(max<int64_t>(0, duration.count()));
+        Stripe &stripe = stripes[metricStripe()];
+        stripe.buckets[bucketOf(ns)].fetch_add(1, memory_order_relaxed);
+        stripe.sum.fetch_add(ns, memory_order_relaxed);
+    }
+
+    /**
+     * @struct Snapshot counts of all stripes, summed
+     */
+    struct Snapshot {
+        vector<uint64_t> buckets;
+        uint64_t count = 0;
+        uint64_t sum = 0; // nanoseconds
+
+        /** @return nanoseconds below which a fraction q of the values lie */
+        double quantile(double q) const;
+    };
+
+    /** @return the distribution recorded so far */
+    Snapshot snapshot() const;
+
+    /** @return bucket of a value in nanoseconds */
+    static unsigned bucketOf(uint64_t ns) {
+        if (ns < SUB_BUCKETS)
+            return static_cast<unsigned>(ns);
+        unsigned exponent = 63 - __builtin_clzll(ns); // >= SUB_BITS
+        if (exponent > MAX_BITS)
+            return BUCKETS - 1;
+        unsigned sub = static_cast<unsigned>(ns >> (exponent - SUB_BITS)) &
+                       (SUB_BUCKETS - 1);
+        return (exponent - SUB_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    /** @return smallest value in nanoseconds of a bucket */
+    static uint64_t lowestOf(unsigned bucket);
+
+    /** @return largest value in nanoseconds of a bucket */
+    static uint64_t highestOf(unsigned bucket);
+
+private:
+    struct alignas(64) Stripe {
+        atomic<uint64_t> buckets[BUCKETS] = {};
+        atomic<uint64_t> sum{0};
+    };
+    Stripe stripes[METRIC_STRIPES];
+};
+
+/**
+ * @class MetricsRegistry
+ * Named metrics of a process, exported in the Prometheus text format.
+ * Metrics are registered once (e.g. when the component using them starts)
+ * and live as long as the process; the hot path keeps the reference it got
+ * and never touches the registry. A metric is identified by its name and
+ * labels ("reason=\"no_account\""); registering it again returns the same
+ * one. Histograms are exported as summaries in seconds, with the quantiles
+ * 0.5, 0.9, 0.99 and 0.999, the sum and the count.
+ */
+class MetricsRegistry {
+public:
+    /** @return the counter of a name and labels, registered if new */
+    Counter &counter(const string &name, const string &help,
+                     const string &labels = "");
+
+    /** @return the gauge of a name and labels, registered if new */
+    Gauge &gauge(const string &name, const string &help,
+                 const string &labels = "");
+
+    /** @return the histogram of a name and labels, registered if new */
+    Histogram &histogram(const string &name, const string &help,
+                         const string &labels = "");
+
+    /** @return all metrics in the Prometheus text exposition format */
+    string render() const;
+
+private:
+    enum Kind { COUNTER, GAUGE, HISTOGRAM };
+
+    struct Entry {
+        string name;
+        string help;
+        string labels;
+        Kind kind;
+        unique_ptr<Counter> counter;
+        unique_ptr<Gauge> gauge;
+        unique_ptr<Histogram> histogram;
+    };
+
+    mutable mutex lock; // guards entries, not the metrics themselves
+    vector<Entry> entries;
+
+    /**
+     * @return the entry of a name and labels, added if new
+     * @throws runtime_error if the name is registered as another kind
+     */
+    Entry &entry(const string &name, const string &help,
+                 const string &labels, Kind kind);
+};
+
+/**
+ * @return the registry of this process
+ */
+MetricsRegistry &metrics();
@@ -0,0 +1,99 @@
+/**
+ * @file MetricsServer.cpp definition for MetricsServer class
+ * @author Nadezhda Chernova
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include "MetricsServer.h"
+
+using namespace std;
+
+MetricsServer::MetricsServer(u_short port, MetricsRegistry &registry)
+        : registry(registry) {
+    listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+        throw runtime_error(string("Failed to create socket: ") +
+                            strerror(errno));
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in me = {};
+    me.sin_family = AF_INET;
+    me.sin_port = htons(port);
+    me.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (::bind(listener, reinterpret_cast<sockaddr *>(&me), sizeof(me)) < 0 ||
+        listen(listener, 16) < 0) {
+        string problem = strerror(errno);
+        close(listener);
+        throw runtime_error("Failed to serve admin port " + to_string(port) +
+                            ": " + problem);
+    }
+    wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake < 0) {
+        close(listener);
+        throw runtime_error(string("Failed to create eventfd: ") +
+                            strerror(errno));
+    }
+    worker = thread([this]() { serve(); });
+}
+
+MetricsServer::~MetricsServer() {
+    uint64_t one = 1;
+    if (write(wake, &one, sizeof(one)) < 0)
+        worker.detach(); // cannot happen; better leak than hang
+    else
+        worker.join();
+    close(wake);
+    close(listener);
+}
+
+void MetricsServer::serve() {
+    pollfd fds[2] = {{listener, POLLIN, 0}, {wake, POLLIN, 0}};
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (fds[1].revents != 0)
+            return;
+        int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client >= 0)
+            answer(client);
+    }
+}
+
+void MetricsServer::answer(int client) {
+    // a slow or silent client must not stall the next scrape for long
+    timeval timeout = {0, 200000};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    char request[1024];
+    (void) !recv(client, request, sizeof(request), 0); // not looked at
+
+    string body = registry.render();
+    string response = "HTTP/1.0 200 OK\r\n"
+                      "Content-Type: text/plain; version=0.0.4\r\n"
+                      "Content-Length: " + to_string(body.size()) +
+                      "\r\n\r\n" + body;
+    const char *data = response.data();
+    size_t left = response.size();
+    while (left > 0) {
+        ssize_t sent = send(client, data, left, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            break;
+        data += sent;
+        left -= sent;
+    }
+    close(client);
+}
@@ -0,0 +1,60 @@
+/**
+ * @file MetricsServer.h declaration for MetricsServer class
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <atomic>
+#include <thread>
+#include "Metrics.h"
+
+using namespace std;
+
+/**
+ * @class MetricsServer
+ * Admin port of a coordinator or participant: every connection gets the
+ * process's metrics (see MetricsRegistry::render) in the Prometheus text
+ * format as an HTTP/1.0 response, whatever it asked for, and is closed. So
+ * Prometheus can scrape it, and "curl host:port/metrics" or
+ * "nc host port" show it. Runs on a thread of its own, away from the
+ * reactors, one connection at a time.
+ *
+ * Failures will be thrown as std::runtime_error by the constructor only.
+ */
+class MetricsServer {
+public:
+    /**
+     * Starts serving on a thread of its own
+     * @param port admin port
+     * @param registry metrics served
+     * @throws runtime_error if the port cannot be served
+     */
+    MetricsServer(u_short port, MetricsRegistry &registry);
+
+    /**
+     * Stops the server and waits for its thread
+     */
+    ~MetricsServer();
+
+    // don't allow any of these:
+    MetricsServer(const MetricsServer &) = delete;
+    MetricsServer &operator=(const MetricsServer &) = delete;
+
+private:
+    MetricsRegistry &registry;
+    int listener;            // listening socket
+    int wake;                // eventfd the destructor signals
+    thread worker;
+
+    /**
+     * Accepts and answers connections until woken
+     */
+    void serve();
+
+    /**
+     * Answers one connection and closes it
+     */
+    void answer(int client);
+};
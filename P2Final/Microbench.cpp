@@ -0,0 +1,83 @@
+/**
+ * @file Microbench.cpp definition for the Microbench harness
+ * @author Nadezhda Chernova
+ */
+
+#include <algorithm>
+#include <iomanip>
+#include "Microbench.h"
+
+using namespace std;
+
+void Microbench::add(const string &name, Function benchmark,
+                     const vector<int64_t> &args) {
+    if (args.empty()) {
+        entries.push_back({name, move(benchmark), 0, false});
+        return;
+    }
+    for (int64_t arg: args)
+        entries.push_back({name, benchmark, arg, true});
+}
+
+vector<BenchResult> Microbench::run(const string &filter,
+                                    chrono::milliseconds minTime) const {
+    const uint64_t most = 1000000000;
+    vector<BenchResult> results;
+    for (const auto &entry: entries) {
+        string name = entry.name;
+        if (entry.hasArg)
+            name += "/" + to_string(entry.arg);
+        if (name.find(filter) == string::npos)
+            continue;
+
+        uint64_t iterations = 1;
+        while (true) {
+            BenchState state(iterations, entry.arg);
+            entry.benchmark(state);
+            auto time = state.time();
+            if (time >= minTime || iterations >= most) {
+                double ns = static_cast<double>(time.count()) / iterations;
+                double perSecond = ns > 0 ? state.items() * 1e9 / ns : 0;
+                results.push_back({name, iterations, ns, perSecond});
+                break;
+            }
+            // aim a bit past the minimum from the rate seen so far
+            uint64_t next = iterations * 2;
+            if (time.count() > 0)
+                next = max(next, static_cast<uint64_t>(
+                        1.2 * minTime.count() * 1e6 * iterations /
+                        time.count()));
+            iterations = min(next, most);
+        }
+    }
+    return results;
+}
+
+void Microbench::printTable(ostream &out,
+                            const vector<BenchResult> &results) {
+    size_t width = 9;
+    for (const auto &result: results)
+        width = max(width, result.name.size());
+    out << left << setw(static_cast<int>(width)) << "Benchmark" << right
+        << setw(14) << "Time/iter" << setw(14) << "Iterations"
+        << setw(16) << "Items/s" << '\n'
+        << string(width + 44, '-') << '\n';
+    for (const auto &result: results)
+        out << left << setw(static_cast<int>(width)) << result.name << right
+            << setw(11) << fixed << setprecision(1) << result.nsPerIteration
+            << " ns" << setw(14) << result.iterations << setw(16)
+            << setprecision(0) << result.itemsPerSecond << '\n';
+}
+
+void Microbench::printJson(ostream &out, const vector<BenchResult> &results) {
+    out << "{\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &result = results[i];
+        out << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << result.name
+            << "\", \"iterations\": " << result.iterations
+            << ", \"ns_per_iteration\": " << fixed << setprecision(2)
+            << result.nsPerIteration << ", \"items_per_second\": "
+            << setprecision(0) << result.itemsPerSecond << "}";
+    }
+    out << "\n  ]\n}\n";
+}
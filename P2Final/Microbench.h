@@ -0,0 +1,150 @@
+/**
+ * @file Microbench.h declaration for the Microbench harness
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Keeps the compiler from optimizing a value (and the code computing it)
+ * away
+ */
+template<typename T>
+inline void doNotOptimize(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ * @class BenchState
+ * Loop control handed to a benchmark, in the style of Google Benchmark:
+ *
+ *     void encode(BenchState &state) {
+ *         ... setup, not timed ...
+ *         while (state.keepRunning())
+ *             ... the code measured, once per iteration ...
+ *     }
+ *
+ * Timing starts with the first keepRunning() and stops when it returns
+ * false; pauseTiming()/resumeTiming() leave out housekeeping in between.
+ */
+class BenchState {
+public:
+    /**
+     * @param iterations times keepRunning() returns true
+     * @param arg the benchmark's argument (e.g. a size), 0 if none
+     */
+    BenchState(uint64_t iterations, int64_t arg)
+            : left(iterations), argument(arg) {}
+
+    /** @return true while iterations are left */
+    bool keepRunning() {
+        if (left == 0) {
+            pauseTiming();
+            return false;
+        }
+        if (!started) {
+            started = true;
+            resumeTiming();
+        }
+        left--;
+        return true;
+    }
+
+    /** Stops the clock */
+    void pauseTiming() {
+        if (running)
+            elapsed += chrono::steady_clock::now() - since;
+        running = false;
+    }
+
+    /** Starts the clock again */
+    void resumeTiming() {
+        since = chrono::steady_clock::now();
+        running = true;
+    }
+
+    /** @return the benchmark's argument */
+    int64_t arg() const { return argument; }
+
+    /** Sets the items (e.g. records or messages) one iteration handles */
+    void setItemsPerIteration(uint64_t items) { itemsPerIteration = items; }
+
+    /** @return time measured */
+    chrono::nanoseconds time() const { return elapsed; }
+
+    /** @return items one iteration handles */
+    uint64_t items() const { return itemsPerIteration; }
+
+private:
+    uint64_t left;
+    int64_t argument;
+    bool started = false;
+    bool running = false;
+    chrono::steady_clock::time_point since;
+    chrono::nanoseconds elapsed{0};
+    uint64_t itemsPerIteration = 1;
+};
+
+/**
+ * @struct BenchResult what one run of a benchmark measured
+ */
+struct BenchResult {
+    string name;         // name, "/arg" appended if it has one
+    uint64_t iterations; // of the final run
+    double nsPerIteration;
+    double itemsPerSecond;
+};
+
+/**
+ * @class Microbench
+ * Registry and runner of microbenchmarks. Each benchmark runs with more
+ * iterations until one run takes at least the minimum time, and that run
+ * is reported, as a table or as JSON.
+ */
+class Microbench {
+public:
+    using Function = function<void(BenchState &)>;
+
+    /**
+     * Registers a benchmark
+     * @param name name, e.g. "wire/decode-binary"
+     * @param benchmark function running the loop
+     * @param args run once per argument, or once with 0 if empty
+     */
+    void add(const string &name, Function benchmark,
+             const vector<int64_t> &args = {});
+
+    /**
+     * Runs the benchmarks whose name contains a filter
+     * @param filter part of the name, empty for all
+     * @param minTime least time of the reported run
+     * @return results in registration order
+     */
+    vector<BenchResult> run(const string &filter,
+                            chrono::milliseconds minTime) const;
+
+    /** Writes results as an aligned table */
+    static void printTable(ostream &out, const vector<BenchResult> &results);
+
+    /** Writes results as a JSON object */
+    static void printJson(ostream &out, const vector<BenchResult> &results);
+
+private:
+    struct Entry {
+        string name;
+        Function benchmark;
+        int64_t arg;
+        bool hasArg;
+    };
+
+    vector<Entry> entries;
+};
@@ -0,0 +1,84 @@
+/**
+ * @file Money.cpp definition for Money class
+ * @author Nadezhda Chernova
+ */
+
+#include <cstring>
+#include "Money.h"
+
+using namespace std;
+
+bool Money::parse(string_view text, Money &amount) {
+    size_t i = 0;
+    bool negative = false;
+    if (i < text.size() && (text[i] == '-' || text[i] == '+'))
+        negative = text[i++] == '-';
+
+    int64_t whole = 0;
+    size_t digits = 0;
+    for (; i < text.size() && text[i] >= '0' && text[i] <= '9'; i++, digits++) {
+        if (whole > (INT64_MAX / 100 - 9) / 10)
+            return false; // overflow
+        whole = whole * 10 + (text[i] - '0');
+    }
+
+    int64_t fraction = 0;
+    int scale = 100;
+    if (i < text.size() && text[i] == '.') {
+        for (i++; i < text.size() && text[i] >= '0' && text[i] <= '9'; i++) {
+            if (scale == 1)
+                return false; // more than two fractional digits
+            scale /= 10;
+            fraction += (text[i] - '0') * scale;
+            digits++;
+        }
+    }
+    if (digits == 0 || i != text.size())
+        return false;
+
+    amount.value = negative ? -(whole * 100 + fraction) : whole * 100 + fraction;
+    return true;
+}
+
+size_t Money::format(char *out) const {
+    // two digits at a time, from the right
+    static const char PAIRS[] =
+            "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+            "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+
+    char digits[MAX_TEXT];
+    char *end = digits + sizeof(digits);
+    char *p = end;
+    // work with the magnitude as unsigned so INT64_MIN does not overflow
+    uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value)
+                                   : static_cast<uint64_t>(value);
+    const char *pair = PAIRS + 2 * (magnitude % 100);
+    *--p = pair[1];
+    *--p = pair[0];
+    *--p = '.';
+    magnitude /= 100;
+    while (magnitude >= 100) {
+        pair = PAIRS + 2 * (magnitude % 100);
+        *--p = pair[1];
+        *--p = pair[0];
+        magnitude /= 100;
+    }
+    if (magnitude >= 10) {
+        pair = PAIRS + 2 * magnitude;
+        *--p = pair[1];
+        *--p = pair[0];
+    } else {
+        *--p = static_cast<char>('0' + magnitude);
+    }
+    if (value < 0)
+        *--p = '-';
+
+    memcpy(out, p, end - p);
+    return end - p;
+}
+
+string Money::toString() const {
+    char text[MAX_TEXT];
+    return string(text, format(text));
+}
@@ -0,0 +1,76 @@
+/**
+ * @file Money.h declaration for Money class
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+/**
+ * @class Money
+ * Exact amount of money in minor units (cents), a signed 64-bit integer.
+ * Balances, holds, amounts on the wire, in the logs and in the files are
+ * all Money, so sums never drift and comparisons are single integer
+ * compares. Amounts are only converted from and to decimal text at the
+ * edges (command line, text wire mode, text accounts file, log messages)
+ * by parse() and format(), which use no iostreams or locales.
+ */
+class Money {
+public:
+    static const size_t MAX_TEXT = 24; // longest formatted amount
+
+    constexpr Money() = default;
+
+    /** @return amount of the given number of cents */
+    static constexpr Money fromCents(int64_t cents) { return Money(cents); }
+
+    /** @return amount in cents */
+    constexpr int64_t cents() const { return value; }
+
+    /**
+     * Parses a decimal amount with at most two fractional digits, e.g.
+     * "-100.5" or "100"
+     * @param text amount
+     * @param amount parsed amount
+     * @return false if the text is not an amount or is out of range
+     */
+    static bool parse(string_view text, Money &amount);
+
+    /**
+     * Formats the amount with two fractional digits, e.g. "-100.50"
+     * @param out destination, at least MAX_TEXT bytes
+     * @return bytes written (no terminating NUL)
+     */
+    size_t format(char *out) const;
+
+    /** @return the amount formatted as by format() */
+    string toString() const;
+
+    constexpr Money operator-() const { return Money(-value); }
+    constexpr Money operator+(Money other) const { return Money(value + other.value); }
+    constexpr Money operator-(Money other) const { return Money(value - other.value); }
+    constexpr Money &operator+=(Money other) { value += other.value; return *this; }
+    constexpr Money &operator-=(Money other) { value -= other.value; return *this; }
+
+    constexpr bool operator==(Money other) const { return value == other.value; }
+    constexpr bool operator!=(Money other) const { return value != other.value; }
+    constexpr bool operator<(Money other) const { return value < other.value; }
+    constexpr bool operator<=(Money other) const { return value <= other.value; }
+    constexpr bool operator>(Money other) const { return value > other.value; }
+    constexpr bool operator>=(Money other) const { return value >= other.value; }
+
+    constexpr bool isZero() const { return value == 0; }
+    constexpr bool isNegative() const { return value < 0; }
+    constexpr bool isPositive() const { return value > 0; }
+
+private:
+    int64_t value = 0; // cents
+
+    constexpr explicit Money(int64_t cents) : value(cents) {}
+};
@@ -1,10 +1,15 @@
 /**
- * @file 2PC_Participant.h declaration and definition for Protocol enum
+ * @file Protocol.h declaration and definition for Protocol enum and Message
  * @author Nadezhda Chernova
  */
 
 #pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <string>
+#include <string_view>
+#include "Money.h"
 
 using namespace std;
 
@@ -13,15 +18,123 @@ using namespace std;
  * Defines different protocol messages used in the 2-phase commit protocol.
  * These messages are used to coordinate the actions between participants
  * and coordinator based on the received commands (responses).
+ * The numeric values are the opcodes of the binary wire format, so new
+ * messages must only be appended.
  */
-enum Protocol {
+enum Protocol : uint8_t {
     VOTE_REQUEST,
     VOTE_COMMIT,
     VOTE_ABORT,
     GLOBAL_COMMIT,
     GLOBAL_ABORT,
     ACK,
-    UNKNOWN_PROTOCOL
+    UNKNOWN_PROTOCOL,
+    DECISION_REQUEST, // participant asks the coordinator for an outcome
+    ONE_PHASE_COMMIT, // commit-if-valid for a transaction at one participant
+    VOTE_READONLY,    // vote of a participant whose legs change nothing
+    BALANCE_INQUIRY,  // asks for the balances of the accounts of its legs
+    BALANCE,          // balances, one leg per account asked for
+    DECISION_UNKNOWN  // the coordinator asked did not start the transaction
+};
+
+/**
+ * Number of opcodes; received opcodes at or above it decode as
+ * UNKNOWN_PROTOCOL. Keep it after the last message appended.
+ */
+const uint8_t PROTOCOL_OPCODES = DECISION_UNKNOWN + 1;
+
+/**
+ * Transaction ids with the top bit set are never sent on the wire. The server
+ * assigns one to every text-mode message that carries no transaction id, so a
+ * legacy client gets exactly one implicit transaction per connection.
+ */
+const uint64_t IMPLICIT_TXN = 1ULL << 63;
+
+/**
+ * Message flag: the transaction is traced, so the receiver records the
+ * spans of its phases too (see Tracer)
+ */
+const uint8_t MESSAGE_TRACED = 1;
+
+/**
+ * Message flag: the frame carries the decision port of the coordinator
+ * (see Message::decisionPort); set by the encoder, binary mode only
+ */
+const uint8_t MESSAGE_DECIDER = 2;
+
+/**
+ * @struct Leg one account delta of a transaction at a participant
+ */
+struct Leg {
+    string_view account; // account id
+    Money amount;        // negative to withdraw
+};
+
+/**
+ * @return true for the requests that carry legs
+ */
+inline bool carriesLegs(Protocol type) {
+    return type == VOTE_REQUEST || type == ONE_PHASE_COMMIT ||
+           type == BALANCE_INQUIRY || type == BALANCE;
+}
+
+/**
+ * @struct Message
+ * One decoded protocol message. A VOTE-REQUEST carries the legs the
+ * participant must validate and hold together, all or nothing. A
+ * ONE-PHASE-COMMIT carries all legs of a transaction that involves no other
+ * participant: they are validated and applied at once, and the reply is
+ * ACK (committed), VOTE-ABORT (refused) or VOTE-COMMIT (held instead, the
+ * transaction continues with phase 2 like after a VOTE-REQUEST). Either may
+ * be answered with VOTE-READONLY if the legs are valid but change no balance
+ * (e.g. they only check that an account exists): the participant holds
+ * nothing and takes no part in phase 2.
+ *
+ * A BALANCE-INQUIRY lists accounts (the amounts are ignored) and is
+ * answered with BALANCE, the committed balance of each account as the
+ * amount of its leg, in the same order, or with VOTE-ABORT if an account
+ * does not exist. It belongs to no transaction; the txn is only echoed.
+ *
+ * A coordinator serving DECISION-REQUESTs puts its decision port in its
+ * VOTE-REQUESTs and ONE-PHASE-COMMITs, so that a participant holding the
+ * transaction in doubt asks the coordinator that decides it (at the
+ * address the request came from). It answers GLOBAL-COMMIT, GLOBAL-ABORT
+ * or, for a transaction it did not start, DECISION-UNKNOWN. The legs and
+ * their accounts are views: on the receiving side they point into the
+ * connection's buffers and are only valid until the message has been
+ * processed; on the sending side they point at the caller's data.
+ */
+struct Message {
+    Protocol type = UNKNOWN_PROTOCOL;
+    uint64_t txn = 0;          // transaction id, echoed in every reply
+    const Leg *legs = nullptr; // account deltas (VOTE-REQUEST only)
+    size_t legCount = 0;
+    uint8_t flags = 0;         // MESSAGE_TRACED, binary mode only
+    uint16_t decisionPort = 0; // VOTE-REQUEST and ONE-PHASE-COMMIT: port
+                               // answering DECISION-REQUESTs, 0 if none;
+                               // binary mode only
+};
+
+/**
+ * @struct Decider where the outcome of a transaction is asked for: the
+ * decision port of the coordinator that sent its VOTE-REQUEST, at the
+ * address the request came from (see Message::decisionPort). Fixed size,
+ * so it is copied along with a request without allocating.
+ */
+struct Decider {
+    char host[16] = {}; // dotted IPv4 address, NUL-terminated
+    uint16_t port = 0;  // 0 if unknown
+
+    Decider() = default;
+
+    /** @param host dotted IPv4 address, cut to fit */
+    Decider(string_view host, uint16_t port) : port(port) {
+        memcpy(this->host, host.data(),
+               min(host.size(), sizeof(this->host) - 1));
+    }
+
+    /** @return true if the transaction came with a decision port */
+    bool known() const { return port != 0; }
 };
 
 /**
@@ -29,7 +142,7 @@ enum Protocol {
  * @param message protocol message as a string
  * @return Protocol enum value
  */
-Protocol toProtocol(const string &message) {
+inline Protocol toProtocol(string_view message) {
     if (message == "VOTE-REQUEST")
         return VOTE_REQUEST;
     if (message == "VOTE-COMMIT")
@@ -42,6 +155,18 @@ Protocol toProtocol(const string &message) {
         return GLOBAL_ABORT;
     if (message == "ACK")
         return ACK;
+    if (message == "DECISION-REQUEST")
+        return DECISION_REQUEST;
+    if (message == "ONE-PHASE-COMMIT")
+        return ONE_PHASE_COMMIT;
+    if (message == "VOTE-READONLY")
+        return VOTE_READONLY;
+    if (message == "BALANCE-INQUIRY")
+        return BALANCE_INQUIRY;
+    if (message == "BALANCE")
+        return BALANCE;
+    if (message == "DECISION-UNKNOWN")
+        return DECISION_UNKNOWN;
     return UNKNOWN_PROTOCOL;
 }
 
@@ -50,7 +175,7 @@ Protocol toProtocol(const string &message) {
  * @param protocol Protocol enum value
  * @return protocol message as a string
  */
-const char *toString(Protocol protocol) {
+inline const char *toString(Protocol protocol) {
     switch (protocol) {
         case VOTE_REQUEST:
             return "VOTE-REQUEST";
@@ -64,9 +189,19 @@ const char *toString(Protocol protocol) {
             return "GLOBAL-ABORT";
         case ACK:
             return "ACK";
+        case DECISION_REQUEST:
+            return "DECISION-REQUEST";
+        case ONE_PHASE_COMMIT:
+            return "ONE-PHASE-COMMIT";
+        case VOTE_READONLY:
+            return "VOTE-READONLY";
+        case BALANCE_INQUIRY:
+            return "BALANCE-INQUIRY";
+        case BALANCE:
+            return "BALANCE";
+        case DECISION_UNKNOWN:
+            return "DECISION-UNKNOWN";
         default:
             return "UNKNOWN-PROTOCOL"; // handle unexpected messages
     }
 }
-
-
@@ -0,0 +1,65 @@
+/**
+ * @file RingBuffer.cpp definition for a mirrored byte ring buffer
+ * @author Nadezhda Chernova
+ */
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include "RingBuffer.h"
+
+using namespace std;
+
+RingBuffer::RingBuffer(size_t requested) : head(0), tail(0) {
+    // Round up to a power of two that is at least one page
+    capacity = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    while (capacity < requested)
+        capacity <<= 1;
+    mask = capacity - 1;
+
+    int fd = memfd_create("ring", MFD_CLOEXEC);
+    if (fd < 0)
+        throw runtime_error(
+                string("Failed to create ring buffer: ") + strerror(errno));
+    if (ftruncate(fd, static_cast<off_t>(capacity)) < 0) {
+        close(fd);
+        throw runtime_error(
+                string("Failed to size ring buffer: ") + strerror(errno));
+    }
+
+    // Reserve twice the capacity, then map the same pages into both halves
+    void *reserved = mmap(nullptr, 2 * capacity, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED) {
+        close(fd);
+        throw runtime_error(
+                string("Failed to reserve ring buffer: ") + strerror(errno));
+    }
+    base = static_cast<char *>(reserved);
+    if (mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             fd, 0) == MAP_FAILED ||
+        mmap(base + capacity, capacity, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        int error = errno;
+        munmap(base, 2 * capacity);
+        close(fd);
+        throw runtime_error(
+                string("Failed to map ring buffer: ") + strerror(error));
+    }
+    close(fd); // the mappings keep the memory alive
+}
+
+RingBuffer::RingBuffer(RingBuffer &&other) noexcept
+        : base(other.base), capacity(other.capacity), mask(other.mask),
+          head(other.head), tail(other.tail) {
+    other.base = nullptr;
+    other.head = other.tail = 0;
+}
+
+RingBuffer::~RingBuffer() {
+    if (base != nullptr)
+        munmap(base, 2 * capacity);
+}
@@ -0,0 +1,61 @@
+/**
+ * @file RingBuffer.h declaration for a mirrored byte ring buffer
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @class RingBuffer is a fixed-capacity byte FIFO used for socket input and
+ *        output. The same memory is mapped twice, back to back, so the
+ *        readable and the writable regions are always contiguous even when
+ *        they wrap around the end of the buffer. That lets recv() write
+ *        straight into the buffer and lets frames be parsed in place, without
+ *        copying a wrapped frame out first.
+ *
+ *        The capacity is rounded up to a whole number of pages.
+ *
+ *        Failures will be thrown as std::runtime_error.
+ */
+class RingBuffer {
+public:
+    explicit RingBuffer(size_t capacity);
+    RingBuffer(RingBuffer &&other) noexcept;
+    ~RingBuffer();
+
+    // don't allow any of these:
+    RingBuffer(const RingBuffer &) = delete;
+    RingBuffer &operator=(const RingBuffer &) = delete;
+    RingBuffer &operator=(RingBuffer &&) = delete;
+
+    /** @return start of the readable bytes */
+    const char *read_ptr() const { return base + (head & mask); }
+
+    /** @return number of readable bytes */
+    size_t readable() const { return tail - head; }
+
+    /** Drops n bytes from the front of the readable region */
+    void consume(size_t n) { head += n; }
+
+    /** @return start of the free space */
+    char *write_ptr() { return base + (tail & mask); }
+
+    /** @return number of bytes that can be written */
+    size_t writable() const { return capacity - readable(); }
+
+    /** Makes n bytes written at write_ptr() readable */
+    void commit(size_t n) { tail += n; }
+
+    bool empty() const { return head == tail; }
+
+    size_t size() const { return capacity; }
+
+private:
+    char *base;       // first of the two mappings
+    size_t capacity;  // bytes, a power of two
+    size_t mask;      // capacity - 1
+    uint64_t head;    // total bytes consumed
+    uint64_t tail;    // total bytes committed
+};
@@ -0,0 +1,76 @@
+/**
+ * @file ShardMailbox.cpp definition for Mailbox class
+ * @author Nadezhda Chernova
+ */
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include "ShardMailbox.h"
+
+using namespace std;
+
+Mailbox::Mailbox() : head(&stub), tail(&stub) {
+    event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event < 0)
+        throw runtime_error(
+                string("Failed to create eventfd: ") + strerror(errno));
+}
+
+Mailbox::~Mailbox() {
+    while (take() != nullptr) {
+    }
+    close(event);
+}
+
+void Mailbox::post(unique_ptr<ShardMail> mail) {
+    push(mail.release());
+    if (!signaled.exchange(true)) {
+        uint64_t one = 1;
+        ssize_t written = ::write(event, &one, sizeof(one));
+        (void) written; // only fails if the counter is full, still readable
+    }
+}
+
+void Mailbox::push(ShardMail *mail) {
+    mail->next.store(nullptr, memory_order_relaxed);
+    ShardMail *previous = head.exchange(mail, memory_order_acq_rel);
+    // until this store the mail is posted but not reachable from tail
+    previous->next.store(mail, memory_order_release);
+}
+
+unique_ptr<ShardMail> Mailbox::take() {
+    ShardMail *first = tail;
+    ShardMail *next = first->next.load(memory_order_acquire);
+    if (first == &stub) {
+        if (next == nullptr)
+            return nullptr;
+        tail = next;
+        first = next;
+        next = next->next.load(memory_order_acquire);
+    }
+    if (next != nullptr) {
+        tail = next;
+        return unique_ptr<ShardMail>(first);
+    }
+    if (first != head.load(memory_order_acquire))
+        return nullptr; // a post() is between its exchange and its link
+    push(&stub);        // first is the last mail: put the stub behind it
+    next = first->next.load(memory_order_acquire);
+    if (next == nullptr)
+        return nullptr;
+    tail = next;
+    return unique_ptr<ShardMail>(first);
+}
+
+void Mailbox::rearm() {
+    // consume the old signal before asking for a new one: the other way
+    // round, the read could swallow the signal of a post() whose mail the
+    // drain then misses behind one that is still being linked
+    uint64_t count;
+    ssize_t got = ::read(event, &count, sizeof(count));
+    (void) got; // EAGAIN when nothing was signaled
+    signaled.store(false);
+}
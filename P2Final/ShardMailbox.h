@@ -0,0 +1,114 @@
+/**
+ * @file ShardMailbox.h declaration for ShardMail and Mailbox
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "AccountTable.h"
+#include "Protocol.h"
+
+using namespace std;
+
+/**
+ * @enum ShardMailType what one shard of a participant asks of another
+ */
+enum ShardMailType : uint8_t {
+    SHARD_REQUEST, // client's request, handed to the transaction's home shard
+    SHARD_PREPARE, // home asks the owner of some legs to hold them
+    SHARD_COMMIT,  // home tells an owner to apply the legs it holds
+    SHARD_ABORT,   // home tells an owner to release the legs it holds
+    SHARD_VOTED,   // owner answers its home: VOTE-COMMIT, VOTE-ABORT or ACK
+    SHARD_REPLY,   // home's reply for a client connected to another shard
+    SHARD_STOP,    // stop serving and roll back
+    SHARD_INQUIRE, // asks the owner of some accounts for their balances
+    SHARD_BALANCE  // owner answers: BALANCE with the legs, or VOTE-ABORT
+};
+
+/**
+ * @struct ShardMail one message between the shards of a participant. Unlike
+ * a Message it owns its legs, since it outlives the buffers of the
+ * connection it came from.
+ */
+struct ShardMail {
+    atomic<ShardMail *> next{nullptr}; // link in the mailbox
+    ShardMailType type = SHARD_STOP;
+    Protocol protocol = UNKNOWN_PROTOCOL; // client command or reply
+    unsigned from = 0;   // sending shard
+    uint64_t client = 0; // client of the request, on shard `from` (REQUEST)
+                         // or on the receiving shard (REPLY); inquiry of
+                         // shard `from` (INQUIRE) or of the receiver
+                         // (BALANCE)
+    uint64_t txn = 0;    // transaction id
+    bool last = false;   // REPLY: close the connection after it
+    bool traced = false; // REQUEST, PREPARE, COMMIT, ABORT: of a traced
+                         // transaction, see Tracer
+    Decider decider;     // REQUEST, PREPARE: asked if the transaction is
+                         // in doubt
+    vector<AccountDelta> legs; // REQUEST and PREPARE of legs, accounts
+                               // asked for (INQUIRE) and their balances
+};
+
+/**
+ * @class Mailbox
+ * Inbox of one shard: an unbounded lock-free queue that any thread may
+ * post() to and only the owning shard's thread take()s from (Vyukov's
+ * intrusive MPSC queue). Posting is one atomic exchange and never waits for
+ * the owner.
+ *
+ * The owner sleeps in epoll_wait(), so it watches fd(), an eventfd that a
+ * post() signals when the owner may have stopped looking. The owner calls
+ * rearm() before it drains the queue; a post() that the drain may miss
+ * finds the mailbox rearmed and signals again.
+ *
+ * Failures will be thrown as std::runtime_error by the constructor only.
+ */
+class Mailbox {
+public:
+    /**
+     * @throws runtime_error if the eventfd cannot be created
+     */
+    Mailbox();
+
+    /**
+     * Deletes mail that was never taken
+     */
+    ~Mailbox();
+
+    // don't allow any of these:
+    Mailbox(const Mailbox &) = delete;
+    Mailbox &operator=(const Mailbox &) = delete;
+
+    /**
+     * Queues mail for the owner; any thread, never blocks
+     */
+    void post(unique_ptr<ShardMail> mail);
+
+    /**
+     * Dequeues the oldest mail; owner's thread only
+     * @return mail, nullptr if there is none (or it is still being linked)
+     */
+    unique_ptr<ShardMail> take();
+
+    /**
+     * Consumes the eventfd signal, then asks for a new one; call before
+     * draining the queue with take()
+     */
+    void rearm();
+
+    /** @return eventfd that becomes readable when mail arrives */
+    int fd() const { return event; }
+
+private:
+    alignas(64) atomic<ShardMail *> head; // most recently posted
+    alignas(64) ShardMail *tail;          // next to take (owner)
+    ShardMail stub;                       // keeps the queue non-empty
+    alignas(64) atomic<bool> signaled{false}; // eventfd written since rearm()
+    int event;
+
+    void push(ShardMail *mail);
+};
@@ -0,0 +1,159 @@
+/**
+ * @file ShardedParticipant.cpp definition for ShardedParticipant class
+ * @author Nadezhda Chernova
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <csignal>
+#include <stdexcept>
+#include "ShardedParticipant.h"
+
+using namespace std;
+
+/**
+ * @return FNV-1a hash of the sorted ids of the escrow accounts, 1 if there
+ * are none, never 0
+ */
+static uint64_t digestOf(const AccountTable &escrow) {
+    vector<string_view> ids;
+    escrow.forEach([&](string_view account, Money) {
+        ids.push_back(account);
+    });
+    sort(ids.begin(), ids.end());
+    uint64_t hash = 14695981039346656037ULL;
+    auto mix = [&](char c) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ULL;
+    };
+    for (string_view id: ids) {
+        for (char c: id)
+            mix(c);
+        mix('\n'); // "ab" "c" is not "a" "bc"
+    }
+    return ids.empty() || hash == 0 ? 1 : hash;
+}
+
+ShardedParticipant::ShardedParticipant(u_short serve_port,
+                                       const string &accounts_filename,
+                                       const string &log_filename,
+                                       const ParticipantOptions &options)
+        : accounts_filename(accounts_filename),
+          count(options.shards),
+          diagnostics(log_filename, options.log),
+          placements(new atomic<uint64_t>[PLACEMENTS]()) {
+    if (count < 2 || count > MAX_SHARDS)
+        throw runtime_error("A sharded participant needs 2 to " +
+                            to_string(MAX_SHARDS) + " shards");
+    escrowLines = Participant::readEscrow(accounts_filename, escrow);
+    digest = digestOf(escrow);
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &allowed))
+                cpus.push_back(cpu);
+
+    for (unsigned i = 0; i < count; i++)
+        mailboxes.push_back(make_unique<Mailbox>());
+    for (unsigned i = 0; i < count; i++)
+        shards.push_back(make_unique<Participant>(
+                serve_port, accounts_filename, log_filename, options, this, i));
+
+    string sizes;
+    for (const auto &shard: shards)
+        sizes += (sizes.empty() ? "" : ", ") +
+                 to_string(shard->balances().size());
+    log("Accounts partitioned across " + to_string(count) + " shards on " +
+        to_string(cpus.size()) + " CPUs: " + sizes + ", " +
+        to_string(escrow.size()) + " escrow accounts in every shard");
+}
+
+ShardedParticipant::~ShardedParticipant() {
+    for (auto &worker: threads)
+        if (worker.joinable())
+            worker.join();
+    try {
+        vector<const AccountStore *> tables;
+        AccountTable merged; // escrow accounts: the sum of the slices
+        for (auto &shard: shards) {
+            shard->checkpoint(); // syncs the log first
+            tables.push_back(&shard->balances());
+        }
+        escrow.forEach([&](string_view account, Money) {
+            AccountKey key;
+            AccountKey::pack(account, key);
+            Money &sum = merged.insert(key);
+            for (const AccountStore *table: tables)
+                if (const Money *slice = table->find(key))
+                    sum += *slice;
+        });
+        // readable copy of the balances; each shard's checkpoint has its
+        // own log record, so the file names none
+        Participant::writeAccountsFile(accounts_filename, escrowLines, tables,
+                                       &merged);
+    } catch (const exception &e) {
+        log(e.what(), LOG_ERROR);
+    }
+    shards.clear();
+}
+
+void ShardedParticipant::serve() {
+    // only this thread takes Ctrl-C, so the handler runs on shard 0
+    sigset_t blocked, previous;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+    for (unsigned i = 1; i < count; i++)
+        threads.emplace_back([this, i]() {
+            pin(i);
+            try {
+                shards[i]->serve();
+            } catch (const exception &e) {
+                shards[i]->log("Error. " + string(e.what()), LOG_ERROR);
+                shards[i]->stop();
+                stopShards(i); // the others cannot decide without it
+            }
+        });
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+
+    pin(0);
+    shards[0]->serve();
+    for (auto &worker: threads)
+        worker.join();
+}
+
+void ShardedParticipant::stop() {
+    stopShards(0);
+    shards[0]->stop();
+}
+
+Money ShardedParticipant::slice(Money balance, unsigned shard) const {
+    int64_t share = balance.cents() / count;
+    int64_t rest = balance.cents() - share * count; // same sign as balance
+    if (shard < static_cast<unsigned>(rest < 0 ? -rest : rest))
+        share += rest < 0 ? -1 : 1;
+    return Money::fromCents(share);
+}
+
+void ShardedParticipant::log(const string &message, LogLevel level) {
+    diagnostics.log(level, message);
+}
+
+void ShardedParticipant::stopShards(unsigned except) {
+    for (unsigned i = 0; i < count; i++)
+        if (i != except)
+            post(i, make_unique<ShardMail>()); // SHARD_STOP
+}
+
+void ShardedParticipant::pin(unsigned shard) const {
+    if (cpus.empty())
+        return;
+    cpu_set_t cpu;
+    CPU_ZERO(&cpu);
+    CPU_SET(cpus[shard % cpus.size()], &cpu);
+    // best effort: a shard that cannot be pinned still runs
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu);
+}
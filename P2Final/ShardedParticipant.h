@@ -0,0 +1,209 @@
+/**
+ * @file ShardedParticipant.h declaration for ShardedParticipant class
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "2PC_Participant.h"
+#include "ShardMailbox.h"
+
+using namespace std;
+
+/**
+ * @class ShardedParticipant
+ * A participant that runs one reactor thread per core
+ * (ParticipantOptions::shards of them, each pinned to its own CPU). Every
+ * shard is a Participant that owns the accounts whose key hashes to it,
+ * with its own write-ahead log and account store, so no account, hold or log
+ * is ever touched by two threads and none of them needs a lock.
+ *
+ * All shards listen on the same port (SO_REUSEPORT) and the kernel spreads
+ * connections across them. A transaction whose legs all belong to one
+ * shard is decided by that owner: a shard hands a request for another
+ * owner over through that shard's Mailbox, a lock-free queue that wakes
+ * the owner's epoll loop through an eventfd, and the reply travels back
+ * the same way, so it costs one hand-off each way at most and none if it
+ * arrives at its owner. The owner is noted in a table all shards read
+ * (see place()), so that the decision, which carries no legs, finds it
+ * too. A transaction whose legs span shards is decided by its home shard
+ * (txn % shards), which has those shards vote first (see
+ * Participant::route()). A coordinator keeping several connections
+ * (--connections) reaches several shards at once.
+ *
+ * Escrow accounts, marked by "# escrow <account>" lines at the top of the
+ * accounts file, are meant for hot accounts such as merchant settlement
+ * accounts that take part in many concurrent transactions. Every shard owns
+ * a slice of such an account: on first start each gets an equal share of
+ * the balance, and a shard holds, commits and logs the legs on the account
+ * of its own transactions against its own slice. Deposits add to the slice
+ * and withdrawals are covered by what is available in it, so legs on the
+ * account commute and never cross shards, and the account takes as many
+ * transactions at once as there are cores. The slices add up to the
+ * balance; a withdrawal larger than the slice of the deciding shard is
+ * refused even if the sum would cover it.
+ *
+ * The shards share one diagnostic log. On shutdown every shard checkpoints
+ * and the text accounts file is rewritten with the balances of all of them,
+ * the slices of escrow accounts summed up.
+ * The number of shards must stay the same across restarts, since each
+ * shard's files only hold its own partition, and so must the escrow
+ * accounts, since each shard's store holds only its slices of them; a
+ * participant refuses to start on files of another layout or with other
+ * escrow accounts (see escrowDigest()).
+ *
+ * Failures will be thrown as std::runtime_error.
+ */
+class ShardedParticipant {
+public:
+    static const unsigned MAX_SHARDS = 1024;
+
+    /**
+     * Creates the shards, each recovering its partition
+     * @param serve_port port number on which all shards listen
+     * @param accounts_filename filename where account info is stored
+     * @param log_filename filename where transaction logs are stored
+     * @param options tuning knobs, including the number of shards
+     * @throws runtime_error if there are fewer than two or more than
+     * MAX_SHARDS shards, or a shard cannot start
+     */
+    ShardedParticipant(u_short serve_port, const string &accounts_filename,
+                       const string &log_filename,
+                       const ParticipantOptions &options);
+
+    /**
+     * Waits for the shards' threads, then checkpoints every shard and
+     * refreshes the text accounts file
+     */
+    ~ShardedParticipant();
+
+    // don't allow any of these:
+    ShardedParticipant(const ShardedParticipant &) = delete;
+    ShardedParticipant &operator=(const ShardedParticipant &) = delete;
+
+    /**
+     * Runs shard 0 on the calling thread and every other shard on a thread
+     * of its own until all of them stopped
+     */
+    void serve();
+
+    /**
+     * Stops serving and rolls back changes, on every shard. Call on the
+     * thread that called serve() (the only one that takes signals).
+     */
+    void stop();
+
+    /**
+     * Logs a message to the shared diagnostic log
+     */
+    void log(const string &message, LogLevel level = LOG_INFO);
+
+    /** @return number of shards */
+    unsigned size() const { return count; }
+
+    /**
+     * @return digest of the ids of the escrow accounts, never 0, recorded
+     * in the account store of every shard
+     */
+    uint64_t escrowDigest() const { return digest; }
+
+    /** @return true for an escrow account, with a slice in every shard */
+    bool isEscrow(const AccountKey &account) const {
+        return escrow.find(account) != nullptr;
+    }
+
+    /**
+     * @param balance balance of an escrow account
+     * @param shard shard index
+     * @return the shard's slice of the balance; the slices differ by one
+     * cent at most and add up to the balance
+     */
+    Money slice(Money balance, unsigned shard) const;
+
+    /** @return shard owning an account (not an escrow account) */
+    unsigned owner(const AccountKey &account) const {
+        // high hash bits: the table of each shard indexes by the low ones
+        return static_cast<unsigned>(((account.hash() >> 32) * count) >> 32);
+    }
+
+    /**
+     * @param txn transaction id
+     * @param origin shard the request arrived at
+     * @return home shard of the transaction, deciding it if its legs span
+     * shards; implicit transactions live and die with their connection, so
+     * they stay at its shard
+     */
+    unsigned home(uint64_t txn, unsigned origin) const {
+        return (txn & IMPLICIT_TXN) != 0 ? origin
+                                         : static_cast<unsigned>(txn % count);
+    }
+
+    /**
+     * Notes the shard deciding a transaction whose legs it owns alone;
+     * any thread. The table has a slot per PLACEMENTS ids, so a note may be
+     * overwritten by a later transaction's.
+     * @param txn transaction id, not an implicit one
+     * @param owner shard holding the legs
+     */
+    void place(uint64_t txn, unsigned owner) {
+        placements[txn & (PLACEMENTS - 1)].store(
+                (txn & ~(PLACEMENTS - 1)) | (owner + 1), memory_order_release);
+    }
+
+    /**
+     * @param txn transaction id
+     * @param otherwise returned if no shard was noted for the transaction
+     * @return shard noted by place() for the transaction
+     */
+    unsigned placed(uint64_t txn, unsigned otherwise) const {
+        uint64_t note = placements[txn & (PLACEMENTS - 1)].load(
+                memory_order_acquire);
+        if ((note & ~(PLACEMENTS - 1)) != (txn & ~(PLACEMENTS - 1)) ||
+            (note & (PLACEMENTS - 1)) == 0)
+            return otherwise;
+        return static_cast<unsigned>(note & (PLACEMENTS - 1)) - 1;
+    }
+
+    /** Hands mail to a shard; any thread */
+    void post(unsigned shard, unique_ptr<ShardMail> mail) {
+        mailboxes[shard]->post(move(mail));
+    }
+
+    /** @return inbox of a shard */
+    Mailbox &mailbox(unsigned shard) { return *mailboxes[shard]; }
+
+    /** @return diagnostic log shared by the shards */
+    Logger &logger() { return diagnostics; }
+
+private:
+    // slots of the placement table; the low bits of an id pick its slot,
+    // the high ones and the owner plus one share the slot's word
+    static const uint64_t PLACEMENTS = 1 << 16;
+
+    string accounts_filename; // text accounts file of all shards
+    unsigned count;           // shards
+    Logger diagnostics;       // shared by the shards
+    AccountTable escrow;      // escrow accounts (balances unused), read-only
+    string escrowLines;       // "# escrow <account>" lines of the file
+    uint64_t digest;          // see escrowDigest()
+    vector<int> cpus;         // CPUs this process may run on
+    vector<unique_ptr<Mailbox>> mailboxes; // one per shard
+    unique_ptr<atomic<uint64_t>[]> placements; // see place()
+    vector<unique_ptr<Participant>> shards;
+    vector<thread> threads;   // shards 1.. (shard 0 runs in serve())
+
+    /**
+     * Posts SHARD_STOP to every shard except one
+     */
+    void stopShards(unsigned except);
+
+    /**
+     * Pins the calling thread to the CPU of a shard
+     */
+    void pin(unsigned shard) const;
+};
@@ -4,33 +4,92 @@
  * @see Seattle University, CPSC 5042, Spring 2024, ICE 4 professor's solution
  */
 
+#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <cstring>
 #include <iostream>
+#include "Metrics.h"
 #include "TCPClient.h"
 
 using namespace std;
 
-TCPClient::TCPClient(const string &server_host, const u_short server_port) {
-   s = socket(AF_INET, SOCK_STREAM, 0);
+static Counter &bytesReceived = metrics().counter(
+        "net_received_bytes_total", "Bytes received on TCP connections");
+static Counter &bytesSent = metrics().counter(
+        "net_sent_bytes_total", "Bytes sent on TCP connections");
+
+TCPClient::TCPClient(const string &server_host, const u_short server_port,
+                     WireMode mode)
+        : TCPClient(resolve(server_host, server_port), mode) {
+}
+
+TCPClient::TCPClient(const sockaddr_in &server_address, WireMode mode,
+                     int timeout_ms)
+        : mode(mode), in(BUFFER_SIZE), pending(0), legs(MAX_LEGS) {
+    s = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
     if (s < 0)
         throw runtime_error(strerror(errno));
 
-    hostent *answer;
-    answer = gethostbyname(server_host.c_str());
-    if (answer == nullptr)
-        throw runtime_error(strerror(h_errno));
+    // connect without blocking, so that it can be given up after the timeout
+    int error = 0;
+    if (connect(s, (const sockaddr *) &server_address,
+                sizeof(server_address)) < 0) {
+        error = errno;
+        if (error == EINPROGRESS) {
+            pollfd writable = {s, POLLOUT, 0};
+            int ready;
+            do {
+                ready = poll(&writable, 1, timeout_ms);
+            } while (ready < 0 && errno == EINTR);
+            socklen_t length = sizeof(error);
+            if (ready == 0)
+                error = ETIMEDOUT;
+            else if (ready < 0)
+                error = errno;
+            else if (getsockopt(s, SOL_SOCKET, SO_ERROR, &error, &length) < 0)
+                error = errno;
+        }
+    }
+    if (error != 0) {
+        close(s);
+        throw runtime_error(strerror(error));
+    }
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL) & ~O_NONBLOCK);
 
-    sockaddr_in to = {};
-    to.sin_family = AF_INET;
-    to.sin_addr.s_addr = *(in_addr_t *)answer->h_addr;
-    to.sin_port = htons(server_port);
-    if (connect(s, (struct sockaddr *) &to, sizeof(to)) < 0)
-        throw runtime_error(strerror(errno));
+    if (timeout_ms >= 0) {
+        timeval timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+        setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+
+    // pipelined requests are flushed explicitly, don't let Nagle delay them
+    int on = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    if (mode == BINARY_MODE) {
+        char negotiate = NEGOTIATE_BINARY;
+        send_all(&negotiate, 1);
+    }
+}
+
+sockaddr_in TCPClient::resolve(const string &host, const u_short port) {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *answer = nullptr;
+    int error = getaddrinfo(host.c_str(), nullptr, &hints, &answer);
+    if (error != 0)
+        throw runtime_error(host + ": " + gai_strerror(error));
+
+    sockaddr_in address = *(const sockaddr_in *) answer->ai_addr;
+    freeaddrinfo(answer);
+    address.sin_port = htons(port);
+    return address;
 }
 
 TCPClient::~TCPClient() {
@@ -40,24 +99,76 @@ TCPClient::~TCPClient() {
     }
 }
 
-TCPClient::TCPClient(TCPClient &&other) noexcept {
-    this->s = other.s;
+TCPClient::TCPClient(TCPClient &&other) noexcept
+        : s(other.s), mode(other.mode), in(std::move(other.in)),
+          pending(other.pending), out(std::move(other.out)),
+          legs(std::move(other.legs)) {
     other.s = -1;
 }
 
-void TCPClient::send_request(const string &request) const {
-    const char *message = request.c_str();
-    ssize_t length = strlen(message);
-    ssize_t sent = send(s, message, length, 0);
-    if (sent < 0)
-        throw runtime_error(strerror(errno));
+void TCPClient::send_all(const char *data, size_t length) const {
+    while (length > 0) {
+        ssize_t sent = send(s, data, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                throw runtime_error("Send timed out");
+            throw runtime_error(strerror(errno));
+        }
+        data += sent;
+        length -= sent;
+        bytesSent.add(sent);
+    }
 }
 
-string TCPClient::get_response() const {
-    char buffer[4096]; // Declare a buffer to hold incoming data (4096 bytes)
-    ssize_t received = recv(s, buffer, sizeof(buffer), 0); // Receive data from the socket
-    if (received < 0)
-        throw runtime_error(strerror(errno));
-    buffer[received] = '\0'; // Null-terminate the received data to make it a valid C-string
-    return string(buffer); // Convert the C-string to a C++ string and return it
+void TCPClient::send_request(const Message &request) const {
+    string frame(maxEncodedSize(request), '\0');
+    send_all(frame.data(), encodeMessage(mode, request, frame.data()));
+}
+
+void TCPClient::queue_request(const Message &request) {
+    size_t start = out.size();
+    out.resize(start + maxEncodedSize(request));
+    out.resize(start + encodeMessage(mode, request, out.data() + start));
+}
+
+void TCPClient::flush() {
+    if (out.empty())
+        return;
+    send_all(out.data(), out.size());
+    out.clear();
+}
+
+Message TCPClient::get_response() {
+    Message response;
+    while (!next_response(response))
+        receive(true);
+    return response;
+}
+
+bool TCPClient::next_response(Message &response) {
+    in.consume(pending); // release the previously returned message
+    pending = decodeMessage(mode, in.read_ptr(), in.readable(), false,
+                            response, legs.data());
+    return pending > 0;
+}
+
+bool TCPClient::receive(bool wait) {
+    while (true) {
+        ssize_t received = recv(s, in.write_ptr(), in.writable(),
+                                wait ? 0 : MSG_DONTWAIT);
+        if (received < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return false;
+            throw runtime_error(strerror(errno));
+        }
+        if (received == 0)
+            throw runtime_error("Connection closed by the server");
+        in.commit(received);
+        bytesReceived.add(received);
+        return true;
+    }
 }
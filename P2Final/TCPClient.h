@@ -5,8 +5,13 @@
  */
 
 #pragma once
+#include <netinet/in.h>
 #include <string>
+#include <vector>
 #include <iostream>
+#include "Protocol.h"
+#include "RingBuffer.h"
+#include "WireFormat.h"
 
 #ifndef P2_TCPCLIENT_H
 #define P2_TCPCLIENT_H
@@ -14,14 +19,37 @@
 /**
  * @class TCPClient  attempts to connect to the server specified by the
  *                   constructor arguments. The send_request() method will
- *                   send the given string to the server and get_response()
- *                   will block waiting for a response.
+ *                   send the given message to the server and get_response()
+ *                   will block waiting for a whole response message.
+ *                   Messages are framed in the wire mode chosen at
+ *                   construction (binary by default, see WireFormat.h); the
+ *                   mode is negotiated with the server right after connect.
+ *
+ *                   The message returned by get_response() points into the
+ *                   client's receive buffer and stays valid until the next
+ *                   call to get_response().
+ *
+ *                   Requests can be pipelined: queue_request() only buffers
+ *                   a message and flush() sends all queued messages with one
+ *                   send(), after which the replies are read one by one.
+ *                   A server address resolved once with resolve() can be
+ *                   reused for any number of connections.
+ *
+ *                   To wait on many servers at once, poll() the socket()
+ *                   of each client, call receive(false) when it is readable
+ *                   and take the replies with next_response().
+ *
+ *                   With a timeout, connect() and each send() fail once it
+ *                   has passed instead of waiting for the server forever.
  *
  *                   Failures will be thrown as std::runtime_error.
  */
 class TCPClient {
 public:
-    TCPClient(const std::string &server_host, u_short server_port);
+    TCPClient(const std::string &server_host, u_short server_port,
+              WireMode mode = BINARY_MODE);
+    explicit TCPClient(const sockaddr_in &server_address,
+                       WireMode mode = BINARY_MODE, int timeout_ms = -1);
     TCPClient(TCPClient &&other) noexcept;
     virtual ~TCPClient();
 
@@ -30,11 +58,27 @@ public:
     TCPClient& operator=(const TCPClient &) = delete;
     TCPClient& operator=(TCPClient &&) = delete;
 
-    void send_request(const std::string &request) const;
-    std::string get_response() const;
+    void send_request(const Message &request) const;
+    void queue_request(const Message &request);
+    void flush();
+    Message get_response();
+    bool next_response(Message &response);
+    bool receive(bool wait);
+    int socket() const { return s; }
+
+    static sockaddr_in resolve(const std::string &host, u_short port);
 
 private:
+    static const size_t BUFFER_SIZE = 2 * MAX_FRAME_SIZE; // receive ring size
+
     int s;  // socket
+    WireMode mode;     // framing negotiated with the server
+    RingBuffer in;     // bytes received, not yet returned as messages
+    size_t pending;    // bytes of the last returned message, still in `in`
+    std::string out;   // queued requests, not yet sent
+    std::vector<Leg> legs; // legs of the last returned message
+
+    void send_all(const char *data, size_t length) const;
 };
 
 
@@ -5,22 +5,52 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
 #include <cstring>
 #include <stdexcept>
+#include "Metrics.h"
 #include "TCPServer.h"
 
 
 using namespace std;
 
-TCPServer::TCPServer(u_short port) {
+static Counter &bytesReceived = metrics().counter(
+        "net_received_bytes_total", "Bytes received on TCP connections");
+static Counter &bytesSent = metrics().counter(
+        "net_sent_bytes_total", "Bytes sent on TCP connections");
+
+/**
+ * Switches a socket to non-blocking mode
+ * @param fd socket
+ * @throws runtime_error if the socket flags cannot be changed
+ */
+static void setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        throw runtime_error(
+                string("Failed to set non-blocking mode: ") + strerror(errno));
+}
+
+TCPServer::TCPServer(u_short port, bool share_port) : legs(MAX_LEGS) {
     server = socket(AF_INET, SOCK_STREAM, 0);
     if (server < 0)
         throw runtime_error(
                 string("Failed to create socket: ") + strerror(errno));
 
+    // allow an immediate restart while old connections are in TIME_WAIT
+    int reuse = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (share_port &&
+        setsockopt(server, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0)
+        throw runtime_error(
+                string("Failed to share port: ") + strerror(errno));
+
     if (port != 0) {
         sockaddr_in me = {};
         me.sin_family = AF_INET;
@@ -31,16 +61,34 @@ TCPServer::TCPServer(u_short port) {
                     string("Failed to bind socket: ") + strerror(errno));
     }
 
-    if (listen(server, 1) < 0)
+    if (listen(server, SOMAXCONN) < 0)
         throw runtime_error(
                 string("Failed to listen on socket: ") + strerror(errno));
+    setNonBlocking(server);
+
+    epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll < 0)
+        throw runtime_error(
+                string("Failed to create epoll: ") + strerror(errno));
+
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.fd = server;
+    if (epoll_ctl(epoll, EPOLL_CTL_ADD, server, &event) < 0)
+        throw runtime_error(
+                string("Failed to watch socket: ") + strerror(errno));
 
     client = -1;
+    accepted = 0;
 }
 
 TCPServer::~TCPServer() {
     stopServer();
-    closeClientSocket();
+    while (!clients.empty())
+        close_client(clients.begin()->first);
+    if (epoll >= 0)
+        close(epoll);
+    epoll = -1;
 }
 
 void TCPServer::stopServer() {
@@ -50,53 +98,276 @@ void TCPServer::stopServer() {
 }
 
 void TCPServer::closeClientSocket() {
-    if (client != -1) {
-        close(client);
-        client = -1;
-    }
+    if (client != -1)
+        close_client(client);
 }
 
 void TCPServer::serve() {
-    sockaddr_in them = {};
-    socklen_t them_len = sizeof(them);
-    client = accept(server, (sockaddr *) &them, &them_len);
-    if (client < 0)
+    epoll_event events[MAX_EVENTS];
+    while (server >= 0) {
+        int ready = epoll_wait(epoll, events, MAX_EVENTS, next_timeout());
+        if (ready < 0) {
+            if (errno != EINTR)
+                throw runtime_error(string("Failed to wait for events: ") +
+                                    strerror(errno));
+            ready = 0;
+        }
+
+        for (int i = 0; i < ready && server >= 0; i++) {
+            int fd = events[i].data.fd;
+            if (fd == server) {
+                accept_clients();
+                continue;
+            }
+
+            auto it = clients.find(fd);
+            if (it == clients.end())
+                continue; // closed earlier in this batch
+            client = fd;
+            try {
+                if (events[i].events & EPOLLOUT)
+                    flush_client(fd, it->second);
+                it = clients.find(fd); // flushing may have closed it
+                if (it != clients.end() &&
+                    events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP |
+                                        EPOLLERR))
+                    read_client(fd, it->second);
+            } catch (const std::exception &e) {
+                cerr << e.what() << endl;
+                close_client(fd); // ensures client socket is closed
+            }
+            client = -1;
+        }
+
+        if (server >= 0)
+            after_events();
+
+        // send the replies queued by respond_to()
+        for (int fd: dirty) {
+            auto it = clients.find(fd);
+            if (it == clients.end())
+                continue;
+            try {
+                flush_client(fd, it->second);
+            } catch (const std::exception &e) {
+                cerr << e.what() << endl;
+                close_client(fd);
+            }
+        }
+        dirty.clear();
+    }
+}
+
+const string &TCPServer::client_host() const {
+    static const string none;
+    auto it = clients.find(client);
+    return it == clients.end() ? none : it->second.host;
+}
+
+void TCPServer::watch(int fd) {
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) < 0)
         throw runtime_error(
-                string("Failed to accept connection: ") + strerror(errno));
+                string("Failed to watch descriptor: ") + strerror(errno));
+}
 
-    string their_host = inet_ntoa(them.sin_addr);
-    u_short their_port = ntohs(them.sin_port);
-    start_client(their_host, their_port);
-    try {
-        while (true) {
-            char buffer[1024];
-            ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+uint64_t TCPServer::client_id() const {
+    auto it = clients.find(client);
+    if (it == clients.end())
+        return 0;
+    // the socket in the low half finds the client, the serial proves it is
+    // still the same connection
+    return (it->second.serial << 32) | static_cast<uint32_t>(client);
+}
 
-            if (received == -1)
-                throw runtime_error(
-                        string("Failed to receive data: ") + strerror(errno));
+void TCPServer::accept_clients() {
+    while (true) {
+        sockaddr_in them = {};
+        socklen_t them_len = sizeof(them);
+        int fd = accept4(server, (sockaddr *) &them, &them_len,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return; // backlog drained
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            throw runtime_error(
+                    string("Failed to accept connection: ") + strerror(errno));
+        }
+        // replies are written whole, often one at a time: don't hold them
+        // back waiting for the ACK of the previous one
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
 
-            // Connection closed by the client
-            if (received == 0) {
-                cerr << "Connection closed by the client." << endl;
-                closeClientSocket();   // close client socket
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+            cerr << "Failed to watch client: " << strerror(errno) << endl;
+            close(fd);
+            continue;
+        }
+
+        Connection &connection = clients[fd];
+        connection.host = inet_ntoa(them.sin_addr);
+        connection.port = ntohs(them.sin_port);
+        connection.serial = ++accepted & 0x7FFFFFFF; // keep ids clear of IMPLICIT_TXN
+        client = fd;
+        try {
+            start_client(connection.host, connection.port);
+        } catch (const std::exception &e) {
+            cerr << e.what() << endl;
+            close_client(fd);
+        }
+        client = -1;
+    }
+}
+
+void TCPServer::read_client(int fd, Connection &connection) {
+    while (true) {
+        RingBuffer &in = connection.in;
+        ssize_t received = recv(fd, in.write_ptr(), in.writable(), 0);
+        if (received > 0) {
+            in.commit(received);
+            bytesReceived.add(received);
+            if (!process_client(fd, connection, false))
                 break;
-            }
-            buffer[received] = '\0'; // null-terminate C-style string
-            string request(buffer);
-            if (!process(request)) {
+            continue;
+        }
+        if (received == 0) {
+            // connection closed by the client: serve what it sent, then close
+            if (process_client(fd, connection, true)) {
+                cerr << "Connection closed by the client." << endl;
+                close_client(fd);
                 return;
             }
+            break;
         }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            process_client(fd, connection, true); // socket drained
+            break;
+        }
+        if (errno == EINTR)
+            continue;
+        throw runtime_error(
+                string("Failed to receive data: ") + strerror(errno));
+    }
+
+    // process() may have closed the client; otherwise send all replies at once
+    auto it = clients.find(fd);
+    if (it != clients.end())
+        flush_client(fd, it->second);
+}
+
+bool TCPServer::process_client(int fd, Connection &connection,
+                               bool drained) {
+    RingBuffer &in = connection.in;
+    if (!connection.negotiated && !in.empty()) {
+        connection.negotiated = true;
+        if (*in.read_ptr() == NEGOTIATE_BINARY) {
+            connection.mode = BINARY_MODE;
+            in.consume(1);
+        }
+    }
+
+    while (!connection.closing && !in.empty()) {
+        Message request;
+        size_t length = decodeMessage(connection.mode, in.read_ptr(),
+                                      in.readable(), drained, request,
+                                      legs.data());
+        if (length == 0)
+            break; // wait for the rest of the message
+        if (request.txn == 0)
+            request.txn = implicit_txn((connection.serial << 32) |
+                                       static_cast<uint32_t>(fd));
+        bool keep = process(request);
+        if (clients.find(fd) == clients.end())
+            return false; // closed by process()
+        in.consume(length);
+        if (!keep)
+            connection.closing = true;
+    }
+    return !connection.closing;
+}
+
+void TCPServer::flush_client(int fd, Connection &connection) {
+    RingBuffer &out = connection.out;
+    while (!out.empty()) {
+        ssize_t sent = send(fd, out.read_ptr(), out.readable(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return; // wait for the next EPOLLOUT edge
+            if (errno == EINTR)
+                continue;
+            throw runtime_error(
+                    string("Failed to send data: ") + strerror(errno));
+        }
+        out.consume(sent);
+        bytesSent.add(sent);
+    }
+    if (connection.closing)
+        close_client(fd);
+}
+
+void TCPServer::close_client(int fd) {
+    auto it = clients.find(fd);
+    if (it == clients.end())
+        return;
+    int previous = client;
+    client = fd;
+    try {
+        end_client();
     } catch (const std::exception &e) {
         cerr << e.what() << endl;
-        closeClientSocket(); // ensures client socket is closed on exception
     }
+    client = previous == fd ? -1 : previous;
+    epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    clients.erase(it);
 }
 
-void TCPServer::respond(const string &response) const {
-    ssize_t sent = send(client, response.c_str(), response.length(), 0);
-    if (sent < 0)
-        throw runtime_error(
-                string("Failed to send data: ") + strerror(errno));
-}
\ No newline at end of file
+void TCPServer::respond(const Message &response) {
+    auto it = clients.find(client);
+    if (it == clients.end())
+        throw runtime_error("Failed to send data: no client connection");
+    // Replies are queued and sent once the current batch is processed
+    enqueue(client, it->second, response);
+}
+
+bool TCPServer::respond_to(uint64_t client_id, const Message &response,
+                           bool last) {
+    auto fd = static_cast<int>(client_id & 0xFFFFFFFF);
+    auto it = clients.find(fd);
+    if (it == clients.end() || it->second.serial != client_id >> 32)
+        return false; // client is gone
+    try {
+        enqueue(fd, it->second, response);
+    } catch (const std::exception &e) {
+        cerr << e.what() << endl;
+        close_client(fd);
+        return false;
+    }
+    if (last)
+        it->second.closing = true;
+    dirty.push_back(fd);
+    return true;
+}
+
+void TCPServer::enqueue(int fd, Connection &connection,
+                        const Message &response) {
+    size_t size = maxEncodedSize(response);
+    if (connection.out.writable() < size) {
+        // make room, but keep the client open until its replies are queued
+        bool closing = connection.closing;
+        connection.closing = false;
+        flush_client(fd, connection);
+        connection.closing = closing;
+        if (connection.out.writable() < size)
+            throw runtime_error("Failed to send data: client " +
+                                connection.host + " is not reading replies");
+    }
+    connection.out.commit(encodeMessage(connection.mode, response,
+                                        connection.out.write_ptr()));
+}
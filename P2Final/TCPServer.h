@@ -3,36 +3,72 @@
  * @author Kevin Lundeen, Nadezhda Chernova
  */
 #pragma once
+#include <cstdint>
 #include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Protocol.h"
+#include "RingBuffer.h"
+#include "WireFormat.h"
 /**
  * @class TCPServer class is intended to only be used as a base class for
- *        an application-defined server. It is a simple server that only
- *        accepts a _single_ client and then after conversing with that client,
- *        exits.
+ *        an application-defined server. It is an edge-triggered epoll
+ *        reactor: a single thread accepts any number of clients and
+ *        multiplexes them over non-blocking sockets. Each connection keeps
+ *        its own read and write buffers, so a slow client never blocks the
+ *        others.
  *        The application's subclass is intended to implement overrides of
- *        two protected methods: start_client() and process():
- *        o  The start_client() method is called after the clients connection
+ *        the protected methods start_client(), process() and end_client():
+ *        o  The start_client() method is called after a client's connection
  *        has been established.
- *        o  The process() method is called after every recv() from the client.
+ *        o  The process() method is called once for every whole message
+ *        received from a client. Messages are framed by the wire format the
+ *        client negotiated with its first byte (see WireFormat.h) and
+ *        decoded in place from the connection's ring buffer, so TCP
+ *        coalescing or splitting of messages does not matter.
+ *        o  The end_client() method is called right before a client's
+ *        connection is closed (by either side).
  *        o  The respond() method is available for replies to be sent to the
- *        client as desired by the subclass.
- *        o  The closeClientSocket() method is called in the serve() when
- *        connection was closed by the client or when exception occurs,
- *        to proper clen-up of client socket.
+ *        client currently being processed, encoded in that client's wire
+ *        format. Replies that do not fit into the socket buffer are queued
+ *        and flushed once the socket is writable.
+ *        o  The client_id() method identifies the client currently being
+ *        processed, so the subclass can keep per-connection state. Ids are
+ *        never reused, so they can be kept after the client is gone.
+ *        o  The client_host() method gives the address of that client.
+ *        o  The respond_to() method queues a reply for any client by id,
+ *        e.g. a reply that had to wait for a log sync. It is sent after
+ *        after_events() returns.
+ *        o  The implicit_txn() method gives the transaction id assigned to
+ *        text-mode messages of a client that carry no transaction id.
+ *        o  The next_timeout() and after_events() methods let the subclass
+ *        run timed work (such as a group commit) on the event loop:
+ *        after_events() is called after every batch of readiness events and
+ *        at the latest next_timeout() milliseconds after the previous one.
+ *        o  The watch() method adds another descriptor (e.g. an eventfd
+ *        that other threads signal) to the loop, so that its readiness ends
+ *        epoll_wait() and after_events() runs.
+ *        o  The closeClientSocket() method closes the client currently being
+ *        processed.
  *        o  The stopServer() method is called during destruction and in
- *        subclass as a part of recovery mechanism from crashes.
+ *        subclass as a part of recovery mechanism from crashes. It makes
+ *        serve() return.
  *
- *        Construction creates the server and initializes the socket.
- *        The serve() method actually starts listening (and will block
- *        internally waiting for the client). It also blocks in serve() waiting
- *        for more recv() calls to finish. The server will exit the inter
- *        serve() loop if the process() method returns false.
+ *        Construction creates the server and initializes the socket. With
+ *        share_port several servers (one per thread) listen on the same port
+ *        and the kernel spreads new connections across them.
+ *        The serve() method runs the event loop until stopServer() is called.
+ *        If process() returns false, the connection to that client is closed
+ *        once its pending replies are flushed; the server keeps serving
+ *        everybody else.
  *
- *        Failures will be thrown as std::runtime_error.
+ *        Failures will be thrown as std::runtime_error. Failures of a single
+ *        connection are reported on cerr and only close that connection.
  */
 class TCPServer {
 public:
-    explicit TCPServer(u_short listening_port);
+    explicit TCPServer(u_short listening_port, bool share_port = false);
 
     virtual ~TCPServer();
 
@@ -51,13 +87,59 @@ protected:
     start_client(const std::string &their_host, u_short their_port) {}
 
     virtual bool
-    process(const std::string &incoming_stream_piece) { return false; }
+    process(const Message &request) { return false; }
 
-    void respond(const std::string &response) const;
+    virtual void end_client() {}
+
+    virtual int next_timeout() { return -1; }
+
+    virtual void after_events() {}
+
+    void respond(const Message &response);
+
+    bool respond_to(uint64_t client_id, const Message &response,
+                    bool last = false);
+
+    uint64_t client_id() const;
+
+    const std::string &client_host() const;
+
+    void watch(int fd);
+
+    static uint64_t implicit_txn(uint64_t client_id) {
+        return IMPLICIT_TXN | client_id;
+    }
 
 private:
-    int server; // socket for listening
-    int client; // sockets for a single client
-};
+    static const int MAX_EVENTS = 256; // readiness events per epoll_wait
+    static const size_t BUFFER_SIZE = 64 * 1024; // per-connection ring size
 
+    /**
+     * Per-connection state kept by the reactor.
+     */
+    struct Connection {
+        std::string host;   // peer address
+        u_short port = 0;   // peer port
+        uint64_t serial = 0; // connection number, never reused
+        RingBuffer in{BUFFER_SIZE};  // bytes received, not yet processed
+        RingBuffer out{BUFFER_SIZE}; // replies not yet accepted by the socket
+        WireMode mode = TEXT_MODE;   // framing negotiated by the first byte
+        bool negotiated = false;     // first byte seen
+        bool closing = false; // close once out is flushed
+    };
 
+    int server; // socket for listening
+    int epoll;  // epoll instance multiplexing server and clients
+    int client; // client currently being processed (-1 if none)
+    uint64_t accepted; // connections accepted so far
+    std::unordered_map<int, Connection> clients; // open clients by socket
+    std::vector<int> dirty; // clients with replies queued by respond_to()
+    std::vector<Leg> legs;  // legs of the request being processed
+
+    void accept_clients();
+    void read_client(int fd, Connection &connection);
+    bool process_client(int fd, Connection &connection, bool drained);
+    void flush_client(int fd, Connection &connection);
+    void close_client(int fd);
+    void enqueue(int fd, Connection &connection, const Message &response);
+};
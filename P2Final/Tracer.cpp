@@ -0,0 +1,145 @@
+/**
+ * @file Tracer.cpp definition for the span recorder
+ * @author Nadezhda Chernova
+ */
+
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include "Tracer.h"
+
+using namespace std;
+
+const char *toString(SpanKind kind) {
+    switch (kind) {
+        case SPAN_CONNECT:
+            return "connect";
+        case SPAN_VOTE_SEND:
+            return "vote send";
+        case SPAN_VOTE_WAIT:
+            return "vote wait";
+        case SPAN_LOG_SYNC:
+            return "log sync";
+        case SPAN_DECISION_SEND:
+            return "decision send";
+        case SPAN_ACK_WAIT:
+            return "ack wait";
+        case SPAN_VALIDATE:
+            return "validate";
+        case SPAN_DECISION:
+            return "decision";
+        default:
+            return "unknown";
+    }
+}
+
+void Tracer::enable(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+    spans = make_unique<Span[]>(size);
+    mask = size - 1;
+}
+
+void Tracer::record(SpanKind kind, uint64_t txn,
+                    chrono::steady_clock::time_point start,
+                    chrono::steady_clock::time_point end,
+                    Protocol message, u_short port) {
+    if (!spans)
+        return;
+    static thread_local auto thread =
+            static_cast<uint32_t>(syscall(SYS_gettid));
+    uint64_t claim = next.fetch_add(1, memory_order_relaxed);
+    Span &span = spans[claim & mask];
+    // seqlock: 0 while the fields change, see dump()
+    span.sequence.store(0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    span.txn = txn;
+    span.start = chrono::duration_cast<chrono::nanoseconds>(
+            start.time_since_epoch()).count();
+    span.duration = chrono::duration_cast<chrono::nanoseconds>(
+            end - start).count();
+    span.thread = thread;
+    span.kind = kind;
+    span.message = message;
+    span.port = port;
+    span.sequence.store(claim + 1, memory_order_release);
+}
+
+/**
+ * @return nanoseconds as the microseconds of a trace event, e.g. 12.345
+ */
+static string microseconds(int64_t ns) {
+    char text[32];
+    snprintf(text, sizeof(text), "%lld.%03lld",
+             static_cast<long long>(ns / 1000),
+             static_cast<long long>(ns % 1000));
+    return text;
+}
+
+size_t Tracer::dump(const string &filename, const string &process) const {
+    ofstream out(filename, ios::trunc);
+    if (!out)
+        throw runtime_error("Unable to write trace " + filename + ": " +
+                            strerror(errno));
+    string pid = to_string(getpid());
+    out << "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+        << ",\"args\":{\"name\":\"" << process << "\"}}";
+
+    // one row (tid) per transaction, so its phases nest and line up with
+    // the same transaction's rows in the other processes
+    unordered_map<uint64_t, size_t> rows;
+    size_t written = 0;
+    uint64_t end = spans ? next.load(memory_order_acquire) : 0;
+    uint64_t first = end > mask + 1 ? end - (mask + 1) : 0;
+    for (uint64_t claim = first; claim < end; claim++) {
+        const Span &slot = spans[claim & mask];
+        if (slot.sequence.load(memory_order_acquire) != claim + 1)
+            continue; // being written, or already overwritten
+        uint64_t txn = slot.txn;
+        int64_t start = slot.start;
+        int64_t duration = slot.duration;
+        uint32_t thread = slot.thread;
+        SpanKind kind = slot.kind;
+        Protocol message = slot.message;
+        u_short port = slot.port;
+        atomic_thread_fence(memory_order_acquire);
+        if (slot.sequence.load(memory_order_relaxed) != claim + 1)
+            continue; // overwritten while copied
+
+        auto [row, fresh] = rows.emplace(txn, rows.size() + 1);
+        string tid = to_string(row->second);
+        if (fresh)
+            out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+                << ",\"tid\":" << tid << ",\"args\":{\"name\":\"#" << txn
+                << "\"}}";
+        out << ",\n{\"name\":\"" << toString(kind)
+            << "\",\"cat\":\"2pc\",\"ph\":\"X\",\"ts\":"
+            << microseconds(start) << ",\"dur\":" << microseconds(duration)
+            << ",\"pid\":" << pid << ",\"tid\":" << tid
+            << ",\"args\":{\"txn\":\"" << txn << "\",\"thread\":" << thread;
+        if (message != UNKNOWN_PROTOCOL)
+            out << ",\"message\":\"" << toString(message) << "\"";
+        if (port != 0)
+            out << ",\"port\":" << port;
+        out << "}}";
+        written++;
+    }
+    out << "\n]\n";
+    out.flush();
+    if (!out)
+        throw runtime_error("Unable to write trace " + filename + ": " +
+                            strerror(errno));
+    return written;
+}
+
+Tracer &tracer() {
+    // never destroyed: threads may still record while the process exits
+    static Tracer *instance = new Tracer();
+    return *instance;
+}
@@ -0,0 +1,125 @@
+/**
+ * @file Tracer.h declaration for the span recorder of per-transaction
+ * tracing
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "Protocol.h"
+
+using namespace std;
+
+/**
+ * @enum SpanKind phase of a transaction a span covers; the coordinator
+ * records CONNECT to ACK_WAIT, a participant VALIDATE to DECISION
+ */
+enum SpanKind : uint8_t {
+    SPAN_CONNECT,       // opening a connection to a participant
+    SPAN_VOTE_SEND,     // queueing and writing the vote requests
+    SPAN_VOTE_WAIT,     // from the written request to a participant's vote
+    SPAN_LOG_SYNC,      // decision log sync, or a reply waiting for the WAL
+    SPAN_DECISION_SEND, // queueing and writing the decisions
+    SPAN_ACK_WAIT,      // from the written decision to a participant's ACK
+    SPAN_VALIDATE,      // a participant checking and holding the legs
+    SPAN_DECISION       // a participant applying or releasing its hold
+};
+
+/**
+ * @return name of a span kind, as shown in the trace viewer
+ */
+const char *toString(SpanKind kind);
+
+/**
+ * Capacity of the span ring unless Tracer::enable() is given another; at
+ * 40 bytes a span, 2.5 MB
+ */
+const size_t TRACE_CAPACITY = 1 << 16;
+
+/**
+ * @class Tracer
+ * Per-transaction tracing. A coordinator traces a sample of its
+ * transactions and marks their messages (MESSAGE_TRACED, see Protocol.h);
+ * the transaction id is the trace id. Each process records the spans of
+ * the phases it sees of a traced transaction into a ring of fixed capacity
+ * that keeps the latest spans, and dumps them at exit in the Chrome
+ * trace-event format. Timestamps are CLOCK_MONOTONIC, which all processes
+ * of a host share, so the dumps of a coordinator and its participants on
+ * one host can be merged ("jq -s add") and viewed on one timeline in
+ * chrome://tracing or Perfetto.
+ *
+ * Recording claims a slot with one relaxed fetch_add and takes no lock, so
+ * any thread (e.g. every shard's reactor) may record. A disabled tracer
+ * records nothing.
+ *
+ * Failures will be thrown as std::runtime_error.
+ */
+class Tracer {
+public:
+    /**
+     * Allocates the ring and starts recording; call before any thread
+     * records
+     * @param capacity spans kept, rounded up to a power of two
+     */
+    void enable(size_t capacity = TRACE_CAPACITY);
+
+    /** @return true once enable() was called */
+    bool enabled() const { return spans != nullptr; }
+
+    /**
+     * Records a span; any thread, lock-free, nothing if disabled
+     * @param kind phase
+     * @param txn transaction (trace) id
+     * @param start when the phase started
+     * @param end when it ended
+     * @param message message the phase sent or answered, if any
+     * @param port participant's port (coordinator spans), 0 if none
+     */
+    void record(SpanKind kind, uint64_t txn,
+                chrono::steady_clock::time_point start,
+                chrono::steady_clock::time_point end,
+                Protocol message = UNKNOWN_PROTOCOL, u_short port = 0);
+
+    /**
+     * Writes the spans recorded so far, oldest first, as a JSON array of
+     * Chrome trace events, after a metadata event naming the process. A
+     * span being recorded meanwhile may be left out.
+     * @param filename file to write
+     * @param process name of the process in the viewer, e.g. "coordinator"
+     * @return number of spans written
+     * @throws runtime_error if the file cannot be written
+     */
+    size_t dump(const string &filename, const string &process) const;
+
+private:
+    /**
+     * @struct Span one recorded phase. A slot is being written while its
+     * sequence is 0; a complete one holds its claim number + 1, so a dump
+     * racing a writer can tell a torn or overwritten slot.
+     */
+    struct Span {
+        atomic<uint64_t> sequence{0};
+        uint64_t txn;
+        int64_t start;    // nanoseconds of CLOCK_MONOTONIC
+        int64_t duration; // nanoseconds
+        uint32_t thread;  // recording thread's id
+        SpanKind kind;
+        Protocol message;
+        u_short port;
+    };
+
+    unique_ptr<Span[]> spans; // the ring, nullptr while disabled
+    size_t mask = 0;          // capacity - 1
+    atomic<uint64_t> next{0}; // spans claimed so far
+};
+
+/**
+ * @return the tracer of this process, disabled until enabled
+ */
+Tracer &tracer();
@@ -0,0 +1,234 @@
+/**
+ * @file TransferFile.cpp definition for TransferReader and TransferWriter
+ * @author Nadezhda Chernova
+ */
+
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include "TransferFile.h"
+#include "WireFormat.h"
+
+using namespace std;
+
+static const char MAGIC[8] = {'2', 'P', 'C', 'X', 'F', 'E', 'R', '1'};
+static const size_t HOST_FIELD = 62;
+
+/**
+ * @return little-endian integer of the given width at p
+ */
+template<typename T>
+static T load(const char *p) {
+    T value;
+    memcpy(&value, p, sizeof(value));
+    if constexpr (sizeof(T) == 2)
+        return static_cast<T>(le16toh(value));
+    else if constexpr (sizeof(T) == 4)
+        return static_cast<T>(le32toh(value));
+    else
+        return static_cast<T>(le64toh(value));
+}
+
+/**
+ * Stores a little-endian integer at p
+ */
+template<typename T>
+static void store(char *p, T value) {
+    if constexpr (sizeof(T) == 2)
+        value = static_cast<T>(htole16(value));
+    else if constexpr (sizeof(T) == 4)
+        value = static_cast<T>(htole32(value));
+    else
+        value = static_cast<T>(htole64(value));
+    memcpy(p, &value, sizeof(value));
+}
+
+TransferReader::TransferReader(const string &filename) : filename(filename) {
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw runtime_error("Unable to open transfer file " + filename +
+                            ": " + strerror(errno));
+    char magic[sizeof(MAGIC)] = {};
+    bool binary = pread(fd, magic, sizeof(magic), 0) ==
+                  static_cast<ssize_t>(sizeof(magic)) &&
+                  memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+    if (!binary) {
+        close(fd);
+        csv.open(filename);
+        if (!csv)
+            throw runtime_error("Unable to open transfer file " + filename);
+        return;
+    }
+
+    struct stat info = {};
+    if (fstat(fd, &info) < 0) {
+        close(fd);
+        throw runtime_error("Unable to stat transfer file " + filename);
+    }
+    length = static_cast<size_t>(info.st_size);
+    void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (mapped == MAP_FAILED)
+        throw runtime_error("Unable to map transfer file " + filename + ": " +
+                            strerror(errno));
+    data = static_cast<const char *>(mapped);
+    madvise(mapped, length, MADV_SEQUENTIAL);
+
+    size_t count = length < HEADER_SIZE ? 0 : load<uint32_t>(data + 8);
+    next = HEADER_SIZE + count * ENDPOINT_SIZE;
+    if (length < next || (length - next) % RECORD_SIZE != 0) {
+        munmap(mapped, length);
+        data = nullptr;
+        throw runtime_error("Transfer file " + filename + " is malformed");
+    }
+    for (size_t i = 0; i < count; i++) {
+        const char *endpoint = data + HEADER_SIZE + i * ENDPOINT_SIZE;
+        endpoints.emplace_back(string(endpoint, strnlen(endpoint, HOST_FIELD)),
+                               load<uint16_t>(endpoint + HOST_FIELD));
+    }
+}
+
+TransferReader::~TransferReader() {
+    if (data != nullptr)
+        munmap(const_cast<char *>(data), length);
+}
+
+size_t TransferReader::read(vector<Transfer> &transfers, size_t max) {
+    transfers.clear();
+    Transfer transfer;
+    while (transfers.size() < max) {
+        if (data != nullptr) {
+            if (next >= length)
+                break;
+            readRecord(transfer);
+        } else if (!readCsv(transfer)) {
+            break;
+        }
+        transfers.push_back(std::move(transfer));
+    }
+    return transfers.size();
+}
+
+bool TransferReader::readCsv(Transfer &transfer) {
+    string text;
+    while (getline(csv, text)) {
+        line++;
+        if (text.empty() || text[0] == '#' || text.rfind("amount", 0) == 0)
+            continue;
+
+        vector<string> fields;
+        istringstream stream(text);
+        string field;
+        while (getline(stream, field, ','))
+            fields.push_back(field);
+        string where = filename + ":" + to_string(line);
+        if (fields.size() != 7)
+            throw runtime_error(where + ": expected 7 fields");
+
+        if (!Money::parse(fields[0], transfer.amount) ||
+            !transfer.amount.isPositive())
+            throw runtime_error(where + ": invalid amount " + fields[0]);
+        for (int i: {2, 5}) {
+            int port = 0;
+            try {
+                port = stoi(fields[i]);
+            }
+            catch (const exception &) {
+            }
+            if (port < 1 || port >= (1 << 16))
+                throw runtime_error(where + ": invalid port " + fields[i]);
+            (i == 2 ? transfer.portFrom : transfer.portTo) =
+                    static_cast<u_short>(port);
+        }
+        transfer.hostFrom = fields[1];
+        transfer.accountFrom = fields[3];
+        transfer.hostTo = fields[4];
+        transfer.accountTo = fields[6];
+        return true;
+    }
+    return false;
+}
+
+void TransferReader::readRecord(Transfer &transfer) {
+    const char *record = data + next;
+    size_t index = (next - HEADER_SIZE - endpoints.size() * ENDPOINT_SIZE) /
+                   RECORD_SIZE;
+    next += RECORD_SIZE;
+
+    auto from = load<uint16_t>(record);
+    auto to = load<uint16_t>(record + 2);
+    auto amount = Money::fromCents(load<int64_t>(record + 8));
+    if (from >= endpoints.size() || to >= endpoints.size() ||
+        !amount.isPositive())
+        throw runtime_error(filename + ": transfer record " +
+                            to_string(index) + " is malformed");
+    transfer.amount = amount;
+    transfer.hostFrom = endpoints[from].first;
+    transfer.portFrom = endpoints[from].second;
+    transfer.hostTo = endpoints[to].first;
+    transfer.portTo = endpoints[to].second;
+    const char *account = record + 16;
+    transfer.accountFrom.assign(account, strnlen(account, ACCOUNT_SIZE));
+    account += ACCOUNT_SIZE;
+    transfer.accountTo.assign(account, strnlen(account, ACCOUNT_SIZE));
+}
+
+TransferWriter::TransferWriter(const string &filename) : filename(filename) {
+    ofstream probe(filename, ios::trunc);
+    if (!probe)
+        throw runtime_error("Unable to create transfer file " + filename);
+}
+
+uint16_t TransferWriter::endpoint(const string &host, u_short port) {
+    auto [it, fresh] = endpointIds.emplace(host + ":" + to_string(port),
+                                           endpoints.size());
+    if (fresh) {
+        if (host.size() > HOST_FIELD || endpoints.size() > UINT16_MAX)
+            throw runtime_error("Endpoint does not fit a transfer file: " +
+                                it->first);
+        endpoints.emplace_back(host, port);
+    }
+    return it->second;
+}
+
+void TransferWriter::add(const Transfer &transfer) {
+    if (transfer.accountFrom.size() > ACCOUNT_SIZE ||
+        transfer.accountTo.size() > ACCOUNT_SIZE)
+        throw runtime_error("Account id too long in transfer " +
+                            transfer.accountFrom + " -> " +
+                            transfer.accountTo);
+    char record[TransferReader::RECORD_SIZE] = {};
+    store<uint16_t>(record, endpoint(transfer.hostFrom, transfer.portFrom));
+    store<uint16_t>(record + 2, endpoint(transfer.hostTo, transfer.portTo));
+    store<int64_t>(record + 8, transfer.amount.cents());
+    memcpy(record + 16, transfer.accountFrom.data(),
+           transfer.accountFrom.size());
+    memcpy(record + 16 + ACCOUNT_SIZE, transfer.accountTo.data(),
+           transfer.accountTo.size());
+    records.append(record, sizeof(record));
+}
+
+void TransferWriter::commit() {
+    char header[TransferReader::HEADER_SIZE] = {};
+    memcpy(header, MAGIC, sizeof(MAGIC));
+    store<uint32_t>(header + 8, static_cast<uint32_t>(endpoints.size()));
+
+    ofstream file(filename, ios::binary | ios::trunc);
+    file.write(header, sizeof(header));
+    for (const auto &[host, port]: endpoints) {
+        char endpoint[TransferReader::ENDPOINT_SIZE] = {};
+        memcpy(endpoint, host.data(), host.size());
+        store<uint16_t>(endpoint + HOST_FIELD, port);
+        file.write(endpoint, sizeof(endpoint));
+    }
+    file.write(records.data(), static_cast<streamsize>(records.size()));
+    file.close();
+    if (!file)
+        throw runtime_error("Unable to write transfer file " + filename);
+}
@@ -0,0 +1,121 @@
+/**
+ * @file TransferFile.h declaration for TransferReader and TransferWriter
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "2PC_Coordinator.h"
+
+using namespace std;
+
+/**
+ * @class TransferReader
+ * Reads a settlement file of transfers, in either of two formats (told
+ * apart by the first bytes):
+ *
+ * CSV, one transfer per line, blank lines, lines starting with '#' and a
+ * header line starting with "amount" are skipped:
+ *
+ *     amount,hostFrom,portFrom,accountFrom,hostTo,portTo,accountTo
+ *
+ * Binary, all integers little-endian, memory mapped:
+ *
+ *     offset  size  field
+ *          0     8  magic "2PCXFER1"
+ *          8     4  number of endpoints
+ *         12     4  zero
+ *         16     -  endpoints of ENDPOINT_SIZE bytes:
+ *                   62-byte NUL-padded host, port
+ *          -     -  transfers of RECORD_SIZE bytes to the end of the file:
+ *                   from endpoint (2), to endpoint (2), zero (4),
+ *                   amount in cents (8), NUL-padded accountFrom (24),
+ *                   NUL-padded accountTo (24)
+ *
+ * Failures will be thrown as std::runtime_error, naming the line (CSV) or
+ * record (binary) that is malformed.
+ */
+class TransferReader {
+public:
+    static const size_t HEADER_SIZE = 16;
+    static const size_t ENDPOINT_SIZE = 64;
+    static const size_t RECORD_SIZE = 64;
+
+    /**
+     * Opens a transfer file
+     * @param filename CSV or binary transfer file
+     * @throws runtime_error if the file cannot be opened or mapped
+     */
+    explicit TransferReader(const string &filename);
+
+    ~TransferReader();
+
+    // don't allow any of these:
+    TransferReader(const TransferReader &) = delete;
+    TransferReader &operator=(const TransferReader &) = delete;
+
+    /**
+     * Reads the next transfers
+     * @param transfers cleared, then filled with up to max transfers
+     * @param max most transfers to read
+     * @return number of transfers read, 0 at the end of the file
+     * @throws runtime_error if a transfer is malformed
+     */
+    size_t read(vector<Transfer> &transfers, size_t max);
+
+private:
+    string filename;
+    ifstream csv;            // CSV file, if not binary
+    size_t line = 0;         // CSV lines read
+    const char *data = nullptr; // mapped binary file
+    size_t length = 0;       // bytes mapped
+    vector<pair<string, u_short>> endpoints; // binary endpoint table
+    size_t next = 0;         // offset of the next binary record
+
+    bool readCsv(Transfer &transfer);
+    void readRecord(Transfer &transfer);
+};
+
+/**
+ * @class TransferWriter
+ * Writes a binary transfer file (see TransferReader), e.g. to convert a
+ * CSV file once so that later runs map it instead of parsing it.
+ */
+class TransferWriter {
+public:
+    /**
+     * Creates a binary transfer file
+     * @throws runtime_error if it cannot be created
+     */
+    explicit TransferWriter(const string &filename);
+
+    // don't allow any of these:
+    TransferWriter(const TransferWriter &) = delete;
+    TransferWriter &operator=(const TransferWriter &) = delete;
+
+    /**
+     * Adds a transfer
+     * @throws runtime_error if a field does not fit the format
+     */
+    void add(const Transfer &transfer);
+
+    /**
+     * Writes the file
+     * @throws runtime_error if writing fails
+     */
+    void commit();
+
+private:
+    string filename;
+    vector<pair<string, u_short>> endpoints;
+    unordered_map<string, uint16_t> endpointIds; // "host:port" -> index
+    string records;
+
+    uint16_t endpoint(const string &host, u_short port);
+};
@@ -0,0 +1,218 @@
+/**
+ * @file WireFormat.cpp definition for the binary and text wire formats
+ * @author Nadezhda Chernova
+ */
+
+#include <endian.h>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include "WireFormat.h"
+
+using namespace std;
+
+/**
+ * @return true if the opcode carries legs
+ */
+static bool hasBody(Protocol type) {
+    return carriesLegs(type);
+}
+
+/**
+ * @return true if a binary frame of the message has the decision port field
+ */
+static bool hasDecider(const Message &message) {
+    return (message.type == VOTE_REQUEST ||
+            message.type == ONE_PHASE_COMMIT) &&
+           ((message.flags & MESSAGE_DECIDER) != 0 ||
+            message.decisionPort != 0);
+}
+
+static size_t decodeBinary(const char *data, size_t size, Message &message,
+                           Leg *legs) {
+    if (size < FRAME_HEADER_SIZE)
+        return 0;
+
+    uint32_t length;
+    memcpy(&length, data, sizeof(length));
+    length = le32toh(length);
+    if (length < FRAME_HEADER_SIZE || length > MAX_FRAME_SIZE)
+        throw runtime_error("Invalid frame length: " + to_string(length));
+    if (size < length)
+        return 0;
+
+    if (static_cast<uint8_t>(data[4]) != WIRE_VERSION)
+        throw runtime_error("Unsupported frame version: " +
+                            to_string(static_cast<uint8_t>(data[4])));
+    auto opcode = static_cast<uint8_t>(data[5]);
+    message.type = opcode < PROTOCOL_OPCODES ? static_cast<Protocol>(opcode)
+                                             : UNKNOWN_PROTOCOL;
+    message.flags = static_cast<uint8_t>(data[6]);
+    memcpy(&message.txn, data + 8, sizeof(message.txn));
+    message.txn = le64toh(message.txn);
+    if ((message.txn & IMPLICIT_TXN) != 0)
+        throw runtime_error("Invalid transaction id: " +
+                            to_string(message.txn));
+
+    message.legs = legs;
+    message.legCount = 0;
+    message.decisionPort = 0;
+    if (hasBody(message.type)) {
+        const char *leg = data + FRAME_HEADER_SIZE;
+        size_t body = length - FRAME_HEADER_SIZE;
+        if (hasDecider(message)) {
+            if (body < DECIDER_SIZE)
+                throw runtime_error("Truncated " +
+                                    string(toString(message.type)) + " frame");
+            uint16_t port;
+            memcpy(&port, leg, sizeof(port));
+            message.decisionPort = le16toh(port);
+            leg += DECIDER_SIZE;
+            body -= DECIDER_SIZE;
+        }
+        if (body == 0 || body % LEG_SIZE != 0)
+            throw runtime_error("Truncated " +
+                                string(toString(message.type)) + " frame");
+        message.legCount = body / LEG_SIZE;
+        for (size_t i = 0; i < message.legCount; i++, leg += LEG_SIZE) {
+            legs[i].account = string_view(leg, strnlen(leg, ACCOUNT_SIZE));
+            uint64_t amount;
+            memcpy(&amount, leg + ACCOUNT_SIZE, sizeof(amount));
+            legs[i].amount = Money::fromCents(
+                    static_cast<int64_t>(le64toh(amount)));
+        }
+    }
+    return length;
+}
+
+/**
+ * Splits the next space-delimited token off the front of a line
+ */
+static string_view nextToken(string_view &line) {
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start == string_view::npos) {
+        line = {};
+        return {};
+    }
+    size_t end = line.find_first_of(" \t\r", start);
+    if (end == string_view::npos)
+        end = line.size();
+    string_view token = line.substr(start, end - start);
+    line.remove_prefix(end);
+    return token;
+}
+
+static size_t decodeText(const char *data, size_t size, bool drained,
+                         Message &message, Leg *legs) {
+    const char *newline = static_cast<const char *>(memchr(data, '\n', size));
+    size_t length;
+    if (newline != nullptr)
+        length = newline - data + 1;
+    else if (size > MAX_FRAME_SIZE)
+        throw runtime_error("Text message too long");
+    else if (drained && size > 0)
+        length = size; // legacy client: one unterminated message per send
+    else
+        return 0;
+
+    string_view line(data, newline != nullptr ? length - 1 : length);
+    message = Message();
+    message.legs = legs;
+    message.type = toProtocol(nextToken(line));
+    string_view token = nextToken(line);
+    if (!token.empty() && token[0] == '#') {
+        const char *end = token.data() + token.size();
+        if (from_chars(token.data() + 1, end, message.txn).ptr != end ||
+            (message.txn & IMPLICIT_TXN) != 0)
+            message.type = UNKNOWN_PROTOCOL;
+        token = nextToken(line);
+    }
+    if (hasBody(message.type)) {
+        for (; !token.empty(); token = nextToken(line)) {
+            if (message.legCount == MAX_LEGS ||
+                !Money::parse(nextToken(line), legs[message.legCount].amount)) {
+                message.type = UNKNOWN_PROTOCOL;
+                break;
+            }
+            legs[message.legCount++].account = token;
+        }
+        if (message.legCount == 0)
+            message.type = UNKNOWN_PROTOCOL;
+    }
+    return length;
+}
+
+size_t decodeMessage(WireMode mode, const char *data, size_t size,
+                     bool drained, Message &message, Leg *legs) {
+    if (mode == BINARY_MODE)
+        return decodeBinary(data, size, message, legs);
+    return decodeText(data, size, drained, message, legs);
+}
+
+size_t maxEncodedSize(const Message &message) {
+    // text: command, " #" and txn, " account amount" per leg, newline
+    size_t legs = hasBody(message.type) ? message.legCount : 0;
+    return 40 + DECIDER_SIZE + legs * (ACCOUNT_SIZE + 23);
+}
+
+size_t encodeMessage(WireMode mode, const Message &message, char *out) {
+    bool body = hasBody(message.type);
+    size_t legCount = body ? message.legCount : 0;
+    if (legCount > MAX_LEGS)
+        throw runtime_error("Too many legs: " + to_string(legCount));
+    for (size_t i = 0; i < legCount; i++)
+        if (message.legs[i].account.size() > ACCOUNT_SIZE)
+            throw runtime_error("Account id too long: " +
+                                string(message.legs[i].account));
+
+    if (mode == TEXT_MODE) {
+        const char *command = toString(message.type);
+        size_t length = strlen(command);
+        memcpy(out, command, length);
+        if (message.txn != 0 && (message.txn & IMPLICIT_TXN) == 0) {
+            out[length++] = ' ';
+            out[length++] = '#';
+            length = to_chars(out + length, out + length + 20,
+                              message.txn).ptr - out;
+        }
+        for (size_t i = 0; i < legCount; i++) {
+            const Leg &leg = message.legs[i];
+            out[length++] = ' ';
+            memcpy(out + length, leg.account.data(), leg.account.size());
+            length += leg.account.size();
+            out[length++] = ' ';
+            length += leg.amount.format(out + length);
+        }
+        out[length++] = '\n';
+        return length;
+    }
+
+    bool decider = message.decisionPort != 0 && hasDecider(message);
+    uint32_t length = FRAME_HEADER_SIZE + (decider ? DECIDER_SIZE : 0) +
+                      legCount * LEG_SIZE;
+    uint32_t wireLength = htole32(length);
+    uint64_t txn = htole64(message.txn);
+    memcpy(out, &wireLength, sizeof(wireLength));
+    out[4] = static_cast<char>(WIRE_VERSION);
+    out[5] = static_cast<char>(message.type);
+    out[6] = static_cast<char>(decider ? message.flags | MESSAGE_DECIDER
+                                       : message.flags & ~MESSAGE_DECIDER);
+    out[7] = 0;
+    memcpy(out + 8, &txn, sizeof(txn));
+    char *leg = out + FRAME_HEADER_SIZE;
+    if (decider) {
+        uint16_t port = htole16(message.decisionPort);
+        memset(leg, 0, DECIDER_SIZE);
+        memcpy(leg, &port, sizeof(port));
+        leg += DECIDER_SIZE;
+    }
+    for (size_t i = 0; i < legCount; i++, leg += LEG_SIZE) {
+        memset(leg, 0, ACCOUNT_SIZE);
+        memcpy(leg, message.legs[i].account.data(),
+               message.legs[i].account.size());
+        uint64_t amount = htole64(static_cast<uint64_t>(
+                message.legs[i].amount.cents()));
+        memcpy(leg + ACCOUNT_SIZE, &amount, sizeof(amount));
+    }
+    return length;
+}
@@ -0,0 +1,92 @@
+/**
+ * @file WireFormat.h declaration for the binary and text wire formats
+ * @author Nadezhda Chernova
+ *
+ * A client selects the format with the first byte it sends on a connection:
+ * NEGOTIATE_BINARY selects length-prefixed binary frames, anything else
+ * selects the legacy text mode (and is the first byte of the first message).
+ *
+ * Binary frame, all integers little-endian:
+ *
+ *     offset  size  field
+ *          0     4  length    whole frame in bytes, header included
+ *          4     1  version   WIRE_VERSION
+ *          5     1  opcode    Protocol enum value
+ *          6     1  flags     MESSAGE_TRACED, MESSAGE_DECIDER, else zero
+ *          7     1  reserved  zero
+ *          8     8  txn       transaction id
+ *
+ * followed, for a VOTE-REQUEST or ONE-PHASE-COMMIT with MESSAGE_DECIDER, by
+ *
+ *          0     2  port      coordinator's decision port
+ *          2     6  reserved  zero
+ *
+ * followed, for the messages with legs only (VOTE-REQUEST,
+ * ONE-PHASE-COMMIT, BALANCE-INQUIRY and BALANCE), by one or more legs of
+ * LEG_SIZE bytes (as many as the length says):
+ *
+ *          0    24  account   NUL-padded account id
+ *         24     8  amount    signed amount in cents
+ *
+ * Text mode: one message per line,
+ * "COMMAND [#txn] [account amount [account amount ...]]\n", amounts with
+ * two decimals. A message without "#txn" decodes with txn 0. Text mode
+ * carries no flags.
+ * A final unterminated line is accepted once the socket has been drained,
+ * so legacy clients that send a bare command still work.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include "Protocol.h"
+
+/**
+ * @enum WireMode selects how messages are framed on a connection
+ */
+enum WireMode {
+    TEXT_MODE,
+    BINARY_MODE
+};
+
+const char NEGOTIATE_BINARY = '\xB2'; // first byte of a binary connection
+const uint8_t WIRE_VERSION = 1;       // version byte of every binary frame
+const size_t FRAME_HEADER_SIZE = 16;  // length, version, opcode, flags, txn
+const size_t ACCOUNT_SIZE = 24;       // fixed width of an account id
+const size_t DECIDER_SIZE = 8;        // decision port field, see above
+const size_t LEG_SIZE = ACCOUNT_SIZE + sizeof(int64_t); // account, amount
+const size_t MAX_FRAME_SIZE = 32 * 1024; // largest frame accepted in any mode
+const size_t MAX_LEGS = (MAX_FRAME_SIZE - FRAME_HEADER_SIZE) / LEG_SIZE;
+
+/**
+ * Decodes the message at the front of a byte span. The accounts of the
+ * message's legs point into the span, nothing is copied.
+ * @param mode wire mode of the connection
+ * @param data start of the received bytes
+ * @param size number of received bytes
+ * @param drained true if no more bytes are pending on the socket (lets the
+ * text mode accept an unterminated legacy message)
+ * @param message decoded message
+ * @param legs room for MAX_LEGS legs, the message's legs are stored there
+ * @return bytes the message occupies, 0 if the span holds no whole message
+ * @throws runtime_error if the frame is malformed
+ */
+size_t decodeMessage(WireMode mode, const char *data, size_t size,
+                     bool drained, Message &message, Leg *legs);
+
+/**
+ * @return upper bound of the bytes encodeMessage() writes for a message
+ */
+size_t maxEncodedSize(const Message &message);
+
+/**
+ * Encodes a message.
+ * @param mode wire mode of the connection
+ * @param message message to encode
+ * @param out destination, at least maxEncodedSize(message) bytes
+ * @return bytes written
+ * @throws runtime_error if an account id does not fit its field or there
+ * are more than MAX_LEGS legs
+ */
+size_t encodeMessage(WireMode mode, const Message &message, char *out);
@@ -0,0 +1,250 @@
+/**
+ * @file WriteAheadLog.cpp definition for WriteAheadLog class
+ * @author Nadezhda Chernova
+ */
+
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include "Metrics.h"
+#include "WriteAheadLog.h"
+
+using namespace std;
+
+static const size_t ACCOUNT_FIELD = 24; // bytes of the account id field
+
+static Histogram &fsyncTime = metrics().histogram(
+        "wal_fsync_seconds", "Time spent in fdatasync of the write-ahead log");
+
+/**
+ * @return the lookup table of CRC-32, built at compile time so that the
+ * shards replaying their logs at once share it without a race
+ */
+static constexpr array<uint32_t, 256> crc32Table() {
+    array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        table[i] = c;
+    }
+    return table;
+}
+
+uint32_t crc32(const char *data, size_t size) {
+    static constexpr array<uint32_t, 256> table = crc32Table();
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFF;
+}
+
+void syncDirectory(const string &filename) {
+    size_t slash = filename.find_last_of('/');
+    string directory = slash == string::npos ? "." : filename.substr(0, slash);
+    int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+WriteAheadLog::WriteAheadLog(const string &filename,
+                             chrono::microseconds syncWindow,
+                             size_t syncBatch)
+        : filename(filename), window(syncWindow), batch(syncBatch),
+          nextLsn(1), durable(0), syncs(0) {
+    fd = open(filename.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw runtime_error("Unable to open write-ahead log " + filename +
+                            ": " + strerror(errno));
+    buffer.reserve(batch * RECORD_SIZE * 2);
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    try {
+        sync();
+    } catch (const exception &) {
+        // nothing sensible left to do while shutting down
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+size_t WriteAheadLog::replay(const function<void(const WalRecord &)> &apply) {
+    size_t count = 0;
+    off_t offset = 0;
+    char page[RECORD_SIZE * 1024];
+    size_t filled = 0;
+
+    while (true) {
+        ssize_t got = pread(fd, page + filled, sizeof(page) - filled,
+                            offset + static_cast<off_t>(filled));
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            throw runtime_error("Unable to read write-ahead log " + filename +
+                                ": " + strerror(errno));
+        }
+        filled += got;
+
+        size_t used = 0;
+        bool corrupt = false;
+        for (; used + RECORD_SIZE <= filled; used += RECORD_SIZE) {
+            const char *record = page + used;
+            uint32_t crc;
+            memcpy(&crc, record, sizeof(crc));
+            if (le32toh(crc) != crc32(record + 4, RECORD_SIZE - 4)) {
+                corrupt = true;
+                break;
+            }
+            WalRecord decoded{};
+            uint64_t field;
+            decoded.type = static_cast<WalType>(record[4]);
+            memcpy(&field, record + 8, sizeof(field));
+            decoded.lsn = le64toh(field);
+            memcpy(&field, record + 16, sizeof(field));
+            decoded.txn = le64toh(field);
+            memcpy(&field, record + 24, sizeof(field));
+            decoded.amount = Money::fromCents(
+                    static_cast<int64_t>(le64toh(field)));
+            decoded.account = string_view(record + 32,
+                                          strnlen(record + 32, ACCOUNT_FIELD));
+            apply(decoded);
+            nextLsn = decoded.lsn + 1;
+            count++;
+        }
+        offset += static_cast<off_t>(used);
+        filled -= used;
+        memmove(page, page + used, filled);
+
+        if (corrupt || got == 0) {
+            // cut off a torn or corrupt tail so new records follow intact ones
+            if (ftruncate(fd, offset) < 0)
+                throw runtime_error("Unable to truncate write-ahead log " +
+                                    filename + ": " + strerror(errno));
+            break;
+        }
+    }
+    durable = nextLsn - 1;
+    return count;
+}
+
+void WriteAheadLog::startAfter(uint64_t lsn) {
+    if (nextLsn <= lsn) {
+        nextLsn = lsn + 1;
+        durable = lsn;
+    }
+}
+
+uint64_t WriteAheadLog::append(WalType type, uint64_t txn,
+                               string_view account, Money amount) {
+    if (account.size() > ACCOUNT_FIELD)
+        throw runtime_error("Account id too long: " + string(account));
+    if (buffer.empty())
+        firstBuffered = chrono::steady_clock::now();
+
+    uint64_t lsn = nextLsn++;
+    size_t start = buffer.size();
+    buffer.resize(start + RECORD_SIZE);
+    char *record = buffer.data() + start;
+    memset(record, 0, RECORD_SIZE);
+    record[4] = static_cast<char>(type);
+    uint64_t field = htole64(lsn);
+    memcpy(record + 8, &field, sizeof(field));
+    field = htole64(txn);
+    memcpy(record + 16, &field, sizeof(field));
+    field = htole64(static_cast<uint64_t>(amount.cents()));
+    memcpy(record + 24, &field, sizeof(field));
+    memcpy(record + 32, account.data(), account.size());
+    uint32_t crc = htole32(crc32(record + 4, RECORD_SIZE - 4));
+    memcpy(record, &crc, sizeof(crc));
+    return lsn;
+}
+
+void WriteAheadLog::writeBuffer() {
+    const char *data = buffer.data();
+    size_t left = buffer.size();
+    while (left > 0) {
+        ssize_t written = write(fd, data, left);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            throw runtime_error("Unable to write write-ahead log " +
+                                filename + ": " + strerror(errno));
+        }
+        data += written;
+        left -= written;
+    }
+    buffer.clear();
+}
+
+uint64_t WriteAheadLog::sync() {
+    if (buffer.empty())
+        return durable;
+    writeBuffer();
+    auto start = chrono::steady_clock::now();
+    if (fdatasync(fd) < 0)
+        throw runtime_error("Unable to sync write-ahead log " + filename +
+                            ": " + strerror(errno));
+    fsyncTime.record(chrono::steady_clock::now() - start);
+    syncs++;
+    durable = nextLsn - 1;
+    return durable;
+}
+
+void WriteAheadLog::rewrite(const function<void()> &relog) {
+    sync();
+
+    string temporary = filename + ".tmp";
+    int fresh = open(temporary.c_str(),
+                     O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fresh < 0)
+        throw runtime_error("Unable to create write-ahead log " + temporary +
+                            ": " + strerror(errno));
+    int old = fd;
+    fd = fresh;
+    try {
+        relog();
+        writeBuffer();
+        if (fdatasync(fd) < 0)
+            throw runtime_error("Unable to sync write-ahead log " +
+                                temporary + ": " + strerror(errno));
+        if (rename(temporary.c_str(), filename.c_str()) < 0)
+            throw runtime_error("Unable to replace write-ahead log " +
+                                filename + ": " + strerror(errno));
+    } catch (...) {
+        // keep appending to the old log, which is still complete
+        buffer.clear();
+        close(fresh);
+        fd = old;
+        unlink(temporary.c_str());
+        throw;
+    }
+    syncDirectory(filename);
+    close(old);
+    syncs++;
+    durable = nextLsn - 1;
+}
+
+bool WriteAheadLog::syncDue(chrono::steady_clock::time_point now) const {
+    if (buffer.empty())
+        return false;
+    return buffer.size() >= batch * RECORD_SIZE ||
+           now - firstBuffered >= window;
+}
+
+int WriteAheadLog::msUntilSync(chrono::steady_clock::time_point now) const {
+    if (buffer.empty())
+        return -1;
+    auto left = firstBuffered + window - now;
+    if (left <= chrono::steady_clock::duration::zero())
+        return 0;
+    // round up, the event loop only waits in whole milliseconds
+    return static_cast<int>(
+            chrono::ceil<chrono::milliseconds>(left).count());
+}
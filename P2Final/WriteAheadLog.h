@@ -0,0 +1,169 @@
+/**
+ * @file WriteAheadLog.h declaration for WriteAheadLog class
+ * @author Nadezhda Chernova
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Money.h"
+
+using namespace std;
+
+/**
+ * @enum WalType kind of a write-ahead log record
+ */
+enum WalType : uint8_t {
+    WAL_HOLD = 1,   // transaction voted commit and holds an amount
+    WAL_COMMIT = 2, // transaction committed, amount applied to the account
+    WAL_ABORT = 3,  // transaction aborted, hold released
+    WAL_DECIDER = 4 // coordinator deciding the holds after it: host as the
+                    // account, decision port as the amount
+};
+
+/**
+ * Computes the CRC-32 (IEEE) of a byte span
+ */
+uint32_t crc32(const char *data, size_t size);
+
+/**
+ * fsyncs the directory holding a file, so a rename is durable
+ */
+void syncDirectory(const string &filename);
+
+/**
+ * @struct WalRecord one decoded write-ahead log record. The account points
+ * into the log's read buffer and is only valid during replay.
+ */
+struct WalRecord {
+    WalType type;
+    uint64_t lsn;        // log sequence number, increases by one per record
+    uint64_t txn;        // transaction id
+    Money amount;        // amount held, applied or zero
+    string_view account; // account involved
+};
+
+/**
+ * @class WriteAheadLog
+ * Binary, append-only log of the participant's hold, commit and abort
+ * decisions. Records have a fixed size of RECORD_SIZE bytes:
+ *
+ *     offset  size  field
+ *          0     4  crc32 of bytes 4..55
+ *          4     1  type (WalType)
+ *          5     3  zero
+ *          8     8  lsn
+ *         16     8  txn
+ *         24     8  amount in cents
+ *         32    24  NUL-padded account id
+ *
+ * all integers little-endian. Appends only fill an in-memory buffer; sync()
+ * writes the whole buffer with one write() and makes it durable with one
+ * fdatasync(), so every transaction appended within the sync window shares
+ * the cost of the sync (group commit). The owner asks syncDue() when to
+ * sync and must not reveal the outcome of a record (reply to the
+ * coordinator) before durableLsn() has reached the record's lsn.
+ *
+ * Failures will be thrown as std::runtime_error.
+ */
+class WriteAheadLog {
+public:
+    static const size_t RECORD_SIZE = 56;
+
+    /**
+     * Opens (or creates) the log file for appending
+     * @param filename log file
+     * @param syncWindow longest time a record waits in the buffer for
+     * company before it is synced
+     * @param syncBatch number of buffered records that forces a sync
+     * regardless of the window
+     * @throws runtime_error if the file cannot be opened
+     */
+    WriteAheadLog(const string &filename, chrono::microseconds syncWindow,
+                  size_t syncBatch);
+
+    /**
+     * Syncs buffered records and closes the file
+     */
+    ~WriteAheadLog();
+
+    // don't allow any of these:
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+    /**
+     * Reads the log from the beginning and calls apply for every intact
+     * record. A torn or corrupt tail left by a crash is cut off, and the
+     * next lsn continues after the last intact record.
+     * @param apply callback for each record
+     * @return number of records replayed
+     */
+    size_t replay(const function<void(const WalRecord &)> &apply);
+
+    /**
+     * Makes the next appended record get an lsn greater than the given one
+     * (used to continue after the lsn of a checkpoint).
+     * @param lsn last lsn already used
+     */
+    void startAfter(uint64_t lsn);
+
+    /**
+     * Buffers a record
+     * @return lsn of the record
+     * @throws runtime_error if the account id does not fit its field
+     */
+    uint64_t append(WalType type, uint64_t txn, string_view account,
+                    Money amount);
+
+    /**
+     * Writes and fdatasyncs all buffered records
+     * @return lsn up to which the log is durable
+     * @throws runtime_error if the write or sync fails
+     */
+    uint64_t sync();
+
+    /**
+     * Atomically replaces the log by a new one that only contains the
+     * records appended by relog (used after a checkpoint made the old
+     * records redundant). The new file is complete and durable before it
+     * replaces the old one, so a crash leaves one or the other.
+     * @param relog appends the records that must survive
+     */
+    void rewrite(const function<void()> &relog);
+
+    /**
+     * @return true if buffered records are due to be synced
+     */
+    bool syncDue(chrono::steady_clock::time_point now) const;
+
+    /**
+     * @return milliseconds until buffered records are due, -1 if none are
+     * buffered
+     */
+    int msUntilSync(chrono::steady_clock::time_point now) const;
+
+    uint64_t durableLsn() const { return durable; }
+
+    uint64_t lastLsn() const { return nextLsn - 1; }
+
+    /** @return number of fdatasync() calls so far */
+    uint64_t syncCount() const { return syncs; }
+
+private:
+    string filename;               // log file
+    int fd;                        // log file, opened for appending
+    chrono::microseconds window;   // group commit latency window
+    size_t batch;                  // records that force a sync
+    vector<char> buffer;           // records not yet written
+    chrono::steady_clock::time_point firstBuffered; // oldest buffered record
+    uint64_t nextLsn;              // lsn of the next record
+    uint64_t durable;              // highest durable lsn
+    uint64_t syncs;                // number of fdatasync() calls
+
+    void writeBuffer();
+};
@@ -2,51 +2,202 @@
 // Created by Nadezhda Chernova on 5/22/24.
 //
 
+#include <poll.h>
+#include <unistd.h>
 #include <sstream>
 #include <iostream>
 #include <vector>
 #include <string>
 #include <stdexcept>
 #include "2PC_Coordinator.h"
+#include "TransferFile.h"
 
 using namespace std;
 
-void validateArguments(int argc, char *argv[], string &logFilename,
-                       double &amount, string &hostFrom, int &portFrom,
-                       string &accountFrom, string &hostTo, int &portTo,
-                       string &accountTo);
+/**
+ * Validates the log filename argument
+ * @throws runtime_error if it is not a .txt file
+ */
+void validateLogFilename(const string &logFilename);
+
+/**
+ * Validates and parses the seven fields of a transfer:
+ * amount hostFrom portFrom accountFrom hostTo portTo accountTo
+ * @param fields the fields
+ * @param transfer ref to the transfer to fill in
+ * @throws runtime_error if a field is invalid
+ */
+void validateTransfer(char *fields[], Transfer &transfer);
+
+/**
+ * Validates and parses the postings of a multi-leg transaction, four
+ * fields each: host port account amount (negative to withdraw)
+ * @param fields the fields, a multiple of four
+ * @param postings ref to the postings to fill in
+ * @throws runtime_error if a field is invalid
+ */
+void validatePostings(const vector<string> &fields, vector<Posting> &postings);
+
+/**
+ * Parses the optional arguments that follow the required ones:
+ *   --connections N         connections kept open to each participant
+ *   --pipeline N            transactions pipelined together
+ *   --connect-timeout-ms N  longest wait for a connect or send
+ *   --vote-timeout-ms N     longest wait for a vote (then presumed abort)
+ *   --ack-timeout-ms N      longest wait for an acknowledgement
+ *   --decision-port N       answer participants' DECISION-REQUESTs on port N
+ *   --admin-port N          serve the metrics on port N
+ *   --trace-file path       trace transactions, spans dumped to path on exit
+ *   --trace-every N         trace one transaction in N (default 1)
+ *   --batch N               transfers per transaction between two banks
+ *   --log-echo 0|1          echo the log on standard output
+ *   --log-level N           least severity logged: 0 debug .. 3 error
+ * @param argc number of command-line arguments
+ * @param argv array of command-line arguments
+ * @param first index of the first optional argument
+ * @param options ref to options to fill in
+ * @throws runtime_error if an option is unknown or its value is invalid
+ */
+void parseOptions(int argc, char *argv[], int first,
+                  CoordinatorOptions &options);
+
+/**
+ * Runs transfers read from standard input, one per line, until end of
+ * input. A line is either a transfer of seven fields (as on the command
+ * line) or a multi-leg transaction of four fields per posting:
+ *   host port account amount [host port account amount ...]
+ * Lines are collected while more input is immediately available, up
+ * to a full pipeline window, so a steady stream is pipelined and a single
+ * typed line runs at once. Invalid lines are reported and skipped.
+ * @param coordinator coordinator running the transfers
+ * @param options coordinator options
+ */
+void serveTransfers(Coordinator &coordinator,
+                    const CoordinatorOptions &options);
+
+/**
+ * Runs all transfers of a settlement file (see TransferReader), reading it
+ * in chunks so that files of millions of transfers need little memory.
+ * @param coordinator coordinator running the transfers
+ * @param filename CSV or binary transfer file
+ */
+void runTransferFile(Coordinator &coordinator, const string &filename);
+
+/**
+ * Converts a transfer file (CSV or binary) to the binary format
+ * @param from file to read
+ * @param to binary file to write
+ */
+void convertTransferFile(const string &from, const string &to);
 
 int main(int argc, char *argv[])
 {
   try
   {
-    string logFilename, hostFrom, accountFrom, hostTo, accountTo;
-    double amount;
-    int portFrom, portTo;
+    if (argc < 3)
+    {
+      throw runtime_error(
+          "Usage: coordinator log_filename amount hostFrom portFrom "
+          "accountFrom hostTo portTo accountTo [options]\n"
+          "       coordinator log_filename - [options]   "
+          "(transfers on standard input, one per line)\n"
+          "       coordinator log_filename --file transfers [options]\n"
+          "       coordinator log_filename --balance host port account "
+          "[account ...] [options]\n"
+          "       coordinator --convert transfers.csv transfers.bin\n"
+          "options: --connections N --pipeline N --connect-timeout-ms N "
+          "--vote-timeout-ms N --ack-timeout-ms N --decision-port N "
+          "--admin-port N --trace-file path --trace-every N "
+          "--batch N --log-echo 0|1 --log-level N");
+    }
+    if (string(argv[1]) == "--convert")
+    {
+      if (argc != 4)
+        throw runtime_error("Usage: coordinator --convert transfers.csv "
+                            "transfers.bin");
+      convertTransferFile(argv[2], argv[3]);
+      return EXIT_SUCCESS;
+    }
+    string logFilename = argv[1];
+    validateLogFilename(logFilename);
+    CoordinatorOptions options;
 
-    // Validate and parse command line arguments
-    validateArguments(argc, argv, logFilename, amount, hostFrom, portFrom,
-                      accountFrom, hostTo, portTo, accountTo);
+    // Long-lived service: transfers on standard input
+    if (string(argv[2]) == "-")
+    {
+      parseOptions(argc, argv, 3, options);
+      Coordinator coordinator(logFilename, options);
+      serveTransfers(coordinator, options);
+      return EXIT_SUCCESS;
+    }
 
-    // Create vector of participants
-    vector<pair<string, u_short>> participants = {
-        {hostFrom, static_cast<u_short>(portFrom)},
-        {hostTo, static_cast<u_short>(portTo)}};
+    // Batch mode: a settlement file
+    if (string(argv[2]) == "--file")
+    {
+      if (argc < 4)
+        throw runtime_error("Missing value for --file");
+      parseOptions(argc, argv, 4, options);
+      Coordinator coordinator(logFilename, options);
+      runTransferFile(coordinator, argv[3]);
+      return EXIT_SUCCESS;
+    }
+
+    // Balance inquiry: accounts of one participant
+    if (string(argv[2]) == "--balance")
+    {
+      if (argc < 6)
+        throw runtime_error("Usage: coordinator log_filename --balance host "
+                            "port account [account ...] [options]");
+      int port = 0;
+      try
+      {
+        port = stoi(argv[4]);
+      }
+      catch (const exception &)
+      {
+        throw runtime_error("Invalid port format: " + string(argv[4]));
+      }
+      if (port < 1 || port >= (1 << 16))
+        throw runtime_error("Invalid port: " + string(argv[4]));
+      int first = 5; // first option, after the accounts
+      while (first < argc && string(argv[first]).rfind("--", 0) != 0)
+        first++;
+      vector<string> accounts(argv + 5, argv + first);
+      parseOptions(argc, argv, first, options);
+      Coordinator coordinator(logFilename, options);
+      vector<Money> balances = coordinator.balances(
+          argv[3], static_cast<u_short>(port), accounts);
+      for (size_t i = 0; i < accounts.size(); i++)
+        cout << balances[i].toString() << " " << accounts[i] << endl;
+      return EXIT_SUCCESS;
+    }
+
+    if (argc < 9)
+    {
+      throw runtime_error(
+          "Usage: coordinator log_filename amount hostFrom portFrom "
+          "accountFrom hostTo portTo accountTo");
+    }
+    Transfer transfer;
+    validateTransfer(argv + 2, transfer);
+    parseOptions(argc, argv, 9, options);
 
     // Initialize coordinator
-    Coordinator coordinator(logFilename);
+    Coordinator coordinator(logFilename, options);
 
     // Log transaction details
-    ostringstream note;
-    note << "Transaction: $" << amount << "\n\tFrom: " << hostFrom << ":"
-         << portFrom << " account #" << accountFrom
-         << "\n\tTo:   " << hostTo << ":" << portTo << " account #"
-         << accountTo;
-    coordinator.log(note.str());
+    coordinator.log("Transaction: $" + transfer.amount.toString() +
+                    "\n\tFrom: " + transfer.hostFrom + ":" +
+                    to_string(transfer.portFrom) + " account #" +
+                    transfer.accountFrom + "\n\tTo:   " + transfer.hostTo +
+                    ":" + to_string(transfer.portTo) + " account #" +
+                    transfer.accountTo);
 
     // Call participants
-    coordinator.callParticipants(accountFrom, accountTo, amount,
-                                 participants);
+    coordinator.callParticipants(transfer.accountFrom, transfer.accountTo,
+                                 transfer.amount,
+                                 {{transfer.hostFrom, transfer.portFrom},
+                                  {transfer.hostTo, transfer.portTo}});
   }
   catch (const exception &e)
   {
@@ -61,71 +212,243 @@ int main(int argc, char *argv[])
   return EXIT_SUCCESS;
 }
 
-void validateArguments(int argc, char *argv[],
-                       string &logFilename, double &amount,
-                       string &hostFrom, int &portFrom,
-                       string &accountFrom, string &hostTo,
-                       int &portTo, string &accountTo)
+void serveTransfers(Coordinator &coordinator,
+                    const CoordinatorOptions &options)
 {
-  if (argc < 9)
+  // let cin buffer on its own, so in_avail() sees lines already read
+  ios::sync_with_stdio(false);
+
+  vector<Transfer> transfers;
+  vector<vector<Posting>> transactions;
+  size_t total = 0, committed = 0;
+  string line;
+  while (getline(cin, line))
   {
-    throw runtime_error(
-        "Usage: coordinator log_filename amount hostFrom portFrom "
-        "accountFrom hostTo portTo accountTo");
+    istringstream fields(line);
+    vector<string> words;
+    string word;
+    while (fields >> word)
+      words.push_back(word);
+    if (words.empty())
+      continue;
+
+    try
+    {
+      if (words.size() % 4 == 0)
+      {
+        vector<Posting> postings;
+        validatePostings(words, postings);
+        transactions.push_back(std::move(postings));
+      }
+      else if (words.size() == 7)
+      {
+        vector<char *> pointers;
+        for (auto &w : words)
+          pointers.push_back(w.data());
+        Transfer transfer;
+        validateTransfer(pointers.data(), transfer);
+        transfers.push_back(transfer);
+      }
+      else
+      {
+        throw runtime_error("expected amount hostFrom portFrom accountFrom "
+                            "hostTo portTo accountTo, or host port account "
+                            "amount per posting");
+      }
+    }
+    catch (const exception &e)
+    {
+      cerr << "Skipping transfer '" << line << "': " << e.what() << endl;
+    }
+
+    // Run what we have once the window is full or the input pauses
+    pollfd input = {STDIN_FILENO, POLLIN, 0};
+    bool more = cin.rdbuf()->in_avail() > 0 || poll(&input, 1, 0) > 0;
+    if (transfers.size() + transactions.size() >= options.pipelineDepth ||
+        !more)
+    {
+      total += transfers.size() + transactions.size();
+      committed += coordinator.runTransfers(transfers);
+      committed += coordinator.runTransactions(transactions);
+      transfers.clear();
+      transactions.clear();
+    }
   }
+  total += transfers.size() + transactions.size();
+  committed += coordinator.runTransfers(transfers);
+  committed += coordinator.runTransactions(transactions);
+  coordinator.log(to_string(committed) + " of " + to_string(total) +
+                  " transactions committed");
+}
 
-  logFilename = argv[1];
-  hostFrom = argv[3];
-  accountFrom = argv[5];
-  hostTo = argv[6];
-  accountTo = argv[8];
+void runTransferFile(Coordinator &coordinator, const string &filename)
+{
+  const size_t CHUNK = 64 * 1024; // transfers read at a time
 
+  TransferReader reader(filename);
+  vector<Transfer> transfers;
+  size_t total = 0, committed = 0;
+  auto started = chrono::steady_clock::now();
+  while (reader.read(transfers, CHUNK) > 0)
+  {
+    total += transfers.size();
+    committed += coordinator.runTransfers(transfers);
+  }
+  auto elapsed = chrono::duration_cast<chrono::milliseconds>(
+      chrono::steady_clock::now() - started);
+  coordinator.log(to_string(committed) + " of " + to_string(total) +
+                  " transfers from " + filename + " committed in " +
+                  to_string(elapsed.count()) + " ms");
+}
+
+void convertTransferFile(const string &from, const string &to)
+{
+  TransferReader reader(from);
+  TransferWriter writer(to);
+  vector<Transfer> transfers;
+  size_t total = 0;
+  while (reader.read(transfers, 64 * 1024) > 0)
+  {
+    for (const auto &transfer : transfers)
+      writer.add(transfer);
+    total += transfers.size();
+  }
+  writer.commit();
+  cout << "Converted " << total << " transfers to " << to << endl;
+}
+
+void validateLogFilename(const string &logFilename)
+{
   // Check if the log file has .txt extension
   if (logFilename.substr(logFilename.find_last_of('.') + 1) != "txt")
   {
     throw runtime_error(
         "Log file must have a .txt extension: " + logFilename);
   }
+}
+
+void validateTransfer(char *fields[], Transfer &transfer)
+{
+  transfer.hostFrom = fields[1];
+  transfer.accountFrom = fields[3];
+  transfer.hostTo = fields[4];
+  transfer.accountTo = fields[6];
 
   // Check for valid amount, ensure it's not zero or negative
-  try
+  if (!Money::parse(fields[0], transfer.amount))
   {
-    amount = stod(argv[2]);
-    if (amount <= 0)
-    {
-      throw runtime_error("Amount must be greater than zero:" +
-                          string(argv[2]));
-    }
+    throw runtime_error("Invalid amount format: " + string(fields[0]));
   }
-  catch (const invalid_argument &)
+  if (!transfer.amount.isPositive())
   {
-    throw runtime_error("Invalid amount format: " + string(argv[2]));
+    throw runtime_error("Amount must be greater than zero: " +
+                        string(fields[0]));
   }
 
   // Check for valid ports
-  try
+  for (int i : {2, 5})
   {
-    portFrom = stoi(argv[4]);
-    if (portFrom < 1 || portFrom >= (1 << 16))
+    int port;
+    try
     {
-      throw runtime_error("Invalid port: " + string(argv[4]));
+      port = stoi(fields[i]);
     }
+    catch (const exception &)
+    {
+      throw runtime_error("Invalid port format: " + string(fields[i]));
+    }
+    if (port < 1 || port >= (1 << 16))
+    {
+      throw runtime_error("Invalid port: " + string(fields[i]));
+    }
+    (i == 2 ? transfer.portFrom : transfer.portTo) =
+        static_cast<u_short>(port);
   }
-  catch (const invalid_argument &)
-  {
-    throw runtime_error("Invalid port format: " + string(argv[4]));
-  }
+}
 
-  try
+void validatePostings(const vector<string> &fields, vector<Posting> &postings)
+{
+  for (size_t i = 0; i + 3 < fields.size(); i += 4)
   {
-    portTo = stoi(argv[7]);
-    if (portTo < 1 || portTo >= (1 << 16))
+    Posting posting;
+    posting.host = fields[i];
+    posting.account = fields[i + 2];
+
+    int port = 0;
+    try
     {
-      throw runtime_error("Invalid port: " + string(argv[7]));
+      port = stoi(fields[i + 1]);
     }
+    catch (const exception &)
+    {
+      throw runtime_error("Invalid port format: " + fields[i + 1]);
+    }
+    if (port < 1 || port >= (1 << 16))
+      throw runtime_error("Invalid port: " + fields[i + 1]);
+    posting.port = static_cast<u_short>(port);
+
+    // a zero amount only checks that the account exists
+    if (!Money::parse(fields[i + 3], posting.amount))
+      throw runtime_error("Invalid amount format: " + fields[i + 3]);
+    postings.push_back(posting);
   }
-  catch (const invalid_argument &)
+}
+
+void parseOptions(int argc, char *argv[], int first,
+                  CoordinatorOptions &options)
+{
+  for (int i = first; i < argc; i += 2)
   {
-    throw runtime_error("Invalid port format: " + string(argv[7]));
+    string option = argv[i];
+    if (i + 1 >= argc)
+      throw runtime_error("Missing value for " + option);
+    if (option == "--trace-file")
+    {
+      options.traceFile = argv[i + 1];
+      continue;
+    }
+    long value;
+    try
+    {
+      value = stol(argv[i + 1]);
+    }
+    catch (const exception &)
+    {
+      throw runtime_error("Invalid value for " + option + ": " +
+                          string(argv[i + 1]));
+    }
+    bool zeroAllowed = option == "--log-echo" || option == "--log-level";
+    if (value < (zeroAllowed ? 0 : 1) ||
+        (option == "--log-echo" && value > 1) ||
+        (option == "--log-level" && value > LOG_ERROR) ||
+        ((option == "--decision-port" || option == "--admin-port") &&
+         value > 65535))
+      throw runtime_error("Invalid value for " + option + ": " +
+                          string(argv[i + 1]));
+
+    if (option == "--connections")
+      options.connections = value;
+    else if (option == "--pipeline")
+      options.pipelineDepth = value;
+    else if (option == "--connect-timeout-ms")
+      options.connectTimeout = chrono::milliseconds(value);
+    else if (option == "--vote-timeout-ms")
+      options.voteTimeout = chrono::milliseconds(value);
+    else if (option == "--ack-timeout-ms")
+      options.ackTimeout = chrono::milliseconds(value);
+    else if (option == "--decision-port")
+      options.decisionPort = static_cast<u_short>(value);
+    else if (option == "--admin-port")
+      options.adminPort = static_cast<u_short>(value);
+    else if (option == "--trace-every")
+      options.traceEvery = value;
+    else if (option == "--batch")
+      options.batchSize = value;
+    else if (option == "--log-echo")
+      options.log.echo = value != 0;
+    else if (option == "--log-level")
+      options.log.level = static_cast<LogLevel>(value);
+    else
+      throw runtime_error("Unknown option: " + option);
   }
-}
\ No newline at end of file
+}
@@ -0,0 +1,450 @@
+/**
+ * @file loadgen.cpp - end-to-end load generator and benchmark: starts
+ * participants on loopback, drives them from several coordinator threads
+ * and reports throughput and phase latencies as JSON
+ * @author Nadezhda Chernova
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "2PC_Coordinator.h"
+
+using namespace std;
+
+/**
+ * @struct LoadOptions shape of the generated load
+ */
+struct LoadOptions {
+    unsigned participants = 2;      // participant processes started
+    size_t accounts = 10000;        // accounts per participant
+    size_t transfers = 100000;      // transfers run in total
+    unsigned threads = 4;           // coordinator threads, one each
+    double zipf = 0.99;             // skew of the accounts, 0 for uniform
+    double abortRatio = 0.0;        // transfers to an unknown account
+    size_t batch = 1;               // CoordinatorOptions::batchSize
+    size_t pipeline = 64;           // CoordinatorOptions::pipelineDepth
+    size_t connections = 1;         // CoordinatorOptions::connections
+    unsigned shards = 1;            // --shards of each participant
+    u_short basePort = 24000;       // port of the first participant
+    uint64_t seed = 1;              // of the transfers generated
+    string participant = "./participant"; // participant binary
+    string directory = "/tmp";      // scratch directory is made in here
+    bool keep = false;              // keep the scratch directory
+    LogLevel logLevel = LOG_WARN;   // of coordinators and participants
+};
+
+/**
+ * @class Zipf draws ranks 0..n-1 with probability proportional to
+ * 1 / (rank + 1)^theta, so rank 0 is the hottest account
+ */
+class Zipf {
+public:
+    Zipf(size_t n, double theta) : cdf(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += 1.0 / pow(static_cast<double>(i + 1), theta);
+            cdf[i] = sum;
+        }
+        for (auto &p: cdf)
+            p /= sum;
+    }
+
+    size_t operator()(mt19937_64 &random) const {
+        double u = uniform_real_distribution<double>(0, 1)(random);
+        size_t rank = lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        return min(rank, cdf.size() - 1);
+    }
+
+private:
+    vector<double> cdf;
+};
+
+/**
+ * @struct Samples phase latencies of every transaction run by one thread
+ */
+struct Samples {
+    vector<int64_t> vote, logSync, decision, total; // nanoseconds
+    size_t transactions = 0;
+    size_t committed = 0;
+};
+
+/**
+ * Parses the options
+ * @throws runtime_error if an option is unknown or its value is invalid
+ */
+void parseOptions(int argc, char *argv[], LoadOptions &options);
+
+/**
+ * Writes the accounts file of each participant into the scratch directory
+ */
+void writeAccounts(const LoadOptions &options, const string &directory);
+
+/**
+ * Generates the transfers of each thread
+ * @return transfers per thread
+ */
+vector<vector<Transfer>> generate(const LoadOptions &options);
+
+/**
+ * Starts a participant process
+ * @return its pid
+ * @throws runtime_error if it does not accept connections within 5 s
+ */
+pid_t startParticipant(const LoadOptions &options, const string &directory,
+                       unsigned index);
+
+/**
+ * Stops participant processes with Ctrl-C and waits for them
+ */
+void stopParticipants(const vector<pid_t> &pids);
+
+/**
+ * Writes the results as JSON on standard output
+ */
+void report(const LoadOptions &options, const vector<Samples> &samples,
+            chrono::nanoseconds elapsed);
+
+int main(int argc, char *argv[]) {
+    LoadOptions options;
+    string directory;
+    vector<pid_t> pids;
+    try {
+        parseOptions(argc, argv, options);
+        string pattern = options.directory + "/loadgen.XXXXXX";
+        if (mkdtemp(pattern.data()) == nullptr)
+            throw runtime_error("Unable to create a directory in " +
+                                options.directory + ": " + strerror(errno));
+        directory = pattern;
+        writeAccounts(options, directory);
+        vector<vector<Transfer>> work = generate(options);
+
+        for (unsigned i = 0; i < options.participants; i++)
+            pids.push_back(startParticipant(options, directory, i));
+
+        vector<Samples> samples(options.threads);
+        vector<string> errors(options.threads);
+        vector<thread> threads;
+        auto start = chrono::steady_clock::now();
+        for (unsigned t = 0; t < options.threads; t++) {
+            threads.emplace_back([&, t]() {
+                try {
+                    CoordinatorOptions coordinatorOptions;
+                    coordinatorOptions.batchSize = options.batch;
+                    coordinatorOptions.pipelineDepth = options.pipeline;
+                    coordinatorOptions.connections = options.connections;
+                    coordinatorOptions.log.echo = false;
+                    coordinatorOptions.log.level = options.logLevel;
+                    Coordinator coordinator(directory + "/coordinator" +
+                                            to_string(t) + ".txt",
+                                            coordinatorOptions);
+                    Samples &mine = samples[t];
+                    coordinator.observeWindows([&mine](const WindowTiming &w) {
+                        // every transaction of a window waits for all of it
+                        auto total = w.vote + w.logSync + w.decision;
+                        mine.vote.insert(mine.vote.end(), w.transactions,
+                                         w.vote.count());
+                        mine.logSync.insert(mine.logSync.end(),
+                                            w.transactions,
+                                            w.logSync.count());
+                        mine.decision.insert(mine.decision.end(),
+                                             w.transactions,
+                                             w.decision.count());
+                        mine.total.insert(mine.total.end(), w.transactions,
+                                          total.count());
+                        mine.transactions += w.transactions;
+                        mine.committed += w.committed;
+                    });
+                    coordinator.runTransfers(work[t]);
+                } catch (const exception &e) {
+                    errors[t] = e.what();
+                }
+            });
+        }
+        for (auto &worker: threads)
+            worker.join();
+        auto elapsed = chrono::steady_clock::now() - start;
+        for (const auto &error: errors)
+            if (!error.empty())
+                throw runtime_error("Coordinator thread failed: " + error);
+
+        stopParticipants(pids);
+        pids.clear();
+        report(options, samples, elapsed);
+    }
+    catch (const exception &e) {
+        cerr << e.what() << endl;
+        stopParticipants(pids);
+        return EXIT_FAILURE;
+    }
+    if (!options.keep)
+        filesystem::remove_all(directory);
+    else
+        cerr << "Kept " << directory << endl;
+    return EXIT_SUCCESS;
+}
+
+void parseOptions(int argc, char *argv[], LoadOptions &options) {
+    for (int i = 1; i < argc; i += 2) {
+        string option = argv[i];
+        if (option == "--help" || i + 1 >= argc)
+            throw runtime_error(
+                    "Usage: loadgen [--participants N] [--accounts N] "
+                    "[--transfers N] [--threads N] [--zipf S] "
+                    "[--abort-ratio R] [--batch N] [--pipeline N] "
+                    "[--connections N] [--shards N] [--base-port N] "
+                    "[--seed N] [--participant path] [--dir path] "
+                    "[--keep 0|1] [--log-level N]");
+        string text = argv[i + 1];
+        if (option == "--participant") {
+            options.participant = text;
+            continue;
+        }
+        if (option == "--dir") {
+            options.directory = text;
+            continue;
+        }
+        double value;
+        try {
+            value = stod(text);
+        }
+        catch (const exception &) {
+            throw runtime_error("Invalid value for " + option + ": " + text);
+        }
+        bool fraction = option == "--zipf" || option == "--abort-ratio";
+        bool zeroAllowed = fraction || option == "--keep" ||
+                           option == "--log-level";
+        if (value < 0 || (value == 0 && !zeroAllowed) ||
+            (!fraction && value != static_cast<double>(
+                    static_cast<uint64_t>(value))) ||
+            (option == "--abort-ratio" && value > 1) ||
+            (option == "--keep" && value > 1) ||
+            (option == "--log-level" && value > static_cast<double>(LOG_ERROR)) ||
+            (option == "--base-port" && value > 65535))
+            throw runtime_error("Invalid value for " + option + ": " + text);
+        auto count = static_cast<size_t>(value);
+        if (option == "--participants")
+            options.participants = static_cast<unsigned>(count);
+        else if (option == "--accounts")
+            options.accounts = count;
+        else if (option == "--transfers")
+            options.transfers = count;
+        else if (option == "--threads")
+            options.threads = static_cast<unsigned>(count);
+        else if (option == "--zipf")
+            options.zipf = value;
+        else if (option == "--abort-ratio")
+            options.abortRatio = value;
+        else if (option == "--batch")
+            options.batch = count;
+        else if (option == "--pipeline")
+            options.pipeline = count;
+        else if (option == "--connections")
+            options.connections = count;
+        else if (option == "--shards")
+            options.shards = static_cast<unsigned>(count);
+        else if (option == "--base-port")
+            options.basePort = static_cast<u_short>(count);
+        else if (option == "--seed")
+            options.seed = count;
+        else if (option == "--keep")
+            options.keep = count != 0;
+        else if (option == "--log-level")
+            options.logLevel = static_cast<LogLevel>(count);
+        else
+            throw runtime_error("Unknown option: " + option);
+    }
+    if (options.basePort + options.participants > 65536)
+        throw runtime_error("Not enough ports above --base-port");
+    if (options.accounts < 2)
+        throw runtime_error("A participant needs at least 2 accounts");
+}
+
+void writeAccounts(const LoadOptions &options, const string &directory) {
+    for (unsigned p = 0; p < options.participants; p++) {
+        string filename = directory + "/accounts" + to_string(p) + ".txt";
+        ofstream file(filename);
+        // rich enough that skewed transfers never run an account dry
+        for (size_t a = 0; a < options.accounts; a++)
+            file << "1000000.00 a" << a << '\n';
+        if (!file)
+            throw runtime_error("Unable to write " + filename);
+    }
+}
+
+vector<vector<Transfer>> generate(const LoadOptions &options) {
+    mt19937_64 random(options.seed);
+    Zipf accounts(options.accounts, options.zipf);
+    uniform_int_distribution<unsigned> participant(0,
+                                                   options.participants - 1);
+    uniform_int_distribution<int64_t> cents(100, 10000);
+    bernoulli_distribution aborts(options.abortRatio);
+
+    vector<vector<Transfer>> work(options.threads);
+    for (size_t i = 0; i < options.transfers; i++) {
+        unsigned from = participant(random), to = from;
+        while (options.participants > 1 && to == from)
+            to = participant(random);
+        size_t accountFrom = accounts(random), accountTo = accountFrom;
+        while (from == to && accountTo == accountFrom)
+            accountTo = accounts(random);
+        Transfer transfer{Money::fromCents(cents(random)),
+                          "127.0.0.1",
+                          static_cast<u_short>(options.basePort + from),
+                          "a" + to_string(accountFrom),
+                          "127.0.0.1",
+                          static_cast<u_short>(options.basePort + to),
+                          "a" + to_string(accountTo)};
+        if (aborts(random))
+            transfer.accountTo = "missing"; // the participant votes abort
+        work[i % options.threads].push_back(move(transfer));
+    }
+    return work;
+}
+
+pid_t startParticipant(const LoadOptions &options, const string &directory,
+                       unsigned index) {
+    auto port = static_cast<u_short>(options.basePort + index);
+    string number = to_string(index);
+    vector<string> arguments = {
+            options.participant, to_string(port),
+            directory + "/accounts" + number + ".txt",
+            directory + "/log" + number + ".txt",
+            "--log-echo", "0",
+            "--log-level", to_string(options.logLevel),
+            "--shards", to_string(options.shards)};
+    string output = directory + "/participant" + number + ".out";
+    pid_t pid = fork();
+    if (pid < 0)
+        throw runtime_error(string("Unable to fork: ") + strerror(errno));
+    if (pid == 0) {
+        // its console output would garble the report
+        int out = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        dup2(out, STDOUT_FILENO);
+        dup2(out, STDERR_FILENO);
+        vector<char *> argv;
+        for (auto &argument: arguments)
+            argv.push_back(argument.data());
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        cerr << "Unable to run " << options.participant << ": "
+             << strerror(errno) << endl;
+        _exit(127);
+    }
+
+    // ready once it accepts a connection
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+    while (chrono::steady_clock::now() < deadline) {
+        int probe = socket(AF_INET, SOCK_STREAM, 0);
+        bool up = connect(probe, reinterpret_cast<sockaddr *>(&address),
+                          sizeof(address)) == 0;
+        close(probe);
+        if (up)
+            return pid;
+        if (waitpid(pid, nullptr, WNOHANG) == pid)
+            break;
+        this_thread::sleep_for(chrono::milliseconds(20));
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    throw runtime_error("Participant on port " + to_string(port) +
+                        " did not start, see " + output);
+}
+
+void stopParticipants(const vector<pid_t> &pids) {
+    for (pid_t pid: pids)
+        kill(pid, SIGINT);
+    for (pid_t pid: pids)
+        waitpid(pid, nullptr, 0);
+}
+
+/**
+ * Writes "name": {"p50": .., "p99": .., "p999": .., "max": ..} of samples
+ * in microseconds
+ */
+static void percentiles(ostream &out, const string &name,
+                        vector<int64_t> &values) {
+    sort(values.begin(), values.end());
+    auto at = [&values](double p) {
+        if (values.empty())
+            return 0.0;
+        auto rank = static_cast<size_t>(ceil(p * values.size()));
+        return values[max<size_t>(rank, 1) - 1] / 1000.0;
+    };
+    out << "    \"" << name << "\": {\"p50\": " << at(0.5)
+        << ", \"p99\": " << at(0.99) << ", \"p999\": " << at(0.999)
+        << ", \"max\": " << at(1.0) << "}";
+}
+
+void report(const LoadOptions &options, const vector<Samples> &samples,
+            chrono::nanoseconds elapsed) {
+    Samples all;
+    for (const auto &mine: samples) {
+        all.vote.insert(all.vote.end(), mine.vote.begin(), mine.vote.end());
+        all.logSync.insert(all.logSync.end(), mine.logSync.begin(),
+                           mine.logSync.end());
+        all.decision.insert(all.decision.end(), mine.decision.begin(),
+                            mine.decision.end());
+        all.total.insert(all.total.end(), mine.total.begin(),
+                         mine.total.end());
+        all.transactions += mine.transactions;
+        all.committed += mine.committed;
+    }
+    double seconds = chrono::duration<double>(elapsed).count();
+
+    ostringstream out;
+    out << fixed << setprecision(1);
+    out << "{\n  \"config\": {\"participants\": " << options.participants
+        << ", \"accounts\": " << options.accounts
+        << ", \"transfers\": " << options.transfers
+        << ", \"threads\": " << options.threads
+        << ", \"zipf\": " << setprecision(3) << options.zipf
+        << ", \"abort_ratio\": " << options.abortRatio << setprecision(1)
+        << ", \"batch\": " << options.batch
+        << ", \"pipeline\": " << options.pipeline
+        << ", \"connections\": " << options.connections
+        << ", \"shards\": " << options.shards
+        << ", \"seed\": " << options.seed << "},\n"
+        << "  \"elapsed_s\": " << setprecision(3) << seconds
+        << setprecision(1) << ",\n"
+        << "  \"transactions\": " << all.transactions << ",\n"
+        << "  \"committed_transfers\": " << all.committed << ",\n"
+        << "  \"failed_transfers\": " << options.transfers - all.committed
+        << ",\n"
+        << "  \"transfers_per_s\": " << all.committed / seconds << ",\n"
+        << "  \"transactions_per_s\": " << all.transactions / seconds
+        << ",\n"
+        << "  \"latency_us\": {\n";
+    percentiles(out, "vote", all.vote);
+    out << ",\n";
+    percentiles(out, "log_sync", all.logSync);
+    out << ",\n";
+    percentiles(out, "decision", all.decision);
+    out << ",\n";
+    percentiles(out, "total", all.total);
+    out << "\n  }\n}\n";
+    cout << out.str();
+}
@@ -0,0 +1,441 @@
+/**
+ * @file microbench.cpp - microbenchmarks of the per-message hot paths:
+ * message encode and decode, protocol names, amounts, account lookups,
+ * accounts file loading, write-ahead log appends, diagnostic logging, metrics
+ * and trace recording, and whole transactions between in-process
+ * participants, which must not allocate once warmed up
+ * @author Nadezhda Chernova
+ */
+
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "2PC_Coordinator.h"
+#include "2PC_Participant.h"
+#include "AccountLoader.h"
+#include "AccountTable.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Microbench.h"
+#include "Money.h"
+#include "Tracer.h"
+#include "WireFormat.h"
+#include "WriteAheadLog.h"
+
+using namespace std;
+
+string scratch; // directory of the files the benchmarks write
+
+// operator new calls of all threads, counted by the replacements below
+atomic<uint64_t> allocations{0};
+
+// GCC takes the free() of memory from the replaced operator new for a
+// mismatch once it inlines them
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    if (void *memory = malloc(size == 0 ? 1 : size))
+        return memory;
+    throw bad_alloc();
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void *operator new(size_t size, align_val_t alignment) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    auto align = static_cast<size_t>(alignment);
+    if (void *memory = aligned_alloc(align, (size + align - 1) / align * align))
+        return memory;
+    throw bad_alloc();
+}
+
+void *operator new[](size_t size, align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void operator delete(void *memory) noexcept { free(memory); }
+
+void operator delete[](void *memory) noexcept { free(memory); }
+
+void operator delete(void *memory, size_t) noexcept { free(memory); }
+
+void operator delete[](void *memory, size_t) noexcept { free(memory); }
+
+void operator delete(void *memory, align_val_t) noexcept { free(memory); }
+
+void operator delete[](void *memory, align_val_t) noexcept { free(memory); }
+
+void operator delete(void *memory, size_t, align_val_t) noexcept {
+    free(memory);
+}
+
+void operator delete[](void *memory, size_t, align_val_t) noexcept {
+    free(memory);
+}
+
+#pragma GCC diagnostic pop
+
+/**
+ * @return account ids "acct0000000".."acct<n-1>", like those of a bank
+ */
+static vector<string> accountIds(size_t n) {
+    vector<string> ids(n);
+    char id[32];
+    for (size_t i = 0; i < n; i++) {
+        snprintf(id, sizeof(id), "acct%07zu", i);
+        ids[i] = id;
+    }
+    return ids;
+}
+
+/**
+ * @return a VOTE-REQUEST with legs over the given account ids
+ */
+static Message voteRequest(const vector<string> &ids, vector<Leg> &legs) {
+    legs.clear();
+    for (size_t i = 0; i < ids.size(); i++)
+        legs.push_back({ids[i], Money::fromCents(i % 2 ? 12345 : -12345)});
+    return {VOTE_REQUEST, 0x1234567890ULL, legs.data(), legs.size()};
+}
+
+static void encode(BenchState &state, WireMode mode) {
+    vector<string> ids = accountIds(static_cast<size_t>(state.arg()));
+    vector<Leg> legs;
+    Message message = voteRequest(ids, legs);
+    vector<char> out(maxEncodedSize(message));
+    while (state.keepRunning())
+        doNotOptimize(encodeMessage(mode, message, out.data()));
+}
+
+static void decode(BenchState &state, WireMode mode) {
+    vector<string> ids = accountIds(static_cast<size_t>(state.arg()));
+    vector<Leg> legs;
+    Message message = voteRequest(ids, legs);
+    vector<char> in(maxEncodedSize(message));
+    size_t size = encodeMessage(mode, message, in.data());
+    vector<Leg> decoded(MAX_LEGS);
+    Message out;
+    while (state.keepRunning()) {
+        doNotOptimize(decodeMessage(mode, in.data(), size, true, out,
+                                    decoded.data()));
+        doNotOptimize(out);
+    }
+}
+
+static void protocolNames(BenchState &state) {
+    vector<string> names;
+    for (uint8_t type = 0; type < PROTOCOL_OPCODES; type++)
+        names.emplace_back(toString(static_cast<Protocol>(type)));
+    size_t i = 0;
+    while (state.keepRunning()) {
+        doNotOptimize(toProtocol(names[i]));
+        i = i + 1 == names.size() ? 0 : i + 1;
+    }
+}
+
+static void formatAmount(BenchState &state) {
+    Money amount = Money::fromCents(123456789);
+    char out[32];
+    while (state.keepRunning()) {
+        doNotOptimize(amount.format(out));
+        doNotOptimize(out);
+    }
+}
+
+static void parseAmount(BenchState &state) {
+    string text = "1234567.89";
+    Money amount;
+    while (state.keepRunning()) {
+        doNotOptimize(Money::parse(text, amount));
+        doNotOptimize(amount);
+    }
+}
+
+static void lookup(BenchState &state) {
+    auto size = static_cast<size_t>(state.arg());
+    vector<string> ids = accountIds(size);
+    AccountTable accounts;
+    accounts.reserve(size);
+    for (const auto &id: ids)
+        accounts.insert(id) = Money::fromCents(100);
+    // random order, so large tables miss the cache like real traffic
+    vector<size_t> order(4096);
+    mt19937_64 random(1);
+    for (auto &i: order)
+        i = random() % size;
+    size_t i = 0;
+    while (state.keepRunning()) {
+        doNotOptimize(accounts.find(ids[order[i]]));
+        i = (i + 1) & (order.size() - 1);
+    }
+}
+
+static void loadAccounts(BenchState &state) {
+    const size_t lines = 1 << 20;
+    string filename = scratch + "/bench-accounts.txt";
+    {
+        vector<string> ids = accountIds(lines);
+        ofstream out(filename);
+        for (size_t i = 0; i < lines; i++)
+            out << i % 100000 << "." << i % 100 / 10 << i % 10 << " "
+                << ids[i] << "\n";
+    }
+    AccountLoader loader(static_cast<unsigned>(state.arg()));
+    state.setItemsPerIteration(lines);
+    size_t accounts = 0;
+    while (state.keepRunning())
+        loader.load(filename, [&](const AccountKey &, Money) {
+            accounts++;
+        });
+    doNotOptimize(accounts);
+    unlink(filename.c_str());
+}
+
+static void walAppend(BenchState &state) {
+    auto perSync = static_cast<size_t>(state.arg());
+    string filename = scratch + "/bench.wal";
+    unlink(filename.c_str());
+    {
+        WriteAheadLog wal(filename, chrono::microseconds(1000), 512);
+        state.setItemsPerIteration(perSync == 0 ? 1 : perSync);
+        size_t buffered = 0;
+        while (state.keepRunning()) {
+            if (perSync == 0) {
+                // append only; written out now and then, untimed
+                wal.append(WAL_COMMIT, 42, "acct0000001",
+                           Money::fromCents(100));
+                if (++buffered == 4096) {
+                    state.pauseTiming();
+                    wal.sync();
+                    buffered = 0;
+                    state.resumeTiming();
+                }
+                continue;
+            }
+            for (size_t i = 0; i < perSync; i++)
+                wal.append(WAL_COMMIT, 42, "acct0000001",
+                           Money::fromCents(100));
+            wal.sync();
+        }
+        state.pauseTiming();
+    }
+    unlink(filename.c_str());
+}
+
+static void logMessage(BenchState &state) {
+    string filename = scratch + "/bench-log.txt";
+    LoggerOptions options;
+    options.echo = false;
+    options.capacity = 1 << 16;
+    {
+        Logger logger(filename, options);
+        uint64_t txn = 7000000000000000000ULL;
+        while (state.keepRunning())
+            logger.log(LOG_INFO, "Transaction #" + to_string(txn++) +
+                                 " committed");
+        state.pauseTiming();
+    }
+    unlink(filename.c_str());
+}
+
+static void countEvent(BenchState &state) {
+    Counter counter;
+    while (state.keepRunning())
+        counter.add();
+    doNotOptimize(counter.value());
+}
+
+static void recordLatency(BenchState &state) {
+    Histogram histogram;
+    int64_t ns = 1;
+    while (state.keepRunning()) {
+        histogram.record(chrono::nanoseconds(ns));
+        ns = ns * 3 % 1000003; // spread over the buckets
+    }
+    doNotOptimize(histogram.snapshot().count);
+}
+
+static void recordSpan(BenchState &state) {
+    Tracer spans;
+    spans.enable();
+    auto start = chrono::steady_clock::now();
+    uint64_t txn = 1;
+    while (state.keepRunning())
+        spans.record(SPAN_VALIDATE, txn++, start, start, VOTE_REQUEST);
+}
+
+/**
+ * @return port of the first of two participants the transaction benchmarks
+ * start, serving on threads of their own until the process exits
+ */
+static u_short participants() {
+    static const u_short port = [] {
+        // another microbench running at the same time has another pid
+        auto first = static_cast<u_short>(20000 + getpid() % 20000 * 2);
+        ParticipantOptions options;
+        options.log.echo = false;
+        // a checkpoint flushes the account store and allocates; the
+        // benchmarks measure the message paths between checkpoints
+        options.checkpointEvery = SIZE_MAX;
+        for (u_short i = 0; i < 2; i++) {
+            string name = scratch + "/bench-participant" + to_string(i);
+            {
+                ofstream out(name + ".txt");
+                out << "1000000.00 acct0000000\n1000000.00 acct0000001\n";
+            }
+            // never deleted: the process ends while it still serves
+            auto participant = new Participant(first + i, name + ".txt",
+                                               name + "-log.txt", options);
+            thread([participant] { participant->serve(); }).detach();
+        }
+        return first;
+    }();
+    return port;
+}
+
+/**
+ * Runs 64 transfers of 1.00 per iteration through a coordinator, back and
+ * forth so the balances stay put, between the two participants or, with
+ * onePhase, within the first one
+ * @throws runtime_error if a transfer aborts, or if an iteration allocates
+ * anywhere in the process once the connections and buffers are warm
+ */
+static void transactions(BenchState &state, bool onePhase) {
+    const size_t count = 64;
+    u_short port = participants();
+    CoordinatorOptions options;
+    options.log.echo = false;
+    Coordinator coordinator(scratch + "/bench-coordinator-log.txt", options);
+    vector<Transfer> transfers(count);
+    for (size_t i = 0; i < count; i++) {
+        Transfer &transfer = transfers[i];
+        transfer.amount = Money::fromCents(100);
+        transfer.hostFrom = transfer.hostTo = "localhost";
+        transfer.portFrom = port;
+        transfer.portTo = onePhase ? port : port + 1;
+        transfer.accountFrom = i % 2 ? "acct0000001" : "acct0000000";
+        transfer.accountTo = i % 2 ? "acct0000000" : "acct0000001";
+    }
+    // opens the connections and sizes the arena, logs and buffers
+    for (int i = 0; i < 8; i++)
+        coordinator.runTransfers(transfers);
+
+    state.setItemsPerIteration(count);
+    uint64_t before = allocations.load();
+    size_t committed = 0, runs = 0;
+    while (state.keepRunning()) {
+        committed += coordinator.runTransfers(transfers);
+        runs++;
+    }
+    uint64_t allocated = allocations.load() - before;
+    if (committed != runs * count)
+        throw runtime_error(to_string(runs * count - committed) +
+                            " transfers aborted");
+    if (allocated > 0)
+        throw runtime_error(to_string(allocated) + " allocations in " +
+                            to_string(runs) + " runs of " + to_string(count) +
+                            " transfers");
+}
+
+/**
+ * Runs the microbenchmarks:
+ *   microbench [--filter text] [--min-time-ms N] [--json 0|1] [--dir path]
+ */
+int main(int argc, char *argv[]) {
+    try {
+        string filter, directory = "/tmp";
+        long minTime = 200;
+        bool json = false;
+        for (int i = 1; i < argc; i += 2) {
+            string option = argv[i];
+            if (i + 1 >= argc)
+                throw runtime_error("Usage: microbench [--filter text] "
+                                    "[--min-time-ms N] [--json 0|1] "
+                                    "[--dir path]");
+            string value = argv[i + 1];
+            if (option == "--filter")
+                filter = value;
+            else if (option == "--dir")
+                directory = value;
+            else if (option == "--min-time-ms" || option == "--json") {
+                long number;
+                try {
+                    number = stol(value);
+                }
+                catch (const exception &) {
+                    throw runtime_error("Invalid value for " + option +
+                                        ": " + value);
+                }
+                if (number < 0 || (option == "--json" && number > 1))
+                    throw runtime_error("Invalid value for " + option +
+                                        ": " + value);
+                if (option == "--json")
+                    json = number != 0;
+                else
+                    minTime = number;
+            } else
+                throw runtime_error("Unknown option: " + option);
+        }
+        string pattern = directory + "/microbench.XXXXXX";
+        if (mkdtemp(pattern.data()) == nullptr)
+            throw runtime_error("Unable to create a directory in " +
+                                directory + ": " + strerror(errno));
+        scratch = pattern;
+
+        Microbench bench;
+        bench.add("wire/encode-binary",
+                  [](BenchState &s) { encode(s, BINARY_MODE); }, {1, 16});
+        bench.add("wire/encode-text",
+                  [](BenchState &s) { encode(s, TEXT_MODE); }, {1, 16});
+        bench.add("wire/decode-binary",
+                  [](BenchState &s) { decode(s, BINARY_MODE); }, {1, 16});
+        bench.add("wire/decode-text",
+                  [](BenchState &s) { decode(s, TEXT_MODE); }, {1, 16});
+        bench.add("protocol/to-protocol", protocolNames);
+        bench.add("money/format", formatAmount);
+        bench.add("money/parse", parseAmount);
+        bench.add("accounts/find", lookup, {1000, 100000, 1000000});
+        // per line of a 1M-line accounts file, on N threads
+        bench.add("accounts/load", loadAccounts, {1, 4});
+        // 0: append only; N: N appends and one fdatasync
+        bench.add("wal/append", walAppend, {0, 1, 64});
+        bench.add("logger/log", logMessage);
+        bench.add("metrics/counter-add", countEvent);
+        bench.add("metrics/histogram-record", recordLatency);
+        bench.add("trace/record", recordSpan);
+        // per transfer; fails if a warm run allocates
+        bench.add("txn/two-phase",
+                  [](BenchState &s) { transactions(s, false); });
+        bench.add("txn/one-phase",
+                  [](BenchState &s) { transactions(s, true); });
+
+        vector<BenchResult> results =
+                bench.run(filter, chrono::milliseconds(minTime));
+        filesystem::remove_all(scratch);
+        if (json)
+            Microbench::printJson(cout, results);
+        else
+            Microbench::printTable(cout, results);
+    }
+    catch (const exception &e) {
+        cerr << e.what() << endl;
+        if (!scratch.empty())
+            filesystem::remove_all(scratch);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -10,10 +10,17 @@
 #include <stdexcept>
 #include <memory>
 #include "2PC_Participant.h"
+#include "MetricsServer.h"
+#include "ShardedParticipant.h"
+#include "Tracer.h"
 
 using namespace std;
 
 unique_ptr<Participant> participant_ptr; // unique pointer to Participant obj
+unique_ptr<ShardedParticipant> sharded_ptr; // instead, with --shards N > 1
+unique_ptr<MetricsServer> admin_ptr; // metrics of all shards, --admin-port
+string trace_filename;               // spans dumped on exit, --trace-file
+string trace_process;                // process name in the trace
 
 /**
  * Validates and parses command-line arguments.
@@ -27,6 +34,29 @@ unique_ptr<Participant> participant_ptr; // unique pointer to Participant obj
 void validateArguments(int argc, char *argv[], int &serve_port,
                        string &accounts_filename, string &log_filename);
 
+/**
+ * Parses the optional arguments that follow the required ones:
+ *   --sync-window-us N     group commit latency window (microseconds)
+ *   --sync-batch N         buffered log records that force a sync
+ *   --checkpoint-every N   commits between account store checkpoints
+ *   --log-echo 0|1         echo the log on standard output
+ *   --log-level N          least severity logged: 0 debug .. 3 error
+ *   --shards N             reactor threads, each owning a partition of
+ *                          the accounts
+ *   --coordinator host:port  decision port of the coordinator asked for
+ *                          the outcome of in-doubt transactions whose
+ *                          requests did not name one
+ *   --inquiry-ms N         age of an in-doubt transaction before asking
+ *   --admin-port N         serve the metrics on port N
+ *   --trace-file path      trace the transactions coordinators trace and
+ *                          dump the spans to path on exit
+ * @param argc number of command-line arguments
+ * @param argv array of command-line arguments
+ * @param options ref to options to fill in
+ * @throws runtime_error if an option is unknown or its value is invalid
+ */
+void parseOptions(int argc, char *argv[], ParticipantOptions &options);
+
 /**
  * Signal handler for Ctrl-C (SIGINT).
  * It logs the receipt of the signal, rolls back any changes, stops the server
@@ -43,6 +73,19 @@ void signalHandler(int signum);
  */
 void handleServerError(const string &errorMessage);
 
+/**
+ * Dumps the spans of traced transactions to the --trace-file, if any
+ */
+void dumpTrace();
+
+/**
+ * Converts a text accounts file to the binary account store a participant
+ * maps (see AccountStore), once, ahead of its first start
+ * @param from text accounts file to read
+ * @param to account store to write, e.g. acc1.acct for acc1.txt
+ */
+void convertAccountsFile(const string &from, const string &to);
+
 /**
  * Main function initializes Participant program, validates command-line
  * arguments, creates a Participant object, and starts the TCP server to handle
@@ -56,6 +99,14 @@ void handleServerError(const string &errorMessage);
  */
 int main(int argc, char *argv[]) {
     try {
+        if (argc > 1 && string(argv[1]) == "--convert") {
+            if (argc != 4)
+                throw runtime_error("Usage: participant --convert acc1.txt "
+                                    "acc1.acct");
+            convertAccountsFile(argv[2], argv[3]);
+            return EXIT_SUCCESS;
+        }
+
         // Declare variables for validation
         int serve_port;
         string accounts_filename, log_filename;
@@ -63,19 +114,42 @@ int main(int argc, char *argv[]) {
         // Validate and parse command-line arguments
         validateArguments(argc, argv, serve_port, accounts_filename,
                           log_filename);
+        ParticipantOptions options;
+        parseOptions(argc, argv, options);
+        if (!options.traceFile.empty()) {
+            tracer().enable();
+            trace_filename = options.traceFile;
+            trace_process = "participant " + to_string(serve_port);
+        }
 
         // Create a Participant object and start the server
-        participant_ptr = make_unique<Participant>(serve_port, argv[2],
-                                                   argv[3]);
+        if (options.shards > 1)
+            sharded_ptr = make_unique<ShardedParticipant>(serve_port, argv[2],
+                                                          argv[3], options);
+        else
+            participant_ptr = make_unique<Participant>(serve_port, argv[2],
+                                                       argv[3], options);
 
+        if (options.adminPort != 0)
+            admin_ptr = make_unique<MetricsServer>(options.adminPort,
+                                                   metrics());
         // Register signal handler for Ctrl-C
         signal(SIGINT, signalHandler);
 
         ostringstream note;
-        note << "\nTransaction service on port " << serve_port
-             << " (Ctrl-C to stop)";
-        participant_ptr->log(note.str());
-        participant_ptr->serve();
+        note << "\nTransaction service on port " << serve_port;
+        if (admin_ptr)
+            note << ", metrics on port " << options.adminPort;
+        if (!trace_filename.empty())
+            note << ", tracing to " << trace_filename;
+        note << " (Ctrl-C to stop)";
+        if (sharded_ptr) {
+            sharded_ptr->log(note.str());
+            sharded_ptr->serve();
+        } else {
+            participant_ptr->log(note.str());
+            participant_ptr->serve();
+        }
     }
     catch (const exception &e) {
         handleServerError("Error. " + string(e.what()));
@@ -99,15 +173,49 @@ void handleServerError(const string &errorMessage) {
     if (participant_ptr) {
         participant_ptr->log(errorMessage);
         participant_ptr->stop();
+    } else if (sharded_ptr) {
+        sharded_ptr->log(errorMessage);
+        sharded_ptr->stop();
+    }
+    dumpTrace();
+}
+
+void dumpTrace() {
+    if (trace_filename.empty())
+        return;
+    try {
+        size_t spans = tracer().dump(trace_filename, trace_process);
+        cerr << "Wrote " << spans << " spans to " << trace_filename << endl;
+    }
+    catch (const exception &e) {
+        cerr << e.what() << endl;
     }
 }
 
+void convertAccountsFile(const string &from, const string &to) {
+    AccountTable accounts;
+    AccountLoad load = Participant::readAccountsFile(
+            from, [&](const AccountKey &key, Money balance) {
+                accounts.insert(key) = balance;
+            }, [&](size_t count) { accounts.reserve(count); });
+    cout << "Read " << from << ": " << load.summary() << endl;
+    AccountStore::create(to, accounts, load.lsn);
+    cout << "Converted " << accounts.size() << " accounts to " << to << endl;
+}
+
 void validateArguments(int argc, char *argv[], int &serve_port,
                        string &accounts_filename, string &log_filename) {
     // Check if the correct number of arguments is provided
     if (argc < 4)
         throw runtime_error("Usage: participant serve_port "
-                            "accounts_filename log_filename");
+                            "accounts_filename log_filename "
+                            "[--sync-window-us N] [--sync-batch N] "
+                            "[--checkpoint-every N] [--log-echo 0|1] "
+                            "[--log-level N] [--shards N] "
+                            "[--coordinator host:port] [--inquiry-ms N] "
+                            "[--admin-port N] [--trace-file path]\n"
+                            "       participant --convert acc1.txt "
+                            "acc1.acct");
 
     accounts_filename = argv[2];
     log_filename = argv[3];
@@ -136,4 +244,68 @@ void validateArguments(int argc, char *argv[], int &serve_port,
                 "Accounts file must have a .txt extension: " +
                 accounts_filename);
     }
-}
\ No newline at end of file
+}
+
+void parseOptions(int argc, char *argv[], ParticipantOptions &options) {
+    for (int i = 4; i < argc; i += 2) {
+        string option = argv[i];
+        if (i + 1 >= argc)
+            throw runtime_error("Missing value for " + option);
+        if (option == "--coordinator") {
+            string address = argv[i + 1];
+            size_t colon = address.find_last_of(':');
+            long port = 0;
+            try {
+                if (colon != string::npos)
+                    port = stol(address.substr(colon + 1));
+            }
+            catch (const exception &) {
+            }
+            if (colon == 0 || port < 1 || port > 65535)
+                throw runtime_error("Invalid value for " + option + ": " +
+                                    address);
+            options.coordinatorHost = address.substr(0, colon);
+            options.coordinatorPort = static_cast<u_short>(port);
+            continue;
+        }
+        if (option == "--trace-file") {
+            options.traceFile = argv[i + 1];
+            continue;
+        }
+        long value;
+        try {
+            value = stol(argv[i + 1]);
+        }
+        catch (const exception &) {
+            throw runtime_error("Invalid value for " + option + ": " +
+                                string(argv[i + 1]));
+        }
+        bool zeroAllowed = option == "--sync-window-us" ||
+                           option == "--log-echo" || option == "--log-level";
+        if (value < 0 || (value == 0 && !zeroAllowed) ||
+            (option == "--log-echo" && value > 1) ||
+            (option == "--log-level" && value > LOG_ERROR) ||
+            (option == "--admin-port" && value > 65535))
+            throw runtime_error("Invalid value for " + option + ": " +
+                                string(argv[i + 1]));
+
+        if (option == "--sync-window-us")
+            options.syncWindow = chrono::microseconds(value);
+        else if (option == "--sync-batch")
+            options.syncBatch = value;
+        else if (option == "--checkpoint-every")
+            options.checkpointEvery = value;
+        else if (option == "--log-echo")
+            options.log.echo = value != 0;
+        else if (option == "--log-level")
+            options.log.level = static_cast<LogLevel>(value);
+        else if (option == "--shards")
+            options.shards = static_cast<unsigned>(value);
+        else if (option == "--inquiry-ms")
+            options.inquiryAfter = chrono::milliseconds(value);
+        else if (option == "--admin-port")
+            options.adminPort = static_cast<u_short>(value);
+        else
+            throw runtime_error("Unknown option: " + option);
+    }
+}